@@ -0,0 +1,157 @@
+#pragma once
+
+#include "Frustum.h"
+#include "Model.h"
+
+#include <JobSystem.h>
+#include <FrameArena.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+namespace RenderCommon
+{
+	// Sampled on the main thread once per frame, after input
+	struct FrameInput
+	{
+		double time = 0;
+		glm::mat4 view{ 1.0f };
+		glm::mat4 projection{ 1.0f };
+		glm::vec3 cameraPosition{};
+
+		std::chrono::steady_clock::time_point sampleTime{};
+	};
+
+	struct ModelState
+	{
+		glm::mat4 model{ 1.0f };
+		bool visible = true;
+		std::vector<bool> meshVisible;
+		// Empty for simple and culled models
+		std::vector<glm::mat4> bones;
+	};
+
+	// Everything a backend reads to render a frame, not modified once simulated
+	struct FrameSnapshot
+	{
+		FrameInput input;
+		std::vector<ModelState> models;
+
+		std::uint64_t drawnModels = 0;
+		std::uint64_t culledModels = 0;
+	};
+
+	// Model matrices, frustum culling and poses of the visible models, in chunks on the job system.
+	// models are the backend's model structs with position, scale, info.simpleModel and model.
+	// zeroToOneDepth selects the Vulkan clip volume, see Frustum::fromMatrix
+	template<class Models>
+	void simulateFrame(const FrameInput& input, Models& models, bool frustumCulling, bool zeroToOneDepth, utils::JobSystem& jobs, FrameSnapshot& snapshot)
+	{
+		using ModelCounts = std::pair<std::uint64_t, std::uint64_t>;
+
+		auto frustum = Frustum::fromMatrix(input.projection * input.view, zeroToOneDepth);
+
+		snapshot.input = input;
+		snapshot.models.resize(models.size());
+
+		// A skinned model is expensive enough to be stolen on its own
+		auto counts = jobs.parallelReduce(0, models.size(), 1, ModelCounts{}, [&](size_t begin, size_t end) {
+			ModelCounts chunkCounts{};
+			utils::FrameVector<aiMatrix4x4> transforms;
+
+			for (size_t i = begin; i < end; ++i)
+			{
+				auto& model = models[i];
+				ModelState& state = snapshot.models[i];
+
+				glm::mat4 modelMat = glm::mat4(1.0f);
+				modelMat = glm::translate(modelMat, model.position);
+				modelMat = glm::scale(modelMat, model.scale);
+
+				if (model.info.simpleModel)
+					modelMat = glm::rotate(modelMat, (float)input.time, glm::vec3(0.5f, 1.0f, 0.0f));
+
+				state.model = modelMat;
+				state.meshVisible.assign(model.model->meshes.size(), true);
+				state.visible = true;
+				state.bones.clear();
+
+				if (frustumCulling)
+				{
+					for (size_t j = 0; j < state.meshVisible.size(); ++j)
+						state.meshVisible[j] = frustum.intersectsSphere(transformSphere(modelMat, model.model->meshes[j].m_boundingSphere));
+
+					// No pose either when nothing of the model is visible
+					if (std::none_of(state.meshVisible.begin(), state.meshVisible.end(), [](bool visible) { return visible; }))
+					{
+						state.visible = false;
+						++chunkCounts.second;
+						continue;
+					}
+				}
+
+				++chunkCounts.first;
+
+				if (model.info.simpleModel)
+					continue;
+
+				transforms.resize(model.model->BoneCount());
+				if (!model.model->BoneTransform((float)input.time, transforms.data()))
+					continue;
+
+				state.bones.resize(transforms.size());
+				for (size_t j = 0; j < transforms.size(); ++j)
+					state.bones[j] = Assimp2Glm(transforms[j]);
+			}
+
+			return chunkCounts;
+		}, [](ModelCounts total, ModelCounts chunk) {
+			return ModelCounts{ total.first + chunk.first, total.second + chunk.second };
+		});
+
+		snapshot.drawnModels = counts.first;
+		snapshot.culledModels = counts.second;
+	}
+
+	// Simulates the same frame on job systems of every worker count of utils::workerCountSweep and prints the time
+	// per frame and the scaling knee. Runs on the calling thread's own job systems, the shared one isn't touched
+	template<class Models>
+	void benchmarkSimulationScaling(const char* backend, const FrameInput& input, Models& models, bool frustumCulling, bool zeroToOneDepth)
+	{
+		constexpr int rounds = 50;
+
+		if (models.empty())
+			return;
+
+		FrameSnapshot snapshot;
+		std::vector<std::pair<size_t, double>> msByWorkers;
+
+		std::cout << backend << " simulation of " << models.size() << " models, ms per frame by workers:";
+
+		for (size_t workers : utils::workerCountSweep(std::max(std::thread::hardware_concurrency(), 1u)))
+		{
+			utils::JobSystem jobs{ workers };
+
+			// The first round grows the snapshot and the arenas
+			simulateFrame(input, models, frustumCulling, zeroToOneDepth, jobs, snapshot);
+
+			auto start = std::chrono::steady_clock::now();
+			for (int round = 0; round < rounds; ++round)
+				simulateFrame(input, models, frustumCulling, zeroToOneDepth, jobs, snapshot);
+
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+			msByWorkers.emplace_back(workers, ms);
+
+			std::cout << " " << workers << ": " << ms;
+		}
+
+		std::cout << ", knee at " << utils::scalingKnee(msByWorkers) << " workers" << std::endl;
+	}
+}
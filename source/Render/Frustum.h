@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <algorithm>
+
+namespace RenderCommon
+{
+	// View frustum as six planes (xyz - normal pointing inside, w - distance)
+	struct Frustum
+	{
+		std::array<glm::vec4, 6> planes;
+
+		// Gribb-Hartmann extraction. zeroToOneDepth selects the Vulkan clip volume (0 <= z <= w) instead of OpenGL's (-w <= z <= w)
+		static Frustum fromMatrix(const glm::mat4& viewProj, bool zeroToOneDepth)
+		{
+			glm::vec4 row0{ viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0] };
+			glm::vec4 row1{ viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1] };
+			glm::vec4 row2{ viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2] };
+			glm::vec4 row3{ viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3] };
+
+			Frustum frustum;
+			frustum.planes[0] = row3 + row0;
+			frustum.planes[1] = row3 - row0;
+			frustum.planes[2] = row3 + row1;
+			frustum.planes[3] = row3 - row1;
+			frustum.planes[4] = zeroToOneDepth ? row2 : row3 + row2;
+			frustum.planes[5] = row3 - row2;
+
+			for (auto& plane : frustum.planes)
+				plane /= glm::length(glm::vec3(plane));
+
+			return frustum;
+		}
+
+		bool intersectsSphere(const glm::vec4& sphere) const
+		{
+			for (auto& plane : planes)
+				if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w)
+					return false;
+
+			return true;
+		}
+	};
+
+	// Moves a bounding sphere (xyz - center, w - radius) into the space of the given matrix
+	inline glm::vec4 transformSphere(const glm::mat4& transform, const glm::vec4& sphere)
+	{
+		glm::vec3 center = transform * glm::vec4(glm::vec3(sphere), 1.0f);
+
+		float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+
+		return glm::vec4(center, sphere.w * scale);
+	}
+}
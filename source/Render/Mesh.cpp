@@ -1,5 +1,7 @@
 #include "Mesh.h"
 
+#include <algorithm>
+
 namespace RenderCommon
 {
 	Mesh::~Mesh()
@@ -11,7 +13,25 @@ namespace RenderCommon
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<Texture> textures) :
 		m_vertices{ std::move(vertices) }, m_indices{ std::move(indices) }, m_textures{ std::move(textures) }
 	{
+		if (m_vertices.empty())
+			return;
+
+		glm::vec3 min = m_vertices[0].Position;
+		glm::vec3 max = m_vertices[0].Position;
+
+		for (auto& vertex : m_vertices)
+		{
+			min = glm::min(min, vertex.Position);
+			max = glm::max(max, vertex.Position);
+		}
+
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = 0.f;
+
+		for (auto& vertex : m_vertices)
+			radius = std::max(radius, glm::length(vertex.Position - center));
 
+		m_boundingSphere = glm::vec4(center, radius);
 	}
 
 	std::string Texture::toString(Type type)
@@ -38,5 +38,8 @@ namespace RenderCommon
         std::vector<Vertex>   m_vertices;
         std::vector<uint32_t> m_indices;
         std::vector<Texture>  m_textures;
+
+        // Bind pose bounds in mesh space: xyz - center, w - radius
+        glm::vec4 m_boundingSphere{};
     };
 }
\ No newline at end of file
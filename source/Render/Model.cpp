@@ -5,6 +5,8 @@
 #include <stdexcept>
 #include "stb_image.h"
 #include <filesystem>
+#include <string_view>
+#include <algorithm>
 #include "stb_image.h"
 
 using namespace std::literals;
@@ -59,8 +61,71 @@ namespace RenderCommon
 		
 
         processNode(scene->mRootNode, scene);
+
+		// Instances of a model share the animation, so its poses are sampled once
+		static std::map<std::pair<std::string, int>, std::vector<glm::vec4>> animatedBounds;
+
+		auto boundsKey = std::make_pair(path.string(), animationNumber);
+		auto boundsIt = animatedBounds.find(boundsKey);
+		if (boundsIt == animatedBounds.end())
+		{
+			fitAnimatedBounds();
+
+			std::vector<glm::vec4> spheres;
+			for (const Mesh& mesh : meshes)
+				spheres.push_back(mesh.m_boundingSphere);
+
+			boundsIt = animatedBounds.emplace(boundsKey, std::move(spheres)).first;
+		}
+
+		for (size_t i = 0; i < meshes.size(); ++i)
+			meshes[i].m_boundingSphere = boundsIt->second[i];
     }
 
+	void Model::fitAnimatedBounds()
+	{
+		const aiScene* scene = m_import->GetScene();
+		if (scene->mNumAnimations == 0 || m_NumBones == 0)
+			return;
+
+		const aiAnimation* animation = scene->mAnimations[m_animationNumber];
+		float ticksPerSecond = animation->mTicksPerSecond != 0 ? (float)animation->mTicksPerSecond : 25.0f;
+		float durationSeconds = (float)animation->mDuration / ticksPerSecond;
+
+		std::vector<aiMatrix4x4> transforms(m_NumBones);
+		std::vector<glm::mat4> bones(m_NumBones);
+
+		for (int sample = 0; sample < AnimatedBoundsSamples; ++sample)
+		{
+			BoneTransform(durationSeconds * sample / AnimatedBoundsSamples, transforms.data());
+			for (size_t i = 0; i < bones.size(); ++i)
+				bones[i] = Assimp2Glm(transforms[i]);
+
+			// The center stays where the bind pose put it, the radius grows to the farthest skinned vertex
+			for (Mesh& mesh : meshes)
+			{
+				glm::vec3 center{ mesh.m_boundingSphere };
+				float radius = mesh.m_boundingSphere.w;
+
+				for (const Vertex& vertex : mesh.m_vertices)
+				{
+					// Bone slots are filled from the first one, so this vertex isn't skinned
+					if (vertex.Weights[0] == 0.0f)
+						continue;
+
+					// Same blend as the vertex shaders
+					glm::mat4 skin{ 0.0f };
+					for (size_t i = 0; i < Vertex::c_maxBonePerVertexCount && vertex.Weights[i] != 0.0f; ++i)
+						skin += bones[vertex.BoneIDs[i]] * vertex.Weights[i];
+
+					radius = std::max(radius, glm::length(glm::vec3(skin * glm::vec4(vertex.Position, 1.0f)) - center));
+				}
+
+				mesh.m_boundingSphere.w = radius;
+			}
+		}
+	}
+
     void Model::processNode(aiNode* node, const aiScene* scene)
     {
         // process all the node's meshes (if any)
@@ -172,6 +237,7 @@ namespace RenderCommon
             textures.push_back(std::move(meshTexture));
         }
 
+        // Skinned meshes are refitted to their animation by fitAnimatedBounds
         return Mesh(std::move(vertices), std::move(indices), std::move(textures));
     }
 
@@ -180,6 +246,15 @@ namespace RenderCommon
 		if (m_import->GetScene()->mNumAnimations == 0)
 			return;
 
+		Transforms.resize(m_NumBones);
+		BoneTransform(TimeInSeconds, Transforms.data());
+	}
+
+	bool Model::BoneTransform(float TimeInSeconds, aiMatrix4x4* Transforms)
+	{
+		if (m_import->GetScene()->mNumAnimations == 0)
+			return false;
+
 		aiMatrix4x4 Identity;
 
 		float TicksPerSecond = (float)(m_import->GetScene()->mAnimations[m_animationNumber]->mTicksPerSecond != 0 ? m_import->GetScene()->mAnimations[m_animationNumber]->mTicksPerSecond : 25.0f);
@@ -188,11 +263,11 @@ namespace RenderCommon
 
 		ReadNodeHeirarchy(AnimationTime, m_import->GetScene()->mRootNode, Identity);
 
-		Transforms.resize(m_NumBones);
-
 		for (int i = 0; i < m_NumBones; i++) {
 			Transforms[i] = m_BoneInfo[i].FinalTransformation;
 		}
+
+		return true;
 	}
 
 	unsigned char* Model::loadTexture(const std::string& path, int& width, int& height)
@@ -229,7 +304,8 @@ namespace RenderCommon
 
 	void Model::ReadNodeHeirarchy(float AnimationTime, const aiNode* pNode, const aiMatrix4x4& ParentTransform)
 	{
-		std::string NodeName(pNode->mName.data);
+		// Runs for every node of every animated model each frame, so the name isn't copied
+		std::string_view NodeName(pNode->mName.data, pNode->mName.length);
 
 		const aiAnimation* pAnimation = m_import->GetScene()->mAnimations[m_animationNumber];
 
@@ -272,8 +348,8 @@ namespace RenderCommon
 
 		aiMatrix4x4 GlobalTransformation = ParentTransform * NodeTransformation;
 
-		if (m_BoneMapping.find(NodeName) != m_BoneMapping.end()) {
-			int BoneIndex = m_BoneMapping[NodeName];
+		if (auto boneIt = m_BoneMapping.find(NodeName); boneIt != m_BoneMapping.end()) {
+			int BoneIndex = boneIt->second;
 			m_BoneInfo[BoneIndex].FinalTransformation = m_GlobalInverseTransform * GlobalTransformation * m_BoneInfo[BoneIndex].BoneOffset;
 		}
 
@@ -31,6 +31,9 @@ namespace RenderCommon
         Model(std::filesystem::path path, std::vector<std::pair<std::filesystem::path, Texture::Type>> textures, int animationNumber);
         
         void BoneTransform(float TimeInSeconds, std::vector<aiMatrix4x4>& Transforms);
+        // Writes BoneCount() matrices, nothing and returns false when the model has no animation
+        bool BoneTransform(float TimeInSeconds, aiMatrix4x4* Transforms);
+        std::size_t BoneCount() const { return m_NumBones; }
 
         static unsigned char* loadTexture(const std::string& path, int& width, int& height);
 
@@ -38,11 +41,17 @@ namespace RenderCommon
     private:
         Assimp::Importer* m_import;
 
-        std::map<std::string, std::uint32_t> m_BoneMapping; // maps a bone name to its index
+        std::map<std::string, std::uint32_t, std::less<>> m_BoneMapping; // maps a bone name to its index
         std::uint32_t m_NumBones = 0;
         std::vector<BoneInfo> m_BoneInfo;
         aiMatrix4x4 m_GlobalInverseTransform;
 
+        // Poses of the animation sampled at load to grow the bounding spheres of skinned meshes, evenly spaced over
+        // its duration. Culling uses the spheres, so a pose between two samples can only stick out by the motion
+        // within 1 / AnimatedBoundsSamples of the animation
+        static constexpr int AnimatedBoundsSamples = 32;
+        void fitAnimatedBounds();
+
         void processNode(aiNode* node, const aiScene* scene);
         Mesh processMesh(aiMesh* mesh, const aiScene* scene);
 
@@ -3,6 +3,67 @@
 #include <string>
 #include <vector>
 
+struct RenderSettings
+{
+	// Per-instance data in storage buffers and indirect draws. Vulkan: instead of per-model secondary command buffers.
+	// OpenGL: shared geometry, persistently mapped buffers and glMultiDrawElementsIndirect instead of a draw per mesh
+	bool gpuDriven = false;
+
+	// Skip models outside of the view frustum. GPU-driven Vulkan mode culls in a compute shader
+	bool frustumCulling = false;
+
+	// GPU-driven Vulkan mode only: also test against a depth pyramid of the previous frame
+	bool occlusionCulling = false;
+
+	// GPU-driven Vulkan mode only: run culling on a separate compute queue when the device has one
+	bool asyncCompute = true;
+
+	// Vulkan: number of frames the CPU may record ahead of the GPU (1-4)
+	int framesInFlight = 2;
+
+	// LowLatency waits for the previous frame before sampling input and keeps the swapchain short,
+	// MaxThroughput lets the CPU run up to framesInFlight frames ahead
+	enum class LatencyMode { MaxThroughput, LowLatency };
+	LatencyMode latencyMode = LatencyMode::MaxThroughput;
+
+	// Simulate frame N+1 (camera, transforms, culling, poses) on its own thread while frame N is rendered.
+	// Off: simulation and rendering run lock-step on the main thread. On: more throughput, a frame more input latency
+	bool pipelinedSimulation = false;
+
+	// OpenGL: the job system's workers write the per-instance data into the mapped buffers (bone palettes, GPU-driven
+	// matrices and indirect commands), the context thread only maps, binds and draws
+	bool parallelDrawPreparation = false;
+
+	// OpenGL: textures and geometry are streamed by a loader thread with a shared context, the render loop starts
+	// right away and draws placeholders until they are ready
+	bool asyncResourceLoading = false;
+
+	// Job system workers, 0 - one per hardware thread. The job system outlives a run and is recreated only when
+	// these change
+	int workerThreads = 0;
+
+	// Pin every worker to its own CPU
+	bool pinWorkerThreads = false;
+
+	// Vulkan present mode, falls back to FIFO when the surface doesn't support it
+	enum class PresentMode { Immediate, Mailbox, Fifo };
+	PresentMode presentMode = PresentMode::Immediate;
+
+	// Vulkan MSAA sample count (1, 2, 4 or 8), lowered to the highest count the device supports
+	int msaaSamples = 8;
+
+	// Vulkan secondary command buffer mode: how the per-model descriptors reach the draws.
+	// DescriptorSets writes every set once, UpdateTemplate rewrites the frame's set every frame with a descriptor
+	// update template, PushDescriptors pushes them into the command buffer (falls back to UpdateTemplate
+	// without VK_KHR_push_descriptor)
+	enum class DescriptorMode { DescriptorSets, UpdateTemplate, PushDescriptors };
+	DescriptorMode descriptorMode = DescriptorMode::DescriptorSets;
+
+	// Run the scaling microbenchmarks (job throughput, recording, simulation, descriptor updates) after a run.
+	// They take a few seconds at exit
+	bool scalingBenchmarks = false;
+};
+
 struct RenderGuiData
 {
 	RenderGuiData() {}
@@ -21,6 +82,8 @@ struct RenderGuiData
 	double averageFps = -1;
 
 	bool simpleScene = false;
+
+	RenderSettings settings{};
 };
 
 struct ModelInfo
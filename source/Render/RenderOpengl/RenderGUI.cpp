@@ -6,6 +6,8 @@
 #include <string>
 #include <iostream>
 #include <thread>
+#include <algorithm>
+#include <cmath>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -189,6 +191,7 @@ public:
 		bool cbMedium = result.sceneLoad == RenderGuiData::SceneLoad::Med;
 		bool cbLow = result.sceneLoad == RenderGuiData::SceneLoad::Low;
 
+		RenderSettings settings = result.settings;
 
 		int modelNumber = result.modelNumber;
 		while (true)
@@ -252,6 +255,45 @@ public:
 			else if (modelNumber > 512)
 				modelNumber = 512;
 
+			if (ImGui::CollapsingHeader("OPTIONS"))
+			{
+				ImGui::SetWindowFontScale(1.5);
+
+				ImGui::Checkbox("GPU DRIVEN", &settings.gpuDriven);
+				ImGui::Checkbox("FRUSTUM CULLING", &settings.frustumCulling);
+				ImGui::Checkbox("VULKAN GPU DRIVEN OCCLUSION CULLING", &settings.occlusionCulling);
+				ImGui::Checkbox("VULKAN ASYNC COMPUTE", &settings.asyncCompute);
+
+				ImGui::SliderInt("VULKAN FRAMES IN FLIGHT", &settings.framesInFlight, 1, 4);
+				ImGui::Checkbox("PIPELINED SIMULATION", &settings.pipelinedSimulation);
+				ImGui::Checkbox("OPENGL PARALLEL DRAW PREPARATION", &settings.parallelDrawPreparation);
+				ImGui::Checkbox("OPENGL ASYNC RESOURCE LOADING", &settings.asyncResourceLoading);
+				ImGui::SliderInt("WORKER THREADS (0 - AUTO)", &settings.workerThreads, 0, 64);
+				ImGui::Checkbox("PIN WORKER THREADS", &settings.pinWorkerThreads);
+				ImGui::Checkbox("SCALING BENCHMARKS AT EXIT", &settings.scalingBenchmarks);
+
+				bool lowLatency = settings.latencyMode == RenderSettings::LatencyMode::LowLatency;
+				if (ImGui::Checkbox("VULKAN LOW LATENCY", &lowLatency))
+					settings.latencyMode = lowLatency ? RenderSettings::LatencyMode::LowLatency : RenderSettings::LatencyMode::MaxThroughput;
+
+				const char* presentModes[] = { "IMMEDIATE", "MAILBOX", "FIFO" };
+				int presentMode = static_cast<int>(settings.presentMode);
+				if (ImGui::Combo("VULKAN PRESENT MODE", &presentMode, presentModes, IM_ARRAYSIZE(presentModes)))
+					settings.presentMode = static_cast<RenderSettings::PresentMode>(presentMode);
+
+				const char* sampleCounts[] = { "1", "2", "4", "8" };
+				int sampleCount = static_cast<int>(std::log2(std::clamp(settings.msaaSamples, 1, 8)));
+				if (ImGui::Combo("VULKAN MSAA SAMPLES", &sampleCount, sampleCounts, IM_ARRAYSIZE(sampleCounts)))
+					settings.msaaSamples = 1 << sampleCount;
+
+				const char* descriptorModes[] = { "DESCRIPTOR SETS", "UPDATE TEMPLATE", "PUSH DESCRIPTORS" };
+				int descriptorMode = static_cast<int>(settings.descriptorMode);
+				if (ImGui::Combo("VULKAN DESCRIPTORS", &descriptorMode, descriptorModes, IM_ARRAYSIZE(descriptorModes)))
+					settings.descriptorMode = static_cast<RenderSettings::DescriptorMode>(descriptorMode);
+
+				ImGui::SetWindowFontScale(3.5);
+			}
+
 			
 
 			ImVec2 windowSize = ImGui::GetIO().DisplaySize;
@@ -299,6 +341,8 @@ public:
 
 		result.simpleScene = cbSimple;
 
+		result.settings = settings;
+
 		return result;
 	}
 
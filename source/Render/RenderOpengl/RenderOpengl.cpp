@@ -4,16 +4,29 @@
 #include "GLFW/glfw3.h"
 #include "Shader.h"
 #include "Shaders.h"
+#include "ResourceLoader.h"
 #include "Camera.h"
 
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <array>
+#include <tuple>
+#include <map>
+#include <set>
+#include <iterator>
+#include <cassert>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
 #include "Model.h"
+#include "Frustum.h"
+#include "FrameSnapshot.h"
+#include "RenderQueue.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -22,6 +35,10 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include <glm/gtc/type_ptr.hpp>
 #include <Utils.h>
+#include <JobSystem.h>
+#include <FramePipeline.h>
+#include <FrameArena.h>
+#include <chrono>
 
 using namespace std::literals;
 
@@ -96,6 +113,8 @@ public:
 	struct MeshRenderData
 	{
 		unsigned int VAO = 0, VBO = 0, EBO = 0;
+		// Streamed meshes get their VAO once both buffers are ready
+		ResourceLoader::Ticket upload = 0;
 	};
 
 	struct OpenglModel
@@ -104,6 +123,13 @@ public:
 		std::vector<MeshRenderData> meshRenderData;
 
 		std::map<RenderCommon::Texture::Type, int> textures;
+		// Bound to units 0 and 1, the diffuse texture stands in for a missing specular one
+		GLuint diffuseTexture = 0;
+		GLuint specularTexture = 0;
+		// Dense index of the textures for the render queue sort key
+		uint32_t material = 0;
+		// Streamed textures are drawn as the placeholder until this upload is ready
+		ResourceLoader::Ticket texturesUpload = 0;
 
 		glm::vec3 position{};
 		glm::vec3 scale{};
@@ -118,8 +144,121 @@ public:
 	int m_modelsMeshCount = 0;
 
 	std::map<std::string, int> m_textureCache;
+
+	// Async resource loading only
+	std::unique_ptr<ResourceLoader> m_loader;
+	std::map<GLuint, ResourceLoader::Ticket> m_textureUploads;
+	GLuint m_placeholderTexture = 0;
+	uint32_t m_placeholderMaterial = 0;
+	// Model and mesh indices of the streamed meshes without a VAO yet, in upload order
+	std::vector<std::pair<uint32_t, uint32_t>> m_pendingMeshes;
+	// Since startRenderLoop was called, negative until it happened
+	double m_firstFrameSeconds = -1;
+	double m_resourcesReadySeconds = -1;
+
+	bool m_parallelShaderCompile = false;
+
+	RenderSettings m_settings;
+
+	std::uint64_t m_drawnModels = 0;
+	std::uint64_t m_culledModels = 0;
+
+	// Only prepares the frame data, GL calls stay on the context thread. The second client is the simulation thread
+	utils::JobSystem& m_jobSystem;
+	int m_coreNumber = static_cast<int>(m_jobSystem.workerCount());
+
+	// Pipelined mode only, otherwise every frame is simulated into m_lockstepSnapshot right before it's drawn
+	std::unique_ptr<utils::FramePipeline<RenderCommon::FrameInput, RenderCommon::FrameSnapshot>> m_framePipeline;
+	RenderCommon::FrameSnapshot m_lockstepSnapshot;
+
+	double m_inputLatencySeconds = 0;
+	// Writing the frame's per-instance data into mapped buffers
+	double m_drawPreparationSeconds = 0;
+
+	static constexpr float FarPlane = 100.0f;
+
+	RenderCommon::RenderQueue m_renderQueue;
+	RenderCommon::StateCache m_stateCache;
+
+	// MAX_BONES and the BonePalette binding of shader_v.vert
+	static constexpr size_t MaxBones = 100;
+	static constexpr GLuint BonePaletteBinding = 0;
+
+	// Palettes of all skinned models of a frame, one uniform buffer range each. Reallocated when a frame needs more
+	GLuint m_bonePaletteBuffer = 0;
+	GLsizeiptr m_bonePaletteBufferSize = 0;
+	GLsizeiptr m_bonePaletteStride = 0;
+	// Per model, -1 for the simple program and models that aren't drawn. Range 0 is an identity palette for
+	// skinned program models without bones
+	std::vector<GLintptr> m_bonePaletteOffsets;
+
+	// Layout glMultiDrawElementsIndirect reads
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count = 0;
+		GLuint instanceCount = 0;
+		GLuint firstIndex = 0;
+		GLint baseVertex = 0;
+		GLuint baseInstance = 0;
+	};
+
+	// Consecutive indirect commands that share a program
+	struct IndirectBatch
+	{
+		bool simpleModel = false;
+		size_t firstCommand = 0;
+		size_t commandCount = 0;
+	};
+
+	// MAX_TEXTURES of the indirect fragment shaders
+	static constexpr size_t MaxIndirectTextures = 16;
+	static constexpr size_t IndirectFramesInFlight = 3;
+
+	// GPU-driven mode: the meshes of all models in one vertex and one index buffer behind a single VAO, and a
+	// glMultiDrawElementsIndirect call per program. Everything written per frame lives in a persistently mapped buffer
+	// of IndirectFramesInFlight sections, a section is rewritten once the fence of its previous frame has signaled
+	struct GpuDrivenScene
+	{
+		GLuint vertexArray = 0;
+		GLuint vertexBuffer = 0;
+		GLuint indexBuffer = 0;
+		// Texture index of every command
+		GLuint commandTextureBuffer = 0;
+		std::vector<GLuint> textures;
+		std::vector<ResourceLoader::Ticket> textureUploads;
+
+		// Streamed geometry is kept until the loader has copied it
+		std::vector<RenderCommon::Vertex> vertices;
+		std::vector<GLuint> indices;
+		ResourceLoader::Ticket geometryUpload = 0;
+
+		// instanceCount and baseInstance are filled in every frame from the visible models
+		std::vector<DrawElementsIndirectCommand> commands;
+		std::vector<size_t> commandMeshes;
+		// Models of command i are commandModels[commandFirstModel[i], commandFirstModel[i + 1])
+		std::vector<uint32_t> commandModels;
+		std::vector<size_t> commandFirstModel;
+		std::vector<IndirectBatch> batches;
+
+		// Section layout: commands, draw instances (model indices), model matrices, bone palettes
+		GLuint frameBuffer = 0;
+		unsigned char* frameMapping = nullptr;
+		GLsizeiptr frameSize = 0;
+		GLsizeiptr instancesOffset = 0;
+		GLsizeiptr modelsOffset = 0;
+		GLsizeiptr bonesOffset = 0;
+		std::array<GLsync, IndirectFramesInFlight> fences{};
+		size_t frame = 0;
+
+		double fenceWaitSeconds = 0;
+	};
+
+	std::unique_ptr<GpuDrivenScene> m_gpuDriven;
+	utils::FrameAllocationCheck m_allocationCheck;
 public:
-	Impl()
+	Impl(RenderSettings settings) :
+		m_settings{ settings },
+		m_jobSystem{ utils::sharedJobSystem({ static_cast<size_t>(std::max(settings.workerThreads, 0)), 2, settings.pinWorkerThreads }) }
 	{
 	}
 
@@ -141,8 +280,26 @@ public:
 		glEnable(GL_MULTISAMPLE);
 		glEnable(GL_FRAMEBUFFER_SRGB);
 
+		if (m_settings.asyncResourceLoading)
+		{
+			m_loader = std::make_unique<ResourceLoader>(m_window);
+			createPlaceholderTexture();
+		}
+
 		auto models = prepareModels(std::move(modelInfos));
+
+		// Decided before loadModels, which leaves out the per-mesh buffers in GPU-driven mode
+		if (m_settings.gpuDriven && indirectTextureCount(models) > MaxIndirectTextures)
+		{
+			std::cerr << "GPU-driven mode supports up to " << MaxIndirectTextures << " textures, the scene has "
+				<< indirectTextureCount(models) << ", falling back to a draw per mesh" << std::endl;
+			m_settings.gpuDriven = false;
+		}
+
 		loadModels(std::move(models));
+
+		if (m_settings.gpuDriven)
+			createGpuDrivenScene();
 	}
 
 	void initWindow()
@@ -169,6 +326,8 @@ public:
 		if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
 			throw std::runtime_error{ "gladLoadGLLoader has failed" };
 
+		m_parallelShaderCompile = Shader::enableParallelCompile(reinterpret_cast<GLADloadproc>(glfwGetProcAddress));
+
 		glfwSetWindowCenter(m_window);
 
 		glfwSetFramebufferSizeCallback(m_window, [](GLFWwindow* window, int x, int y) {
@@ -237,13 +396,40 @@ public:
 		return models;
 	}
 
+	// Unique diffuse textures of the GPU-driven texture array, the first one of every model as in loadModels
+	static size_t indirectTextureCount(const std::vector<OpenglModel>& models)
+	{
+		std::set<std::string> paths;
+
+		for (const OpenglModel& model : models)
+		{
+			for (const auto& mesh : model.model->meshes)
+			{
+				auto textureIt = std::find_if(mesh.m_textures.begin(), mesh.m_textures.end(),
+					[](const RenderCommon::Texture& texture) { return texture.type == RenderCommon::Texture::Type::diffuse; });
+
+				if (textureIt != mesh.m_textures.end())
+				{
+					paths.insert(textureIt->path);
+					break;
+				}
+			}
+		}
+
+		return paths.size();
+	}
+
 	void loadModels(std::vector<OpenglModel> models)
 	{
+		std::map<std::pair<GLuint, GLuint>, uint32_t> materials;
+
 		for (OpenglModel& model : models)
 		{
 			for (size_t i = 0; i < model.model->meshes.size(); ++i)
 			{
-				model.meshRenderData.push_back(createMeshRenderData(model.model->meshes[i]));
+				// GPU-driven mode draws from the shared geometry buffers instead
+				if (!m_settings.gpuDriven)
+					model.meshRenderData.push_back(createMeshRenderData(model.model->meshes[i]));
 
 				for (auto& texture : model.model->meshes[i].m_textures)
 				{
@@ -252,13 +438,56 @@ public:
 						model.textures.emplace(texture.type, createTextureImage(texture.path));
 				}
 			}
+
+			auto diffuseIt = model.textures.find(RenderCommon::Texture::Type::diffuse);
+			if (diffuseIt == model.textures.end())
+				throw std::runtime_error{ "Can't find diffuse texture" };
+
+			auto specularIt = model.textures.find(RenderCommon::Texture::Type::specular);
+
+			model.diffuseTexture = static_cast<GLuint>(diffuseIt->second);
+			model.specularTexture = static_cast<GLuint>(specularIt != model.textures.end() ? specularIt->second : diffuseIt->second);
+			model.material = materials.emplace(std::make_pair(model.diffuseTexture, model.specularTexture), static_cast<uint32_t>(materials.size())).first->second;
+			model.texturesUpload = std::max(textureUpload(model.diffuseTexture), textureUpload(model.specularTexture));
+		}
+
+		m_placeholderMaterial = static_cast<uint32_t>(materials.size());
+
+		for (uint32_t modelIndex = 0; modelIndex < models.size(); ++modelIndex)
+		{
+			for (uint32_t i = 0; i < models[modelIndex].meshRenderData.size(); ++i)
+			{
+				if (models[modelIndex].meshRenderData[i].upload)
+					m_pendingMeshes.emplace_back(modelIndex, i);
+			}
 		}
 
 		m_models = std::move(models);
 	}
 
+	// Buffers with immutable storage the loader thread fills through a mapping
+	MeshRenderData streamMeshRenderData(RenderCommon::Mesh& mesh)
+	{
+		GLsizeiptr vertexSize = mesh.m_vertices.size() * sizeof(RenderCommon::Vertex);
+		GLsizeiptr indexSize = mesh.m_indices.size() * sizeof(unsigned int);
+
+		MeshRenderData meshRenderData;
+		glCreateBuffers(1, &meshRenderData.VBO);
+		glNamedBufferStorage(meshRenderData.VBO, vertexSize, nullptr, GL_MAP_WRITE_BIT);
+		glCreateBuffers(1, &meshRenderData.EBO);
+		glNamedBufferStorage(meshRenderData.EBO, indexSize, nullptr, GL_MAP_WRITE_BIT);
+
+		m_loader->uploadBuffer(meshRenderData.VBO, mesh.m_vertices.data(), vertexSize);
+		meshRenderData.upload = m_loader->uploadBuffer(meshRenderData.EBO, mesh.m_indices.data(), indexSize);
+
+		return meshRenderData;
+	}
+
 	MeshRenderData createMeshRenderData(RenderCommon::Mesh& mesh)
 	{
+		if (m_loader)
+			return streamMeshRenderData(mesh);
+
 		MeshRenderData meshRenderData;
 		glGenVertexArrays(1, &meshRenderData.VAO);
 		glGenBuffers(1, &meshRenderData.VBO);
@@ -313,6 +542,17 @@ public:
 		}
 
 		unsigned int textureID;
+
+		if (m_loader)
+		{
+			// Created here so the name can be used right away, the loader gives it storage
+			glCreateTextures(GL_TEXTURE_2D, 1, &textureID);
+			m_textureUploads.emplace(textureID, m_loader->loadTexture(path, textureID));
+			m_textureCache.emplace(path, textureID);
+
+			return textureID;
+		}
+
 		glGenTextures(1, &textureID);
 
 		int width, height, nrComponents;
@@ -338,22 +578,119 @@ public:
 		return textureID;
 	}
 
+	// 0 for textures loaded synchronously
+	ResourceLoader::Ticket textureUpload(GLuint texture) const
+	{
+		auto findIt = m_textureUploads.find(texture);
+		return findIt != m_textureUploads.end() ? findIt->second : 0;
+	}
+
+	bool resourceReady(ResourceLoader::Ticket ticket) const
+	{
+		return !m_loader || m_loader->ready(ticket);
+	}
+
+	// Drawn instead of streamed textures that aren't ready yet
+	void createPlaceholderTexture()
+	{
+		const unsigned char grey[] = { 128, 128, 128, 255 };
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_placeholderTexture);
+		glTextureStorage2D(m_placeholderTexture, 1, GL_RGBA8, 1, 1);
+		glTextureSubImage2D(m_placeholderTexture, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	}
+
+	// Polls the loader's fences and gives the meshes that became ready their VAOs. The VAO binds the buffers on this
+	// context after the fence, which makes the loader's writes visible here
+	void updateStreamedResources()
+	{
+		if (!m_loader)
+			return;
+
+		m_loader->update();
+
+		size_t ready = 0;
+		for (; ready < m_pendingMeshes.size(); ++ready)
+		{
+			auto [modelIndex, meshIndex] = m_pendingMeshes[ready];
+			MeshRenderData& meshRenderData = m_models[modelIndex].meshRenderData[meshIndex];
+
+			if (!m_loader->ready(meshRenderData.upload))
+				break;
+
+			meshRenderData.VAO = createVertexArray(meshRenderData.VBO, meshRenderData.EBO);
+		}
+		m_pendingMeshes.erase(m_pendingMeshes.begin(), m_pendingMeshes.begin() + ready);
+	}
+
+	// The vertex layout of createMeshRenderData with vertex attribute binding
+	GLuint createVertexArray(GLuint vertexBuffer, GLuint indexBuffer)
+	{
+		constexpr GLuint binding = 0;
+
+		GLuint vertexArray = 0;
+		glCreateVertexArrays(1, &vertexArray);
+		glVertexArrayVertexBuffer(vertexArray, binding, vertexBuffer, 0, sizeof(RenderCommon::Vertex));
+		glVertexArrayElementBuffer(vertexArray, indexBuffer);
+
+		auto floatAttribute = [&](GLuint attribute, GLint size, size_t offset) {
+			glEnableVertexArrayAttrib(vertexArray, attribute);
+			glVertexArrayAttribFormat(vertexArray, attribute, size, GL_FLOAT, GL_FALSE, static_cast<GLuint>(offset));
+			glVertexArrayAttribBinding(vertexArray, attribute, binding);
+		};
+		auto intAttribute = [&](GLuint attribute, GLint size, size_t offset) {
+			glEnableVertexArrayAttrib(vertexArray, attribute);
+			glVertexArrayAttribIFormat(vertexArray, attribute, size, GL_INT, static_cast<GLuint>(offset));
+			glVertexArrayAttribBinding(vertexArray, attribute, binding);
+		};
+
+		floatAttribute(0, 3, offsetof(RenderCommon::Vertex, Position));
+		floatAttribute(1, 3, offsetof(RenderCommon::Vertex, Normal));
+		floatAttribute(2, 2, offsetof(RenderCommon::Vertex, TexCoords));
+		intAttribute(3, 4, offsetof(RenderCommon::Vertex, BoneIDs));
+		intAttribute(4, 4, offsetof(RenderCommon::Vertex, BoneIDs) + 4 * sizeof(std::uint32_t));
+		floatAttribute(5, 4, offsetof(RenderCommon::Vertex, Weights));
+		floatAttribute(6, 4, offsetof(RenderCommon::Vertex, Weights) + 4 * sizeof(float));
+
+		return vertexArray;
+	}
+
 	double startRenderLoop(std::vector<ModelInfo> modelInfos)
 	{		
+		auto callTime = std::chrono::steady_clock::now();
+		auto secondsSinceCall = [callTime] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - callTime).count(); };
+
 		init(std::move(modelInfos));
 
 		glEnable(GL_DEPTH_TEST);
 		glEnable(GL_CULL_FACE);
 		glClearColor(135 / 255.f, 206 / 255.f, 235 / 255.f, 1.0f);
 
-		Shader ourShaderSimple(s_shader_v_simple, s_shader_f_simple);
-		Shader ourShader(s_shader_v, s_shader_f);
-
-		Shader* currentShader = &ourShader;
+		// GPU-driven mode reads the per-model data from storage buffers. Both programs are created before either is
+		// used, so they compile at the same time with parallel compile
+		auto shaderStart = std::chrono::steady_clock::now();
+		bool indirect = m_gpuDriven != nullptr;
+		Shader ourShaderSimple(indirect ? s_shader_v_simple_indirect : s_shader_v_simple, indirect ? s_shader_f_simple_indirect : s_shader_f_simple);
+		Shader ourShader(indirect ? s_shader_v_indirect : s_shader_v, indirect ? s_shader_f_indirect : s_shader_f);
 
 		ourShader.use();
 		ourShader.setInt("material.texture_diffuse1", 0);
 		//ourShader.setInt("material.texture_specular1", 1);
+		ourShader.bindUniformBlock("BonePalette", BonePaletteBinding);
+		// Used in the first frame anyway. Finished here so a rejected cached binary isn't counted as a cache hit
+		ourShaderSimple.finish();
+
+		std::cout << "OpenGL programs: " << ourShader.loadedFromCache() + ourShaderSimple.loadedFromCache() << " of 2 from the binary cache, "
+			<< (m_parallelShaderCompile ? "parallel" : "serial") << " compile, ready after "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count() << " ms" << std::endl;
+
+		createBonePaletteBuffer();
+
+		if (m_settings.pipelinedSimulation)
+			m_framePipeline = std::make_unique<utils::FramePipeline<RenderCommon::FrameInput, RenderCommon::FrameSnapshot>>(
+				[this](const RenderCommon::FrameInput& input, RenderCommon::FrameSnapshot& snapshot) { simulate(input, snapshot); },
+				[this] { m_jobSystem.attachThread(); },
+				[this] { m_jobSystem.detachThread(); });
 
 		auto startSeconds = glfwGetTime();
 		std::uint64_t frameCount = 0;
@@ -362,73 +699,36 @@ public:
 			if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 				break;
 
+			utils::FrameArena::local().reset();
+			m_allocationCheck.beginFrame();
+
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			showFPS();
 			processInput();
 
-			auto currentTime = glfwGetTime();
+			updateStreamedResources();
+			if (m_resourcesReadySeconds < 0 && (!m_loader || m_loader->allReady()) && m_pendingMeshes.empty())
+				m_resourcesReadySeconds = secondsSinceCall();
 
-			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)1280 / (float)720, 0.1f, 100.0f);
-			glm::mat4 view = camera.GetViewMatrix();
-
-			for (auto& model : m_models)
-			{
-				if (model.info.simpleModel)
-					currentShader = &ourShaderSimple;
-				else
-					currentShader = &ourShader;
+			const RenderCommon::FrameSnapshot& snapshot = nextSnapshot(sampleFrameInput());
 
-				currentShader->use();
+			m_drawnModels += snapshot.drawnModels;
+			m_culledModels += snapshot.culledModels;
 
-				glm::mat4 modelMat = glm::mat4(1.0f);
-				modelMat = glm::translate(modelMat, model.position);
-				modelMat = glm::scale(modelMat, model.scale);
-
-				if (model.info.simpleModel)
-					modelMat = glm::rotate(modelMat, (float)currentTime, glm::vec3(0.5f, 1.0f, 0.0f));
-
-				currentShader->setMat4("model", modelMat);
-				currentShader->setMat4("PVM", projection * view * modelMat);
-
-				std::vector<aiMatrix4x4> Transforms;
-				model.model->BoneTransform(currentTime, Transforms);
-
-				
-				if (!model.info.simpleModel)
-				for (int i = 0; i < Transforms.size(); i++) {
-					currentShader->setMat4("gBones["s + std::to_string(i) + "]", RenderCommon::Assimp2Glm(Transforms[i]));
-				}
-
-				auto findIt = model.textures.find(RenderCommon::Texture::Type::diffuse);
-				if (findIt == model.textures.end())
-					throw std::runtime_error{ "Can't find diffuse texture" };
-
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, findIt->second);
-
-				findIt = model.textures.find(RenderCommon::Texture::Type::specular);
-				if (findIt != model.textures.end())
-				{
-					glActiveTexture(GL_TEXTURE0 + 1);
-					glBindTexture(GL_TEXTURE_2D, findIt->second);
-				}
-				else
-				{
-					glActiveTexture(GL_TEXTURE0 + 1);
-					glBindTexture(GL_TEXTURE_2D, model.textures.find(RenderCommon::Texture::Type::diffuse)->second);
-				}
-
-				for (int i = 0; i < model.model->meshes.size(); ++i)
-				{
-					glBindVertexArray(model.meshRenderData[i].VAO);
-					glDrawElements(GL_TRIANGLES, model.model->meshes[i].m_indices.size(), GL_UNSIGNED_INT, 0);
-					glBindVertexArray(0);
-				}
-			}
+			if (m_gpuDriven)
+				drawGpuDriven(snapshot, ourShader, ourShaderSimple);
+			else
+				drawModels(snapshot, ourShader, ourShaderSimple);
 
 			glfwSwapBuffers(m_window);
 			frameCount++;
 
+			if (m_firstFrameSeconds < 0)
+				m_firstFrameSeconds = secondsSinceCall();
+
+			m_inputLatencySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshot.input.sampleTime).count();
+			m_allocationCheck.endFrame();
+
 			auto endSeconds = glfwGetTime();
 			auto renderSeconds = endSeconds - startSeconds;
 
@@ -442,11 +742,544 @@ public:
 		auto renderSeconds = endSeconds - startSeconds;
 		auto averageFps = frameCount / renderSeconds;
 
+		if (frameCount)
+			std::cout << "OpenGL average input sample to swap latency: " << m_inputLatencySeconds * 1000.0 / frameCount << " ms ("
+				<< (m_framePipeline ? "pipelined simulation" : "lock-step simulation") << ")" << std::endl;
+
+		if (utils::heapAllocationCounting && m_allocationCheck.steadyFrames())
+			std::cout << "OpenGL steady-state frames with heap allocations: " << m_allocationCheck.allocatingFrames() << " of "
+				<< m_allocationCheck.steadyFrames() << ", " << m_allocationCheck.allocations() << " allocations" << std::endl;
+
+		if (m_framePipeline)
+		{
+			std::cout << "OpenGL simulation thread: " << m_framePipeline->averageSimulateMs() << " ms per frame, render thread waited "
+				<< m_framePipeline->averageWaitMs() << " ms per frame" << std::endl;
+			m_framePipeline.reset();
+		}
+
+		if (!m_gpuDriven)
+			m_stateCache.print(std::cout, "OpenGL", frameCount);
+
+		if (frameCount)
+			std::cout << "OpenGL draw preparation into mapped buffers: " << m_drawPreparationSeconds * 1000.0 / frameCount << " ms per frame ("
+				<< (m_settings.parallelDrawPreparation ? "job system workers" : "context thread") << ")" << std::endl;
+
+		if (m_gpuDriven && frameCount)
+			std::cout << "OpenGL GPU-driven: " << m_gpuDriven->commands.size() << " indirect commands in " << m_gpuDriven->batches.size()
+				<< " multi-draws, waited " << m_gpuDriven->fenceWaitSeconds * 1000.0 / frameCount << " ms per frame for frame buffer fences" << std::endl;
+
+		if (frameCount)
+		{
+			std::cout << "OpenGL resource loading (" << (m_loader ? "loader thread" : "synchronous") << "): first frame after "
+				<< m_firstFrameSeconds * 1000.0 << " ms, ";
+
+			if (m_resourcesReadySeconds >= 0)
+				std::cout << "all resources ready after " << m_resourcesReadySeconds * 1000.0 << " ms" << std::endl;
+			else
+				std::cout << "resources still loading at exit" << std::endl;
+		}
+
+		if (m_settings.frustumCulling && frameCount)
+			std::cout << "OpenGL frustum culling, models per frame: " << m_drawnModels / frameCount << " drawn, "
+				<< m_culledModels / frameCount << " culled" << std::endl;
+
+		if (m_settings.scalingBenchmarks)
+			RenderCommon::benchmarkSimulationScaling("OpenGL", sampleFrameInput(), m_models, m_settings.frustumCulling, false);
+
+		// Before anything it may still be writing to is deleted
+		m_loader.reset();
+		glDeleteTextures(1, &m_placeholderTexture);
+		m_placeholderTexture = 0;
+
+		glDeleteBuffers(1, &m_bonePaletteBuffer);
+		m_bonePaletteBuffer = 0;
+		m_bonePaletteBufferSize = 0;
+
+		destroyGpuDrivenScene();
+
 		glfwDestroyWindow(m_window);
 
 		return averageFps;
 	}
 
+	RenderCommon::FrameInput sampleFrameInput()
+	{
+		RenderCommon::FrameInput input;
+		input.time = glfwGetTime();
+		input.projection = glm::perspective(glm::radians(camera.Zoom), (float)1280 / (float)720, 0.1f, FarPlane);
+		input.view = camera.GetViewMatrix();
+		input.cameraPosition = camera.Position;
+		input.sampleTime = std::chrono::steady_clock::now();
+
+		return input;
+	}
+
+	void simulate(const RenderCommon::FrameInput& input, RenderCommon::FrameSnapshot& snapshot)
+	{
+		RenderCommon::simulateFrame(input, m_models, m_settings.frustumCulling, false, m_jobSystem, snapshot);
+	}
+
+	const RenderCommon::FrameSnapshot& nextSnapshot(const RenderCommon::FrameInput& input)
+	{
+		if (m_framePipeline)
+			return m_framePipeline->next(input);
+
+		simulate(input, m_lockstepSnapshot);
+		return m_lockstepSnapshot;
+	}
+
+	void createGpuDrivenScene()
+	{
+		auto scene = std::make_unique<GpuDrivenScene>();
+
+		struct MeshRange
+		{
+			GLuint firstIndex = 0;
+			GLuint indexCount = 0;
+			GLint baseVertex = 0;
+		};
+
+		// Every unique mesh is stored once in the shared geometry buffers
+		std::map<std::pair<std::string, size_t>, MeshRange> meshRanges;
+		std::vector<RenderCommon::Vertex> vertices;
+		std::vector<GLuint> indices;
+
+		// Instances with the same program, texture and mesh are merged into one instanced command.
+		// The program goes first in the key, so commands of one program are consecutive
+		using GroupKey = std::tuple<bool, GLuint, std::string, size_t>;
+		std::map<GroupKey, std::vector<uint32_t>> groups;
+		std::map<GLuint, GLuint> textureIndices;
+
+		for (uint32_t modelIndex = 0; modelIndex < m_models.size(); ++modelIndex)
+		{
+			OpenglModel& model = m_models[modelIndex];
+
+			auto diffuseIt = model.textures.find(RenderCommon::Texture::Type::diffuse);
+			if (diffuseIt == model.textures.end())
+				throw std::runtime_error{ "Can't find diffuse texture" };
+
+			GLuint texture = static_cast<GLuint>(diffuseIt->second);
+			auto textureIt = textureIndices.emplace(texture, static_cast<GLuint>(textureIndices.size())).first;
+			if (textureIt->second == scene->textures.size())
+			{
+				scene->textures.push_back(texture);
+				scene->textureUploads.push_back(textureUpload(texture));
+			}
+
+			for (size_t j = 0; j < model.model->meshes.size(); ++j)
+			{
+				auto meshKey = std::make_pair(model.info.modelPath, j);
+				if (meshRanges.find(meshKey) == meshRanges.end())
+				{
+					const RenderCommon::Mesh& mesh = model.model->meshes[j];
+
+					MeshRange range;
+					range.firstIndex = static_cast<GLuint>(indices.size());
+					range.indexCount = static_cast<GLuint>(mesh.m_indices.size());
+					range.baseVertex = static_cast<GLint>(vertices.size());
+					meshRanges.emplace(meshKey, range);
+
+					vertices.insert(vertices.end(), mesh.m_vertices.begin(), mesh.m_vertices.end());
+					indices.insert(indices.end(), mesh.m_indices.begin(), mesh.m_indices.end());
+				}
+
+				groups[GroupKey{ model.info.simpleModel, textureIt->second, model.info.modelPath, j }].push_back(modelIndex);
+			}
+		}
+
+		// init() falls back to per-model draws for scenes with more textures
+		assert(scene->textures.size() <= MaxIndirectTextures);
+
+		std::vector<GLuint> commandTextures;
+
+		for (const auto& [groupKey, modelIndices] : groups)
+		{
+			const auto& [simpleModel, textureIndex, modelPath, meshIndex] = groupKey;
+			const MeshRange& range = meshRanges.at({ modelPath, meshIndex });
+
+			if (scene->batches.empty() || scene->batches.back().simpleModel != simpleModel)
+			{
+				IndirectBatch batch;
+				batch.simpleModel = simpleModel;
+				batch.firstCommand = scene->commands.size();
+				scene->batches.push_back(batch);
+			}
+			++scene->batches.back().commandCount;
+
+			DrawElementsIndirectCommand command;
+			command.count = range.indexCount;
+			command.firstIndex = range.firstIndex;
+			command.baseVertex = range.baseVertex;
+			scene->commands.push_back(command);
+			scene->commandMeshes.push_back(meshIndex);
+			scene->commandFirstModel.push_back(scene->commandModels.size());
+			scene->commandModels.insert(scene->commandModels.end(), modelIndices.begin(), modelIndices.end());
+			commandTextures.push_back(textureIndex);
+		}
+		scene->commandFirstModel.push_back(scene->commandModels.size());
+
+		if (scene->commands.empty())
+			return;
+
+		GLsizeiptr vertexSize = vertices.size() * sizeof(vertices[0]);
+		GLsizeiptr indexSize = indices.size() * sizeof(indices[0]);
+
+		glCreateBuffers(1, &scene->vertexBuffer);
+		glCreateBuffers(1, &scene->indexBuffer);
+
+		if (m_loader)
+		{
+			glNamedBufferStorage(scene->vertexBuffer, vertexSize, nullptr, GL_MAP_WRITE_BIT);
+			glNamedBufferStorage(scene->indexBuffer, indexSize, nullptr, GL_MAP_WRITE_BIT);
+
+			scene->vertices = std::move(vertices);
+			scene->indices = std::move(indices);
+			m_loader->uploadBuffer(scene->vertexBuffer, scene->vertices.data(), vertexSize);
+			scene->geometryUpload = m_loader->uploadBuffer(scene->indexBuffer, scene->indices.data(), indexSize);
+		}
+		else
+		{
+			glNamedBufferStorage(scene->vertexBuffer, vertexSize, vertices.data(), 0);
+			glNamedBufferStorage(scene->indexBuffer, indexSize, indices.data(), 0);
+		}
+
+		glCreateBuffers(1, &scene->commandTextureBuffer);
+		glNamedBufferStorage(scene->commandTextureBuffer, commandTextures.size() * sizeof(commandTextures[0]), commandTextures.data(), 0);
+
+		// Streamed geometry gets its VAO once the upload is ready
+		if (!scene->geometryUpload)
+			scene->vertexArray = createVertexArray(scene->vertexBuffer, scene->indexBuffer);
+
+		GLint alignment = 0;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, GLint{ alignof(glm::vec4) });
+
+		auto alignUp = [alignment](GLsizeiptr size) { return (size + alignment - 1) / alignment * alignment; };
+
+		scene->instancesOffset = alignUp(scene->commands.size() * sizeof(DrawElementsIndirectCommand));
+		scene->modelsOffset = scene->instancesOffset + alignUp(scene->commandModels.size() * sizeof(GLuint));
+		scene->bonesOffset = scene->modelsOffset + alignUp(m_models.size() * sizeof(glm::mat4));
+		scene->frameSize = scene->bonesOffset + alignUp(m_models.size() * MaxBones * sizeof(glm::mat4));
+
+		// Coherent, so writes through the mapping need no flush before the draws of the frame
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GLsizeiptr bufferSize = scene->frameSize * IndirectFramesInFlight;
+
+		glCreateBuffers(1, &scene->frameBuffer);
+		glNamedBufferStorage(scene->frameBuffer, bufferSize, nullptr, flags);
+		scene->frameMapping = static_cast<unsigned char*>(glMapNamedBufferRange(scene->frameBuffer, 0, bufferSize, flags));
+		if (!scene->frameMapping)
+			throw std::runtime_error{ "glMapNamedBufferRange has failed for the GPU-driven frame buffer" };
+
+		// Models without animation keep identity palettes
+		for (size_t i = 0; i < IndirectFramesInFlight; ++i)
+		{
+			auto* bones = reinterpret_cast<glm::mat4*>(scene->frameMapping + i * scene->frameSize + scene->bonesOffset);
+			std::fill(bones, bones + m_models.size() * MaxBones, glm::mat4(1.0f));
+		}
+
+		m_gpuDriven = std::move(scene);
+	}
+
+	void destroyGpuDrivenScene()
+	{
+		if (!m_gpuDriven)
+			return;
+
+		for (GLsync& fence : m_gpuDriven->fences)
+		{
+			if (fence)
+				glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		if (m_gpuDriven->frameMapping)
+			glUnmapNamedBuffer(m_gpuDriven->frameBuffer);
+
+		GLuint buffers[] = { m_gpuDriven->vertexBuffer, m_gpuDriven->indexBuffer, m_gpuDriven->commandTextureBuffer, m_gpuDriven->frameBuffer };
+		glDeleteBuffers(static_cast<GLsizei>(std::size(buffers)), buffers);
+		glDeleteVertexArrays(1, &m_gpuDriven->vertexArray);
+	}
+
+	// Writes the frame's section of the persistent buffer and submits a multi-draw per program
+	void drawGpuDriven(const RenderCommon::FrameSnapshot& snapshot, Shader& shader, Shader& shaderSimple)
+	{
+		GpuDrivenScene& scene = *m_gpuDriven;
+
+		// Nothing is drawn until the shared geometry is streamed in
+		if (scene.geometryUpload)
+		{
+			if (!m_loader->ready(scene.geometryUpload))
+				return;
+
+			scene.vertexArray = createVertexArray(scene.vertexBuffer, scene.indexBuffer);
+			scene.geometryUpload = 0;
+			scene.vertices.clear();
+			scene.vertices.shrink_to_fit();
+			scene.indices.clear();
+			scene.indices.shrink_to_fit();
+		}
+
+		GLsync& fence = scene.fences[scene.frame];
+		if (fence)
+		{
+			auto waitStart = std::chrono::steady_clock::now();
+
+			GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (result == GL_TIMEOUT_EXPIRED)
+				result = glClientWaitSync(fence, 0, 1000000);
+
+			if (result == GL_WAIT_FAILED)
+				throw std::runtime_error{ "glClientWaitSync has failed" };
+
+			scene.fenceWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		GLintptr sectionOffset = static_cast<GLintptr>(scene.frame * scene.frameSize);
+		unsigned char* section = scene.frameMapping + sectionOffset;
+
+		auto* commands = reinterpret_cast<DrawElementsIndirectCommand*>(section);
+		auto* instances = reinterpret_cast<GLuint*>(section + scene.instancesOffset);
+		auto* models = reinterpret_cast<glm::mat4*>(section + scene.modelsOffset);
+		auto* bones = reinterpret_cast<glm::mat4*>(section + scene.bonesOffset);
+
+		auto preparationStart = std::chrono::steady_clock::now();
+
+		forEachChunk(m_models.size(), 8, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+			{
+				const RenderCommon::ModelState& state = snapshot.models[i];
+				if (!state.visible)
+					continue;
+
+				models[i] = state.model;
+				std::memcpy(bones + i * MaxBones, state.bones.data(), std::min(state.bones.size(), MaxBones) * sizeof(glm::mat4));
+			}
+		});
+
+		// Every command owns the instance slots of all its models, so commands are filled independently.
+		// Culled meshes are left out of their command's instances, a command may end up with none
+		forEachChunk(scene.commands.size(), 16, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+			{
+				DrawElementsIndirectCommand command = scene.commands[i];
+				command.baseInstance = static_cast<GLuint>(scene.commandFirstModel[i]);
+
+				for (size_t j = scene.commandFirstModel[i]; j < scene.commandFirstModel[i + 1]; ++j)
+				{
+					uint32_t modelIndex = scene.commandModels[j];
+					const RenderCommon::ModelState& state = snapshot.models[modelIndex];
+
+					if (state.visible && state.meshVisible[scene.commandMeshes[i]])
+						instances[command.baseInstance + command.instanceCount++] = modelIndex;
+				}
+
+				commands[i] = command;
+			}
+		});
+
+		m_drawPreparationSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - preparationStart).count();
+
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, scene.frameBuffer, sectionOffset + scene.modelsOffset, scene.bonesOffset - scene.modelsOffset);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, scene.frameBuffer, sectionOffset + scene.bonesOffset, scene.frameSize - scene.bonesOffset);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, scene.frameBuffer, sectionOffset + scene.instancesOffset, scene.modelsOffset - scene.instancesOffset);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, scene.commandTextureBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, scene.frameBuffer);
+
+		// Streamed textures that aren't ready yet are bound as the placeholder
+		std::array<GLuint, MaxIndirectTextures> textures{};
+		for (size_t i = 0; i < scene.textures.size(); ++i)
+			textures[i] = resourceReady(scene.textureUploads[i]) ? scene.textures[i] : m_placeholderTexture;
+
+		glBindTextures(0, static_cast<GLsizei>(scene.textures.size()), textures.data());
+		glBindVertexArray(scene.vertexArray);
+
+		glm::mat4 viewProj = snapshot.input.projection * snapshot.input.view;
+
+		for (const IndirectBatch& batch : scene.batches)
+		{
+			Shader& batchShader = batch.simpleModel ? shaderSimple : shader;
+			batchShader.use();
+			batchShader.setMat4("viewProj", viewProj);
+			batchShader.setVec3("viewPos", snapshot.input.cameraPosition);
+			batchShader.setInt("firstCommand", static_cast<int>(batch.firstCommand));
+
+			auto indirect = reinterpret_cast<const void*>(sectionOffset + batch.firstCommand * sizeof(DrawElementsIndirectCommand));
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, indirect, static_cast<GLsizei>(batch.commandCount), 0);
+		}
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		scene.frame = (scene.frame + 1) % IndirectFramesInFlight;
+	}
+
+	// One draw call per visible mesh with per-mesh VAOs. Draws go through the render queue, sorted by program,
+	// textures and distance, and binds of state that is already bound are dropped
+	void drawModels(const RenderCommon::FrameSnapshot& snapshot, Shader& shader, Shader& shaderSimple)
+	{
+		const glm::mat4& projection = snapshot.input.projection;
+		const glm::mat4& view = snapshot.input.view;
+
+		uploadBonePalettes(snapshot);
+
+		m_renderQueue.clear();
+		for (uint32_t modelIndex = 0; modelIndex < m_models.size(); ++modelIndex)
+		{
+			const OpenglModel& model = m_models[modelIndex];
+			const RenderCommon::ModelState& state = snapshot.models[modelIndex];
+
+			if (!state.visible)
+				continue;
+
+			float depth = glm::length(glm::vec3(state.model[3]) - snapshot.input.cameraPosition) / FarPlane;
+
+			uint32_t material = resourceReady(model.texturesUpload) ? model.material : m_placeholderMaterial;
+
+			// Streamed meshes are left out until they have a VAO
+			for (uint32_t i = 0; i < model.model->meshes.size(); ++i)
+			{
+				if (state.meshVisible[i] && model.meshRenderData[i].VAO)
+					m_renderQueue.push(RenderCommon::makeSortKey(model.info.simpleModel ? 0 : 1, material, depth, i), modelIndex, i);
+			}
+		}
+		m_renderQueue.sort();
+
+		// Bindings made outside of the loop, e.g. by the palette upload, aren't tracked
+		m_stateCache.invalidate();
+
+		for (const RenderCommon::DrawItem& item : m_renderQueue.items())
+		{
+			const OpenglModel& model = m_models[item.model];
+			const RenderCommon::ModelState& state = snapshot.models[item.model];
+
+			Shader& currentShader = model.info.simpleModel ? shaderSimple : shader;
+
+			if (m_stateCache.bind(RenderCommon::StateSlot::Pipeline, currentShader.Program))
+			{
+				currentShader.use();
+				// The model's uniforms are program state
+				m_stateCache.invalidate(RenderCommon::StateSlot::ModelData);
+			}
+
+			if (m_stateCache.bind(RenderCommon::StateSlot::ModelData, item.model))
+			{
+				currentShader.setMat4("model", state.model);
+				currentShader.setMat4("PVM", projection * view * state.model);
+
+				if (m_bonePaletteOffsets[item.model] >= 0)
+					glBindBufferRange(GL_UNIFORM_BUFFER, BonePaletteBinding, m_bonePaletteBuffer, m_bonePaletteOffsets[item.model], MaxBones * sizeof(glm::mat4));
+			}
+
+			bool texturesReady = resourceReady(model.texturesUpload);
+			GLuint diffuseTexture = texturesReady ? model.diffuseTexture : m_placeholderTexture;
+			GLuint specularTexture = texturesReady ? model.specularTexture : m_placeholderTexture;
+
+			if (m_stateCache.bind(RenderCommon::StateSlot::Material, (std::uint64_t(diffuseTexture) << 32) | specularTexture))
+			{
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, diffuseTexture);
+				glActiveTexture(GL_TEXTURE0 + 1);
+				glBindTexture(GL_TEXTURE_2D, specularTexture);
+			}
+
+			if (m_stateCache.bind(RenderCommon::StateSlot::Geometry, model.meshRenderData[item.mesh].VAO))
+				glBindVertexArray(model.meshRenderData[item.mesh].VAO);
+
+			glDrawElements(GL_TRIANGLES, model.model->meshes[item.mesh].m_indices.size(), GL_UNSIGNED_INT, 0);
+		}
+
+		glBindVertexArray(0);
+	}
+
+	void createBonePaletteBuffer()
+	{
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, GLint{ sizeof(glm::mat4) });
+
+		GLsizeiptr paletteSize = MaxBones * sizeof(glm::mat4);
+		m_bonePaletteStride = (paletteSize + alignment - 1) / alignment * alignment;
+
+		glGenBuffers(1, &m_bonePaletteBuffer);
+	}
+
+	// Fills mapped buffers in chunks: on the job system's workers with parallel draw preparation, otherwise inline.
+	// GL calls stay on the context thread either way, the workers only write through the mapping
+	template<class F>
+	void forEachChunk(size_t count, size_t grainSize, const F& function)
+	{
+		if (m_settings.parallelDrawPreparation)
+			m_jobSystem.parallelFor(0, count, grainSize, function);
+		else if (count)
+			function(0, count);
+	}
+
+	// One upload for the whole frame instead of a glUniform call per bone
+	void uploadBonePalettes(const RenderCommon::FrameSnapshot& snapshot)
+	{
+		m_bonePaletteOffsets.assign(m_models.size(), -1);
+
+		bool skinned = false;
+		GLsizeiptr size = m_bonePaletteStride;
+		for (size_t i = 0; i < m_models.size(); ++i)
+		{
+			if (!snapshot.models[i].visible || m_models[i].info.simpleModel)
+				continue;
+
+			skinned = true;
+			if (snapshot.models[i].bones.empty())
+			{
+				m_bonePaletteOffsets[i] = 0;
+			}
+			else
+			{
+				m_bonePaletteOffsets[i] = size;
+				size += m_bonePaletteStride;
+			}
+		}
+
+		if (!skinned)
+			return;
+
+		glBindBuffer(GL_UNIFORM_BUFFER, m_bonePaletteBuffer);
+
+		if (size > m_bonePaletteBufferSize)
+		{
+			m_bonePaletteBufferSize = size;
+			glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+
+		// Invalidating orphans the previous frame's storage, so the driver doesn't wait for the draws still reading it
+		auto* palettes = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		if (!palettes)
+			throw std::runtime_error{ "glMapBufferRange has failed for the bone palettes" };
+
+		std::fill_n(reinterpret_cast<glm::mat4*>(palettes), MaxBones, glm::mat4(1.0f));
+
+		auto preparationStart = std::chrono::steady_clock::now();
+
+		forEachChunk(m_models.size(), 8, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+			{
+				if (m_bonePaletteOffsets[i] <= 0)
+					continue;
+
+				auto& bones = snapshot.models[i].bones;
+				std::memcpy(palettes + m_bonePaletteOffsets[i], bones.data(), std::min(bones.size(), MaxBones) * sizeof(glm::mat4));
+			}
+		});
+
+		m_drawPreparationSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - preparationStart).count();
+
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
 	void showFPS()
 	{
 		double currentTime = glfwGetTime();
@@ -459,7 +1292,9 @@ public:
 		if (delta >= 1.0) { // If last cout was more than 1 sec ago
 			double fps = double(nbFrames) / delta;
 
-			glfwSetWindowTitle(m_window, (std::string("OPENGL FPS: ") + std::to_string(fps)).c_str());
+			char title[64];
+			std::snprintf(title, sizeof(title), "OPENGL FPS: %f", fps);
+			glfwSetWindowTitle(m_window, title);
 			lastTime = currentTime;
 
 			nbFrames = 0;
@@ -494,8 +1329,8 @@ private:
 	GLFWwindow* m_window;
 };
 
-RenderOpengl::RenderOpengl()
-	: m_impl{ std::make_unique< RenderOpengl::Impl>() }
+RenderOpengl::RenderOpengl(RenderSettings settings)
+	: m_impl{ std::make_unique< RenderOpengl::Impl>(settings) }
 {
 
 }
@@ -7,7 +7,7 @@
 class RenderOpengl : public IRender
 {
 public:
-	RenderOpengl();
+	RenderOpengl(RenderSettings settings = {});
 	~RenderOpengl();
 
 	double startRenderLoop(std::vector<ModelInfo> modelInfos) override;
@@ -0,0 +1,180 @@
+#include "ResourceLoader.h"
+#include "GLFW/glfw3.h"
+#include "Model.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using namespace std::literals;
+
+ResourceLoader::ResourceLoader(GLFWwindow* sharedWindow)
+{
+	// The context hints of the render window are still set
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	m_window = glfwCreateWindow(1, 1, "OpenGL loader", nullptr, sharedWindow);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	if (!m_window)
+		throw std::runtime_error{ "glfwCreateWindow has failed for the loader context" };
+
+	m_thread = std::thread{ [this] { threadLoop(); } };
+}
+
+ResourceLoader::~ResourceLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_uploads.clear();
+		m_stop = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+
+	for (GLsync fence : m_fences)
+		glDeleteSync(fence);
+
+	glfwDestroyWindow(m_window);
+}
+
+ResourceLoader::Ticket ResourceLoader::loadTexture(const std::string& path, GLuint texture)
+{
+	return enqueue([this, path, texture] { uploadTexture(path, texture); });
+}
+
+ResourceLoader::Ticket ResourceLoader::uploadBuffer(GLuint buffer, const void* data, GLsizeiptr size)
+{
+	return enqueue([buffer, data, size] {
+		// Invalidating, so the driver doesn't keep the old contents around
+		void* mapping = glMapNamedBufferRange(buffer, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (!mapping)
+			throw std::runtime_error{ "glMapNamedBufferRange has failed for a streamed buffer" };
+
+		std::memcpy(mapping, data, static_cast<size_t>(size));
+
+		if (!glUnmapNamedBuffer(buffer))
+			throw std::runtime_error{ "Streamed buffer contents were lost while mapped" };
+	});
+}
+
+void ResourceLoader::update()
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+
+	if (m_exception)
+		std::rethrow_exception(std::exchange(m_exception, nullptr));
+
+	while (!m_fences.empty())
+	{
+		GLenum result = glClientWaitSync(m_fences.front(), 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+			break;
+
+		if (result == GL_WAIT_FAILED)
+			throw std::runtime_error{ "glClientWaitSync has failed for a loader fence" };
+
+		glDeleteSync(m_fences.front());
+		m_fences.pop_front();
+		++m_readyTickets;
+	}
+}
+
+ResourceLoader::Ticket ResourceLoader::enqueue(std::function<void()> upload)
+{
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_uploads.push_back(std::move(upload));
+	}
+	m_condition.notify_one();
+
+	return ++m_queuedTickets;
+}
+
+void ResourceLoader::threadLoop()
+{
+	glfwMakeContextCurrent(m_window);
+	glCreateBuffers(1, &m_pixelBuffer);
+
+	std::unique_lock<std::mutex> lock{ m_mutex };
+
+	while (true)
+	{
+		m_condition.wait(lock, [this] { return !m_uploads.empty() || m_stop; });
+		if (m_stop)
+			break;
+
+		auto upload = std::move(m_uploads.front());
+		m_uploads.pop_front();
+		lock.unlock();
+
+		std::exception_ptr exception;
+
+		try
+		{
+			upload();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+
+		// The fence has to reach the GPU before the render thread can see it signal
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		lock.lock();
+		m_fences.push_back(fence);
+		if (exception && !m_exception)
+			m_exception = exception;
+	}
+
+	lock.unlock();
+
+	glDeleteBuffers(1, &m_pixelBuffer);
+	glFinish();
+	glfwMakeContextCurrent(nullptr);
+}
+
+void ResourceLoader::uploadTexture(const std::string& path, GLuint texture)
+{
+	int width, height;
+	unsigned char* pixels = RenderCommon::Model::loadTexture(path, width, height);
+
+	if (!pixels)
+		throw std::runtime_error{ "Texture failed to load at path: "s + path };
+
+	GLsizeiptr size = GLsizeiptr(width) * height * 4;
+
+	if (size > m_pixelBufferSize)
+	{
+		m_pixelBufferSize = size;
+		glNamedBufferData(m_pixelBuffer, size, nullptr, GL_STREAM_DRAW);
+	}
+
+	// Orphans the storage the previous texture may still be copied from
+	void* mapping = glMapNamedBufferRange(m_pixelBuffer, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!mapping)
+		throw std::runtime_error{ "glMapNamedBufferRange has failed for the pixel buffer" };
+
+	std::memcpy(mapping, pixels, static_cast<size_t>(size));
+	glUnmapNamedBuffer(m_pixelBuffer);
+
+	GLsizei levels = 1;
+	for (int extent = std::max(width, height); extent > 1; extent /= 2)
+		++levels;
+
+	glTextureStorage2D(texture, levels, GL_RGBA8, width, height);
+
+	// The copy runs on the GPU, from the pixel buffer instead of client memory
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer);
+	glTextureSubImage2D(texture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	glGenerateTextureMipmap(texture);
+
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
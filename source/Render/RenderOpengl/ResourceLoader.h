@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstdint>
+#include "glad/glad.h"
+
+struct GLFWwindow;
+
+// Uploads textures and buffers on its own thread, through a hidden window whose context shares objects with the
+// render context. Every upload ends with a fence, the render thread polls them in update() and uses a resource only
+// once ready() says so, after binding it again. Uploads finish in the order they were queued
+class ResourceLoader final
+{
+public:
+    // Increases with every queued upload, 0 is always ready
+    using Ticket = std::uint64_t;
+
+    // GLFW creates windows on the main thread only
+    explicit ResourceLoader(GLFWwindow* sharedWindow);
+    // Drops the uploads that haven't started yet. The render context has to be current
+    ~ResourceLoader();
+
+    ResourceLoader(const ResourceLoader&) = delete;
+    ResourceLoader& operator=(const ResourceLoader&) = delete;
+
+    // Decodes the image on the loader thread and uploads it with mipmaps through a pixel buffer object.
+    // texture is a name made with glCreateTextures, without storage
+    Ticket loadTexture(const std::string& path, GLuint texture);
+
+    // buffer needs immutable storage of size bytes with GL_MAP_WRITE_BIT. data is read on the loader thread,
+    // it has to stay valid until the upload is ready
+    Ticket uploadBuffer(GLuint buffer, const void* data, GLsizeiptr size);
+
+    // Render thread, once per frame. Rethrows the loader thread's exceptions
+    void update();
+
+    bool ready(Ticket ticket) const { return ticket <= m_readyTickets; }
+    bool allReady() const { return m_readyTickets == m_queuedTickets; }
+    Ticket queuedUploads() const { return m_queuedTickets; }
+
+private:
+    Ticket enqueue(std::function<void()> upload);
+    void threadLoop();
+
+    void uploadTexture(const std::string& path, GLuint texture);
+
+    GLFWwindow* m_window = nullptr;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_uploads;
+    // Fences of the finished uploads, in ticket order
+    std::deque<GLsync> m_fences;
+    std::exception_ptr m_exception;
+    bool m_stop = false;
+
+    // Render thread only
+    Ticket m_queuedTickets = 0;
+    Ticket m_readyTickets = 0;
+
+    // Loader thread only, orphaned for every texture
+    GLuint m_pixelBuffer = 0;
+    GLsizeiptr m_pixelBufferSize = 0;
+
+    std::thread m_thread;
+};
@@ -1,19 +1,79 @@
 #include "Shader.h"
 #include "glad/glad.h"
 #include <cassert>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <system_error>
 #include "glm/gtc/type_ptr.hpp"
 
 using namespace std::literals;
+namespace fs = std::filesystem;
 
-Shader::Shader(std::string vertexSource, std::string fragmentSource)
+// GL_KHR_parallel_shader_compile, not in the generated glad
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// One file per program, named after the hash of its sources and the driver
+const fs::path g_programCachePath = "program_cache";
+
+// Written in front of the binary, the driver rejects a binary of another format or version on its own
+struct ProgramBinaryHeader
 {
-	GLuint vertex = compileShader(vertexSource.c_str(), GL_VERTEX_SHADER);
-	GLuint fragment = compileShader(fragmentSource.c_str(), GL_FRAGMENT_SHADER);
+	uint64_t key;
+	uint32_t format;
+};
 
-	m_programID = linkShader(vertex, fragment);
+static uint64_t fnv1a(uint64_t hash, std::string_view data)
+{
+	for (unsigned char c : data)
+	{
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
 
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
+	return hash;
+}
+
+static uint64_t programKey(const std::string& vertexSource, const std::string& fragmentSource)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	// A driver update can change the binary format without telling
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		auto string = reinterpret_cast<const char*>(glGetString(name));
+		hash = fnv1a(hash, string ? string : "");
+		hash = fnv1a(hash, "\n");
+	}
+
+	hash = fnv1a(hash, vertexSource);
+	hash = fnv1a(hash, "\n");
+	return fnv1a(hash, fragmentSource);
+}
+
+Shader::Shader(std::string vertexSource, std::string fragmentSource) :
+	m_vertexSource{ std::move(vertexSource) },
+	m_fragmentSource{ std::move(fragmentSource) }
+{
+	m_cacheKey = programKey(m_vertexSource, m_fragmentSource);
+
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(m_cacheKey));
+	m_cachePath = g_programCachePath / (name + ".bin"s);
+
+	m_programID = glCreateProgram();
+
+	if (loadBinary())
+	{
+		m_loadedFromCache = true;
+		return;
+	}
+
+	linkShader();
 }
 
 Shader::~Shader()
@@ -24,59 +84,136 @@ Shader::~Shader()
 	m_programID = 0;
 }
 
+bool Shader::enableParallelCompile(GLADloadproc loader)
+{
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+	for (GLint i = 0; i < extensionCount; ++i)
+	{
+		auto extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		const char* function = nullptr;
+
+		if (std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+			function = "glMaxShaderCompilerThreadsKHR";
+		else if (std::strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+			function = "glMaxShaderCompilerThreadsARB";
+		else
+			continue;
+
+		auto maxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(loader(function));
+		if (!maxShaderCompilerThreads)
+			continue;
+
+		// As many threads as the driver wants
+		maxShaderCompilerThreads(0xFFFFFFFF);
+		return true;
+	}
+
+	return false;
+}
+
+void Shader::finish()
+{
+	if (m_linked)
+		return;
+
+	// The first status query is where the driver is waited for
+	GLint success = 0;
+	glGetProgramiv(m_programID, GL_LINK_STATUS, &success);
+
+	if (!success && m_loadedFromCache)
+	{
+		// Rejected binary, e.g. after a driver update. Built from the sources and cached again
+		m_loadedFromCache = false;
+		linkShader();
+		glGetProgramiv(m_programID, GL_LINK_STATUS, &success);
+	}
+
+	if (!success)
+	{
+		for (GLuint shader : { m_vertexShader, m_fragmentShader })
+		{
+			GLint compiled = 0;
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+			if (!compiled)
+				reportError(shader, "shader compilation failed");
+		}
+
+		reportError(m_programID, "shader linking failed");
+	}
+
+	for (GLuint* shader : { &m_vertexShader, &m_fragmentShader })
+	{
+		if (!*shader)
+			continue;
+
+		glDetachShader(m_programID, *shader);
+		glDeleteShader(*shader);
+		*shader = 0;
+	}
+
+	if (!m_loadedFromCache)
+		saveBinary();
+
+	m_vertexSource = {};
+	m_fragmentSource = {};
+
+	cacheUniformLocations();
+	m_linked = true;
+}
+
 void Shader::use()
 {
 	assert(m_programID);
+	finish();
 	glUseProgram(m_programID);
 }
 
 void Shader::setBool(const std::string& name, bool value) const
 {
 	assert(m_programID);
-	try
-	{
-		glUniform1i(getUniformLocation(name.c_str()), (int)value);
-	}
-	catch (...) {}
+	glUniform1i(uniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
 	assert(m_programID);
-	try
-	{
-	glUniform1i(getUniformLocation(name.c_str()), value);
-	}
-	catch (...) {}
+	glUniform1i(uniformLocation(name), value);
 }
+
 void Shader::setFloat(const std::string& name, float value) const
 {
 	assert(m_programID);
-	try
-	{
-	glUniform1f(getUniformLocation(name.c_str()), value);
-	}
-	catch (...) {}
+	glUniform1f(uniformLocation(name), value);
 }
 
 void Shader::setMat4(const std::string& name, const glm::mat4& mat)
 {
-	try
-	{
-	glUniformMatrix4fv(getUniformLocation(name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
-	}
-	catch (...) {}
+	glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, glm::value_ptr(mat));
 }
 
 void Shader::setVec3(const std::string& name, const glm::vec3& vec)
 {
-	try
-	{
-	glUniform3fv(getUniformLocation(name.c_str()), 1, glm::value_ptr(vec));
-	}
-	catch (...) {}
+	glUniform3fv(uniformLocation(name), 1, glm::value_ptr(vec));
 }
 
+GLint Shader::uniformLocation(std::string_view name) const
+{
+	auto findIt = m_uniformLocations.find(name);
+	return findIt != m_uniformLocations.end() ? findIt->second : -1;
+}
+
+void Shader::bindUniformBlock(const char* name, GLuint binding)
+{
+	finish();
+
+	GLuint index = glGetUniformBlockIndex(m_programID, name);
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(m_programID, index, binding);
+}
+
+// Status is checked in finish()
 GLuint Shader::compileShader(const char* source, GLenum shaderType)
 {
 	GLuint shader = 0;
@@ -85,43 +222,107 @@ GLuint Shader::compileShader(const char* source, GLenum shaderType)
 	glShaderSource(shader, 1, &source, NULL);
 	glCompileShader(shader);
 
-	GLint success = 0;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-
-	if(!success)
-		reportError(shader, "shader compilation failed");
-
 	return shader;
 }
 
-GLuint Shader::linkShader(GLuint vertex, GLuint fragment)
+void Shader::linkShader()
 {
-	GLuint programID = glCreateProgram();
-	glAttachShader(programID, vertex);
-	glAttachShader(programID, fragment);
-	glLinkProgram(programID);
-
-	GLint success = 0;
-	glGetProgramiv(programID, GL_LINK_STATUS, &success);
+	m_vertexShader = compileShader(m_vertexSource.c_str(), GL_VERTEX_SHADER);
+	m_fragmentShader = compileShader(m_fragmentSource.c_str(), GL_FRAGMENT_SHADER);
 
-	if (!success)
-		reportError(programID, "shader linking failed");
-
-	return programID;
+	glAttachShader(m_programID, m_vertexShader);
+	glAttachShader(m_programID, m_fragmentShader);
+	glProgramParameteri(m_programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(m_programID);
 }
 
 void Shader::reportError(GLuint Id, std::string message)
 {
 	GLchar infoLog[512] = { 0 };
-	glGetShaderInfoLog(Id, sizeof(infoLog), NULL, infoLog);
+	if (glIsProgram(Id))
+		glGetProgramInfoLog(Id, sizeof(infoLog), NULL, infoLog);
+	else
+		glGetShaderInfoLog(Id, sizeof(infoLog), NULL, infoLog);
 	throw std::runtime_error{ "ERROR: " + message + ":" + infoLog };
 }
 
-GLint Shader::getUniformLocation(const std::string & name) const
+bool Shader::loadBinary()
+{
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (formatCount == 0)
+		return false;
+
+	std::ifstream file(m_cachePath, std::ios::binary);
+	if (!file)
+		return false;
+
+	std::vector<char> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	ProgramBinaryHeader header{};
+	if (data.size() <= sizeof(header))
+		return false;
+
+	std::memcpy(&header, data.data(), sizeof(header));
+	if (header.key != m_cacheKey)
+		return false;
+
+	// Link status is checked in finish() like for a program built from sources
+	glProgramBinary(m_programID, header.format, data.data() + sizeof(header), static_cast<GLsizei>(data.size() - sizeof(header)));
+	return true;
+}
+
+void Shader::saveBinary()
+{
+	GLint formatCount = 0, length = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	glGetProgramiv(m_programID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (formatCount == 0 || length <= 0)
+		return;
+
+	ProgramBinaryHeader header{};
+	header.key = m_cacheKey;
+
+	std::vector<char> data(sizeof(header) + length);
+	GLenum format = 0;
+	glGetProgramBinary(m_programID, length, &length, &format, data.data() + sizeof(header));
+	header.format = format;
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	// A failed write only costs a compile next time
+	std::error_code error;
+	fs::create_directories(g_programCachePath, error);
+
+	std::ofstream file(m_cachePath, std::ios::binary | std::ios::trunc);
+	file.write(data.data(), static_cast<std::streamsize>(sizeof(header) + length));
+}
+
+void Shader::cacheUniformLocations()
 {
-	auto res = glGetUniformLocation(m_programID, name.c_str());
-	if (res < 0)
-		throw std::runtime_error{ "glGetUniformLocation for "s + name + " not found" };
+	GLint uniformCount = 0, maxNameLength = 0;
+	glGetProgramiv(m_programID, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(m_programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::string name(std::max(maxNameLength, 1), '\0');
 
-	return res;
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(m_programID, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+
+		std::string uniformName = name.substr(0, length);
+
+		// Members of uniform blocks have no location
+		GLint location = glGetUniformLocation(m_programID, uniformName.c_str());
+		if (location < 0)
+			continue;
+
+		m_uniformLocations[uniformName] = location;
+
+		// Arrays are reported as "name[0]"
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			m_uniformLocations[uniformName.substr(0, uniformName.size() - 3)] = location;
+	}
 }
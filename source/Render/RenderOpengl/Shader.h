@@ -1,30 +1,65 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <map>
 #include <filesystem>
+#include <cstdint>
 #include "glad/glad.h"
 #include "glm/glm.hpp"
 
 class Shader final
 {
 public:
+    // Starts building the program, from the program binary cache when it has one for these sources and this driver.
+    // Nothing waits for the driver until the program is first used, so programs created back to back compile
+    // concurrently where the driver supports it
     Shader(std::string vertexSource, std::string fragmentSource);
     ~Shader();
 
+    // Lets the driver compile on its own threads with GL_KHR_parallel_shader_compile or the ARB version.
+    // Returns false without either. The context has to be current
+    static bool enableParallelCompile(GLADloadproc loader);
+
+    // Blocks until the program is linked and throws if that failed. use() and bindUniformBlock() call it
+    void finish();
+    bool loadedFromCache() const { return m_loadedFromCache; }
+
     void use();
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
     void setMat4(const std::string& name, const glm::mat4& mat);
     void setVec3(const std::string& name, const glm::vec3& vec);
+
+    // Looked up in the table built at link time, -1 for names the program doesn't use, which glUniform* ignores.
+    // Arrays are found by their name and by the name of their first element
+    GLint uniformLocation(std::string_view name) const;
+
+    // Does nothing when the block was optimized out
+    void bindUniformBlock(const char* name, GLuint binding);
 private:
     GLuint compileShader(const char* source, GLenum shaderType);
-    GLuint linkShader(GLuint vertex, GLuint fragment);
+    void linkShader();
     void reportError(GLuint Id, std::string message);
 
-	GLint getUniformLocation(const std::string& name) const;
+    bool loadBinary();
+    void saveBinary();
+
+    void cacheUniformLocations();
 private:
     unsigned int m_programID = 0;
+    // Kept until finish(), the sources to compile when the driver rejects the cached binary
+    std::string m_vertexSource;
+    std::string m_fragmentSource;
+    GLuint m_vertexShader = 0;
+    GLuint m_fragmentShader = 0;
+    uint64_t m_cacheKey = 0;
+    std::filesystem::path m_cachePath;
+    bool m_loadedFromCache = false;
+    bool m_linked = false;
+
+    std::map<std::string, GLint, std::less<>> m_uniformLocations;
 public:
     unsigned int& Program = m_programID;
 };
\ No newline at end of file
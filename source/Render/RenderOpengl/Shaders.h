@@ -1,12 +1,24 @@
 inline constexpr char* const s_shader_f = 
 #include "ShadersGen/shader_f.frag"
 ;
+inline constexpr char* const s_shader_f_indirect = 
+#include "ShadersGen/shader_f_indirect.frag"
+;
 inline constexpr char* const s_shader_f_simple = 
 #include "ShadersGen/shader_f_simple.frag"
 ;
+inline constexpr char* const s_shader_f_simple_indirect = 
+#include "ShadersGen/shader_f_simple_indirect.frag"
+;
 inline constexpr char* const s_shader_v = 
 #include "ShadersGen/shader_v.vert"
 ;
+inline constexpr char* const s_shader_v_indirect = 
+#include "ShadersGen/shader_v_indirect.vert"
+;
 inline constexpr char* const s_shader_v_simple = 
 #include "ShadersGen/shader_v_simple.vert"
 ;
+inline constexpr char* const s_shader_v_simple_indirect = 
+#include "ShadersGen/shader_v_simple_indirect.vert"
+;
@@ -0,0 +1,18 @@
+#version 460 core
+
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+flat in uint TextureIndex;
+
+#define MAX_TEXTURES 16
+
+// Texture units 0 to MAX_TEXTURES - 1
+layout (binding = 0) uniform sampler2D textures[MAX_TEXTURES];
+
+void main()
+{
+    FragColor = texture(textures[TextureIndex], TexCoords);
+}
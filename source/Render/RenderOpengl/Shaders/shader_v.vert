@@ -21,7 +21,11 @@ uniform mat4 model;
 uniform mat4 PVM;
 
 #define MAX_BONES 100
-uniform mat4 gBones[MAX_BONES];
+// Range of the frame's palette buffer, bound per model
+layout (std140) uniform BonePalette
+{
+    mat4 gBones[MAX_BONES];
+};
 
 void main()
 {
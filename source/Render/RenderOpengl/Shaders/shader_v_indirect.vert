@@ -0,0 +1,71 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+layout (location = 3) in ivec4 aBoneIDs;
+layout (location = 4) in ivec4 aBoneIDs2;
+
+layout (location = 5) in vec4 aWeights;
+layout (location = 6) in vec4 aWeights2;
+
+out vec2 TexCoords;
+out vec3 FragPos;
+out vec3 Normal;
+flat out uint TextureIndex;
+
+#define MAX_BONES 100
+
+layout (std430, binding = 0) readonly buffer ModelBuffer
+{
+    mat4 models[];
+};
+
+layout (std430, binding = 1) readonly buffer BoneBuffer
+{
+    mat4 gBones[];
+};
+
+// Model index of every instance, the instances of a command start at its baseInstance
+layout (std430, binding = 2) readonly buffer DrawInstanceBuffer
+{
+    uint drawInstances[];
+};
+
+// Per indirect command, indexed with firstCommand + gl_DrawID so the index stays dynamically uniform
+layout (std430, binding = 3) readonly buffer CommandTextureBuffer
+{
+    uint commandTextures[];
+};
+
+uniform mat4 viewProj;
+// First command of the multi-draw, gl_DrawID restarts at 0 for every one
+uniform int firstCommand;
+
+void main()
+{
+    uint modelIndex = drawInstances[gl_BaseInstance + gl_InstanceID];
+    mat4 model = models[modelIndex];
+    uint boneBase = modelIndex * MAX_BONES;
+
+    mat4 BoneTransform = gBones[boneBase + aBoneIDs[0]] * aWeights[0];
+    BoneTransform     += gBones[boneBase + aBoneIDs[1]] * aWeights[1];
+    BoneTransform     += gBones[boneBase + aBoneIDs[2]] * aWeights[2];
+    BoneTransform     += gBones[boneBase + aBoneIDs[3]] * aWeights[3];
+
+    BoneTransform     += gBones[boneBase + aBoneIDs2[0]] * aWeights2[0];
+    BoneTransform     += gBones[boneBase + aBoneIDs2[1]] * aWeights2[1];
+    BoneTransform     += gBones[boneBase + aBoneIDs2[2]] * aWeights2[2];
+    BoneTransform     += gBones[boneBase + aBoneIDs2[3]] * aWeights2[3];
+
+    vec4 PosL = BoneTransform * vec4(aPos, 1.0);
+
+    gl_Position = viewProj * model * PosL;
+    FragPos = vec3(model * vec4(aPos, 1.0));
+
+    vec4 NormalL = BoneTransform * vec4(aNormal, 0.0);
+    Normal = (model * NormalL).xyz;
+
+    TexCoords = aTexCoords;
+    TextureIndex = commandTextures[firstCommand + gl_DrawID];
+}
@@ -0,0 +1,43 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+out vec3 FragPos;
+out vec3 Normal;
+flat out uint TextureIndex;
+
+layout (std430, binding = 0) readonly buffer ModelBuffer
+{
+    mat4 models[];
+};
+
+// Model index of every instance, the instances of a command start at its baseInstance
+layout (std430, binding = 2) readonly buffer DrawInstanceBuffer
+{
+    uint drawInstances[];
+};
+
+// Per indirect command, indexed with firstCommand + gl_DrawID so the index stays dynamically uniform
+layout (std430, binding = 3) readonly buffer CommandTextureBuffer
+{
+    uint commandTextures[];
+};
+
+uniform mat4 viewProj;
+// First command of the multi-draw, gl_DrawID restarts at 0 for every one
+uniform int firstCommand;
+
+void main()
+{
+    mat4 model = models[drawInstances[gl_BaseInstance + gl_InstanceID]];
+
+    gl_Position = viewProj * model * vec4(aPos, 1.0);
+    FragPos = vec3(model * vec4(aPos, 1.0));
+
+    Normal = aNormal.xyz;
+
+    TexCoords = aTexCoords;
+    TextureIndex = commandTextures[firstCommand + gl_DrawID];
+}
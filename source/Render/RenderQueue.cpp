@@ -0,0 +1,80 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace RenderCommon
+{
+	std::uint64_t makeSortKey(std::uint32_t pipeline, std::uint32_t material, float depth, std::uint32_t mesh)
+	{
+		constexpr std::uint32_t depthMax = (1u << 24) - 1;
+
+		auto quantizedDepth = static_cast<std::uint32_t>(std::clamp(depth, 0.0f, 1.0f) * depthMax);
+
+		return (std::uint64_t(std::min(pipeline, 0xFFu)) << 56) |
+			(std::uint64_t(std::min(material, 0xFFFFu)) << 40) |
+			(std::uint64_t(quantizedDepth) << 16) |
+			std::uint64_t(std::min(mesh, 0xFFFFu));
+	}
+
+	void RenderQueue::sort()
+	{
+		constexpr size_t passes = sizeof(std::uint64_t);
+
+		// Histograms of all passes in one read of the keys
+		std::array<std::array<size_t, 256>, passes> counts{};
+		for (const DrawItem& item : m_items)
+		{
+			for (size_t pass = 0; pass < passes; ++pass)
+				++counts[pass][(item.key >> (pass * 8)) & 0xFF];
+		}
+
+		m_scratch.resize(m_items.size());
+
+		for (size_t pass = 0; pass < passes; ++pass)
+		{
+			auto& passCounts = counts[pass];
+
+			if (std::any_of(passCounts.begin(), passCounts.end(), [&](size_t count) { return count == m_items.size(); }))
+				continue;
+
+			std::array<size_t, 256> offsets;
+			size_t offset = 0;
+			for (size_t digit = 0; digit < 256; ++digit)
+			{
+				offsets[digit] = offset;
+				offset += passCounts[digit];
+			}
+
+			for (const DrawItem& item : m_items)
+				m_scratch[offsets[(item.key >> (pass * 8)) & 0xFF]++] = item;
+
+			m_items.swap(m_scratch);
+		}
+	}
+
+	void StateCache::merge(const StateCache& other)
+	{
+		for (size_t i = 0; i < SlotCount; ++i)
+		{
+			m_requested[i] += other.m_requested[i];
+			m_issued[i] += other.m_issued[i];
+		}
+	}
+
+	void StateCache::print(std::ostream& out, const char* backend, std::uint64_t frames) const
+	{
+		static constexpr const char* slotNames[SlotCount] = { "pipeline", "material", "model data", "geometry" };
+
+		if (!frames)
+			return;
+
+		out << backend << " state changes per frame, without / with the render queue:";
+		for (size_t i = 0; i < SlotCount; ++i)
+		{
+			if (m_requested[i])
+				out << " " << slotNames[i] << " " << m_requested[i] / frames << " / " << m_issued[i] / frames;
+		}
+		out << std::endl;
+	}
+}
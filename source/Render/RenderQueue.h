@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+
+namespace RenderCommon
+{
+	// 64-bit sort key, most significant field first: pipeline (8 bits), material (16 bits), depth (24 bits), mesh (16 bits).
+	// Depth sits above the mesh because both backends keep vertex buffers per model: the meshes of a model stay
+	// together, so its per-model state is bound once. depth is the view distance divided by the far plane, near first
+	std::uint64_t makeSortKey(std::uint32_t pipeline, std::uint32_t material, float depth, std::uint32_t mesh);
+
+	struct DrawItem
+	{
+		std::uint64_t key = 0;
+		std::uint32_t model = 0;
+		std::uint32_t mesh = 0;
+	};
+
+	// Draws of a frame, sorted by key before submission. Storage is kept between frames
+	class RenderQueue
+	{
+	public:
+		void clear() { m_items.clear(); }
+		void push(std::uint64_t key, std::uint32_t model, std::uint32_t mesh) { m_items.push_back({ key, model, mesh }); }
+
+		// Stable LSD radix sort on the key bytes, bytes all keys share are skipped
+		void sort();
+
+		const std::vector<DrawItem>& items() const { return m_items; }
+
+	private:
+		std::vector<DrawItem> m_items;
+		std::vector<DrawItem> m_scratch;
+	};
+
+	enum class StateSlot { Pipeline, Material, ModelData, Geometry, Count };
+
+	// Remembers the bound value of every slot so redundant binds can be dropped, and counts the binds asked for and issued
+	class StateCache
+	{
+	public:
+		static constexpr size_t SlotCount = static_cast<size_t>(StateSlot::Count);
+
+		// True when value isn't bound yet, the caller binds it then
+		bool bind(StateSlot slot, std::uint64_t value)
+		{
+			size_t index = static_cast<size_t>(slot);
+			++m_requested[index];
+
+			if (m_valid[index] && m_bound[index] == value)
+				return false;
+
+			m_valid[index] = true;
+			m_bound[index] = value;
+			++m_issued[index];
+			return true;
+		}
+
+		// The next bind of slot is issued whatever was bound
+		void invalidate(StateSlot slot) { m_valid[static_cast<size_t>(slot)] = false; }
+		void invalidate() { m_valid.fill(false); }
+
+		// Adds the other cache's counters to this one
+		void merge(const StateCache& other);
+
+		std::uint64_t requested(StateSlot slot) const { return m_requested[static_cast<size_t>(slot)]; }
+		std::uint64_t issued(StateSlot slot) const { return m_issued[static_cast<size_t>(slot)]; }
+
+		// Per frame and slot: binds without the cache, the ones issued with it. Slots never bound are left out
+		void print(std::ostream& out, const char* backend, std::uint64_t frames) const;
+
+	private:
+		std::array<std::uint64_t, SlotCount> m_bound{};
+		std::array<bool, SlotCount> m_valid{};
+		std::array<std::uint64_t, SlotCount> m_requested{};
+		std::array<std::uint64_t, SlotCount> m_issued{};
+	};
+}
@@ -0,0 +1,602 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+	struct UsageInfo
+	{
+		VkPipelineStageFlags stages;
+		VkAccessFlags readAccess;
+		VkAccessFlags writeAccess;
+		VkImageLayout layout;
+		VkImageUsageFlags imageUsage;
+	};
+
+	UsageInfo usageInfo(RenderGraph::Usage usage)
+	{
+		switch (usage)
+		{
+		case RenderGraph::Usage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+		case RenderGraph::Usage::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+		case RenderGraph::Usage::DepthSampledCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+		case RenderGraph::Usage::SampledCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+		case RenderGraph::Usage::StorageImageCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+		case RenderGraph::Usage::StorageBufferCompute:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+		case RenderGraph::Usage::StorageBufferVertex:
+			return { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+		case RenderGraph::Usage::IndirectBuffer:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, 0,
+				VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+		case RenderGraph::Usage::TransferDst:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+		}
+
+		throw std::runtime_error("unknown render graph usage");
+	}
+
+	constexpr VkAccessFlags g_writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(ResourceId resource, Usage usage)
+{
+	m_graph.addAccess(m_pass, resource, usage, false, false);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(ResourceId resource, Usage usage, bool discard)
+{
+	m_graph.addAccess(m_pass, resource, usage, true, discard);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffects()
+{
+	m_graph.m_passes[m_pass].sideEffects = true;
+	return *this;
+}
+
+RenderGraph::RenderGraph(VkDevice device, VkPhysicalDevice physicalDevice) :
+	m_device{ device },
+	m_physicalDevice{ physicalDevice }
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+	for (auto& resource : m_resources)
+	{
+		if (!resource.transient)
+			continue;
+
+		if (resource.view)
+			vkDestroyImageView(m_device, resource.view, nullptr);
+
+		if (resource.image)
+			vkDestroyImage(m_device, resource.image, nullptr);
+	}
+
+	for (auto& block : m_memoryBlocks)
+	{
+		if (block.memory)
+			vkFreeMemory(m_device, block.memory, nullptr);
+	}
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(std::string name, const ImageDesc& desc)
+{
+	Resource resource;
+	resource.name = std::move(name);
+	resource.isImage = true;
+	resource.transient = true;
+	resource.desc = desc;
+
+	m_resources.push_back(std::move(resource));
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(std::string name, VkImageAspectFlags aspect)
+{
+	Resource resource;
+	resource.name = std::move(name);
+	resource.isImage = true;
+	resource.desc.aspect = aspect;
+	resource.desc.mipLevels = VK_REMAINING_MIP_LEVELS;
+
+	m_resources.push_back(std::move(resource));
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::importBuffer(std::string name)
+{
+	Resource resource;
+	resource.name = std::move(name);
+
+	m_resources.push_back(std::move(resource));
+	return static_cast<ResourceId>(m_resources.size() - 1);
+}
+
+void RenderGraph::setExternallySynchronized(ResourceId resource)
+{
+	m_resources.at(resource).external = true;
+}
+
+void RenderGraph::markOutput(ResourceId resource)
+{
+	m_resources.at(resource).output = true;
+}
+
+void RenderGraph::bindImage(ResourceId resource, VkImage image)
+{
+	auto& imported = m_resources.at(resource);
+	if (imported.transient)
+		throw std::runtime_error("render graph: can't bind transient image " + imported.name);
+
+	imported.image = image;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(std::string name, PassCallback callback)
+{
+	if (m_compiled)
+		throw std::runtime_error("render graph: pass " + name + " added after compile");
+
+	Pass pass;
+	pass.name = std::move(name);
+	pass.callback = std::move(callback);
+
+	m_passes.push_back(std::move(pass));
+	return PassBuilder{ *this, static_cast<uint32_t>(m_passes.size() - 1) };
+}
+
+void RenderGraph::addAccess(uint32_t pass, ResourceId resource, Usage usage, bool write, bool discard)
+{
+	const auto& declared = m_resources.at(resource);
+	UsageInfo info = usageInfo(usage);
+
+	Access access;
+	access.resource = resource;
+	access.stages = info.stages;
+	access.access = write ? info.readAccess | info.writeAccess : info.readAccess;
+	access.layout = declared.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	access.imageUsage = info.imageUsage;
+	access.write = write;
+	access.discard = write && discard;
+
+	if (write && !info.writeAccess)
+		throw std::runtime_error("render graph: read-only usage written in pass " + m_passes[pass].name);
+
+	auto& accesses = m_passes[pass].accesses;
+	auto it = std::find_if(accesses.begin(), accesses.end(), [resource](const Access& other) { return other.resource == resource; });
+
+	if (it == accesses.end())
+	{
+		accesses.push_back(access);
+		return;
+	}
+
+	// Several usages of one resource inside a pass, the pass orders them itself
+	if (declared.isImage && it->layout != access.layout)
+		throw std::runtime_error("render graph: " + declared.name + " used in two layouts by pass " + m_passes[pass].name);
+
+	it->stages |= access.stages;
+	it->access |= access.access;
+	it->imageUsage |= access.imageUsage;
+	// Content is only discarded when every usage overwrites it, a read in the same pass needs the previous one
+	it->discard = it->discard && access.discard;
+	it->write = it->write || access.write;
+}
+
+void RenderGraph::compile()
+{
+	cullPasses();
+	computeLifetimes();
+	allocateTransientImages();
+	buildBarriers();
+
+	m_compiled = true;
+}
+
+// A pass is kept when it has side effects or writes something a later kept pass or the next frame needs
+void RenderGraph::cullPasses()
+{
+	std::vector<bool> needed(m_resources.size());
+	for (size_t i = 0; i < m_resources.size(); ++i)
+		needed[i] = m_resources[i].output;
+
+	for (auto pass = m_passes.rbegin(); pass != m_passes.rend(); ++pass)
+	{
+		pass->alive = pass->sideEffects || std::any_of(pass->accesses.begin(), pass->accesses.end(),
+			[&needed](const Access& access) { return access.write && needed[access.resource]; });
+
+		if (!pass->alive)
+			continue;
+
+		for (auto& access : pass->accesses)
+		{
+			if (access.discard)
+				needed[access.resource] = false;
+		}
+
+		// Partial writes keep the previous content alive as well
+		for (auto& access : pass->accesses)
+		{
+			if (!access.discard)
+				needed[access.resource] = true;
+		}
+	}
+
+	m_statistics.passes = static_cast<uint32_t>(std::count_if(m_passes.begin(), m_passes.end(), [](const Pass& pass) { return pass.alive; }));
+	m_statistics.culledPasses = static_cast<uint32_t>(m_passes.size()) - m_statistics.passes;
+}
+
+void RenderGraph::computeLifetimes()
+{
+	for (int i = 0; i < static_cast<int>(m_passes.size()); ++i)
+	{
+		if (!m_passes[i].alive)
+			continue;
+
+		for (auto& access : m_passes[i].accesses)
+		{
+			auto& resource = m_resources[access.resource];
+
+			if (resource.firstPass < 0)
+			{
+				if (resource.transient && !access.discard)
+					throw std::runtime_error("render graph: transient image " + resource.name + " is used before it is written");
+
+				resource.firstPass = i;
+			}
+
+			resource.lastPass = i;
+			resource.usage |= access.imageUsage;
+		}
+	}
+}
+
+// Transient images are placed greedily, biggest first, into the first memory block whose images are all dead
+// while this one is alive. Every image of a block is bound at offset 0
+void RenderGraph::allocateTransientImages()
+{
+	std::vector<ResourceId> transients;
+
+	for (ResourceId id = 0; id < m_resources.size(); ++id)
+	{
+		auto& resource = m_resources[id];
+		if (!resource.transient || resource.firstPass < 0)
+			continue;
+
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = resource.desc.extent.width;
+		imageInfo.extent.height = resource.desc.extent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = resource.desc.mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = resource.desc.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = resource.usage | resource.desc.extraUsage;
+
+		if (resource.desc.transientAttachment)
+		{
+			constexpr VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+				| VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+			if (imageInfo.usage & ~attachmentUsage)
+				throw std::runtime_error("render graph: transient attachment " + resource.name + " is used outside of render passes");
+
+			imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+		imageInfo.samples = resource.desc.samples;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateImage(m_device, &imageInfo, nullptr, &resource.image))
+			throw std::runtime_error("render graph: failed to create image " + resource.name);
+
+		vkGetImageMemoryRequirements(m_device, resource.image, &resource.memoryRequirements);
+
+		// Lazily allocated memory has no backing until used, there's nothing to gain from aliasing it
+		if (resource.desc.transientAttachment && findMemoryType(resource.memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+		{
+			MemoryBlock block;
+			block.size = resource.memoryRequirements.size;
+			block.memoryTypeBits = resource.memoryRequirements.memoryTypeBits;
+			block.lazilyAllocated = true;
+			block.resources.push_back(id);
+
+			resource.memoryBlock = static_cast<int>(m_memoryBlocks.size());
+			m_memoryBlocks.push_back(std::move(block));
+			continue;
+		}
+
+		m_statistics.transientMemoryWithoutAliasing += resource.memoryRequirements.size;
+		transients.push_back(id);
+	}
+
+	std::stable_sort(transients.begin(), transients.end(), [this](ResourceId a, ResourceId b) {
+		return m_resources[a].memoryRequirements.size > m_resources[b].memoryRequirements.size;
+	});
+
+	for (ResourceId id : transients)
+	{
+		auto& resource = m_resources[id];
+
+		auto overlaps = [this, &resource](ResourceId other) {
+			return resource.firstPass <= m_resources[other].lastPass && m_resources[other].firstPass <= resource.lastPass;
+		};
+
+		auto block = std::find_if(m_memoryBlocks.begin(), m_memoryBlocks.end(), [&](const MemoryBlock& block) {
+			return !block.lazilyAllocated && (block.memoryTypeBits & resource.memoryRequirements.memoryTypeBits)
+				&& std::none_of(block.resources.begin(), block.resources.end(), overlaps);
+		});
+
+		if (block == m_memoryBlocks.end())
+			block = m_memoryBlocks.insert(m_memoryBlocks.end(), MemoryBlock{});
+
+		block->size = std::max(block->size, resource.memoryRequirements.size);
+		block->memoryTypeBits &= resource.memoryRequirements.memoryTypeBits;
+		block->resources.push_back(id);
+		resource.memoryBlock = static_cast<int>(block - m_memoryBlocks.begin());
+	}
+
+	for (auto& block : m_memoryBlocks)
+	{
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = block.size;
+		auto memoryType = findMemoryType(block.memoryTypeBits,
+			block.lazilyAllocated ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		if (!memoryType)
+			throw std::runtime_error("render graph: failed to find suitable memory type");
+
+		allocInfo.memoryTypeIndex = *memoryType;
+
+		if (vkAllocateMemory(m_device, &allocInfo, nullptr, &block.memory))
+			throw std::runtime_error("render graph: failed to allocate transient memory");
+
+		if (block.lazilyAllocated)
+			m_statistics.lazilyAllocatedMemory += block.size;
+		else
+			m_statistics.transientMemory += block.size;
+
+		for (ResourceId id : block.resources)
+		{
+			auto& resource = m_resources[id];
+			vkBindImageMemory(m_device, resource.image, block.memory, 0);
+
+			VkImageViewCreateInfo viewInfo{};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = resource.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = resource.desc.format;
+			// Barriers of depth/stencil formats need both aspects, a sampled view only the depth one
+			viewInfo.subresourceRange.aspectMask = (resource.desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? VkImageAspectFlags(VK_IMAGE_ASPECT_DEPTH_BIT) : resource.desc.aspect;
+			viewInfo.subresourceRange.levelCount = resource.desc.mipLevels;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(m_device, &viewInfo, nullptr, &resource.view))
+				throw std::runtime_error("render graph: failed to create image view " + resource.name);
+		}
+	}
+}
+
+void RenderGraph::buildBarriers()
+{
+	// One frame is simulated to find the state every resource is left in, which is where the next frame starts
+	std::vector<ResourceState> states(m_resources.size());
+
+	for (auto& pass : m_passes)
+	{
+		if (!pass.alive)
+			continue;
+
+		for (auto& access : pass.accesses)
+			applyAccess(states[access.resource], access, nullptr, nullptr);
+	}
+
+	std::vector<ResourceState> finalStates = states;
+
+	for (size_t i = 0; i < m_resources.size(); ++i)
+	{
+		if (m_resources[i].external)
+			states[i] = ResourceState{ 0, 0, 0, 0, finalStates[i].layout };
+	}
+
+	for (int i = 0; i < static_cast<int>(m_passes.size()); ++i)
+	{
+		auto& pass = m_passes[i];
+		if (!pass.alive)
+			continue;
+
+		pass.memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+		for (auto& access : pass.accesses)
+		{
+			const auto& resource = m_resources[access.resource];
+
+			// The first user of aliased memory waits for every image sharing it,
+			// the earlier ones of this frame and the later ones of the previous frame
+			ResourceState blockState{};
+			bool aliased = resource.memoryBlock >= 0 && m_memoryBlocks[resource.memoryBlock].resources.size() > 1 && resource.firstPass == i;
+
+			if (aliased)
+			{
+				for (ResourceId other : m_memoryBlocks[resource.memoryBlock].resources)
+				{
+					blockState.writeStages |= finalStates[other].writeStages;
+					blockState.writeAccess |= finalStates[other].writeAccess;
+					blockState.readStages |= finalStates[other].readStages;
+					blockState.readAccess |= finalStates[other].readAccess;
+				}
+			}
+
+			applyAccess(states[access.resource], access, aliased ? &blockState : nullptr, &pass);
+		}
+
+		if (pass.srcStages)
+		{
+			++m_statistics.barrierBatches;
+			m_statistics.imageBarriers += static_cast<uint32_t>(pass.imageBarriers.size());
+		}
+	}
+}
+
+// Records into pass the barrier the access needs, if any, and advances the resource state
+void RenderGraph::applyAccess(ResourceState& state, const Access& access, const ResourceState* discardSource, Pass* pass)
+{
+	const auto& resource = m_resources[access.resource];
+	const ResourceState& source = discardSource ? *discardSource : state;
+
+	bool transition = resource.isImage && (access.discard || state.layout != access.layout);
+	bool write = access.write || transition;
+
+	bool needBarrier = write
+		? transition || source.writeStages || source.readStages
+		: source.writeStages && ((state.readStages & access.stages) != access.stages || (state.readAccess & access.access) != access.access);
+
+	if (needBarrier && pass)
+	{
+		VkPipelineStageFlags srcStages = source.writeStages | (write ? source.readStages : 0);
+
+		pass->srcStages |= srcStages ? srcStages : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+		pass->dstStages |= access.stages;
+
+		if (resource.isImage)
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = source.writeAccess;
+			barrier.dstAccessMask = access.access;
+			barrier.oldLayout = access.discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+			barrier.newLayout = access.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.subresourceRange.aspectMask = resource.desc.aspect;
+			barrier.subresourceRange.levelCount = resource.desc.mipLevels;
+			barrier.subresourceRange.layerCount = 1;
+
+			pass->imageBarriers.push_back(barrier);
+			pass->imageBarrierResources.push_back(access.resource);
+		}
+		else
+		{
+			pass->memoryBarrier.srcAccessMask |= source.writeAccess;
+			pass->memoryBarrier.dstAccessMask |= access.access;
+		}
+	}
+
+	if (write)
+	{
+		state.writeStages = access.write ? access.stages : 0;
+		state.writeAccess = access.write ? access.access & g_writeAccessMask : 0;
+		state.readStages = access.write ? 0 : access.stages;
+		state.readAccess = access.write ? 0 : access.access;
+	}
+	else
+	{
+		state.readStages |= access.stages;
+		state.readAccess |= access.access;
+	}
+
+	state.layout = access.layout;
+}
+
+void RenderGraph::execute(const PassContext& context)
+{
+	if (!m_compiled)
+		throw std::runtime_error("render graph: execute before compile");
+
+	for (auto& pass : m_passes)
+	{
+		if (!pass.alive)
+			continue;
+
+		if (pass.srcStages)
+		{
+			for (size_t i = 0; i < pass.imageBarriers.size(); ++i)
+			{
+				const auto& resource = m_resources[pass.imageBarrierResources[i]];
+				if (!resource.image)
+					throw std::runtime_error("render graph: image " + resource.name + " is not bound");
+
+				pass.imageBarriers[i].image = resource.image;
+			}
+
+			bool memoryBarrier = pass.memoryBarrier.srcAccessMask || pass.memoryBarrier.dstAccessMask;
+
+			vkCmdPipelineBarrier(context.commandBuffer, pass.srcStages, pass.dstStages, 0,
+				memoryBarrier ? 1 : 0, &pass.memoryBarrier, 0, nullptr,
+				static_cast<uint32_t>(pass.imageBarriers.size()), pass.imageBarriers.data());
+		}
+
+		if (pass.callback)
+			pass.callback(context);
+	}
+}
+
+VkImage RenderGraph::image(ResourceId resource) const
+{
+	return m_resources.at(resource).image;
+}
+
+VkImageView RenderGraph::imageView(ResourceId resource) const
+{
+	return m_resources.at(resource).view;
+}
+
+VkDeviceSize RenderGraph::imageSize(ResourceId resource) const
+{
+	return m_resources.at(resource).memoryRequirements.size;
+}
+
+VkDeviceSize RenderGraph::lazilyCommittedMemory() const
+{
+	VkDeviceSize committed = 0;
+
+	for (auto& block : m_memoryBlocks)
+	{
+		if (!block.lazilyAllocated)
+			continue;
+
+		VkDeviceSize blockCommitted = 0;
+		vkGetDeviceMemoryCommitment(m_device, block.memory, &blockCommitted);
+		committed += blockCommitted;
+	}
+
+	return committed;
+}
+
+std::optional<uint32_t> RenderGraph::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	VkPhysicalDeviceMemoryProperties memProperties{};
+	vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
+
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+
+	return std::nullopt;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "glad/vulkan.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <optional>
+
+// Frame graph for the passes recorded into one command buffer.
+// Passes declare which images and buffers they read and write, compile() drops passes whose results
+// are never consumed, places transient images with disjoint lifetimes in the same memory and derives
+// the barriers between passes. Passes run in the order they were added, the graph is replayed every frame,
+// so the state a resource is left in at the end of a frame is its state at the start of the next one
+class RenderGraph
+{
+public:
+	using ResourceId = uint32_t;
+
+	enum class Usage
+	{
+		ColorAttachment,      // COLOR_ATTACHMENT_OPTIMAL
+		DepthAttachment,      // DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		DepthSampledCompute,  // DEPTH_STENCIL_READ_ONLY_OPTIMAL, sampled by a compute shader
+		SampledCompute,       // GENERAL, sampled by a compute shader
+		StorageImageCompute,  // GENERAL, image load/store in a compute shader
+		StorageBufferCompute,
+		StorageBufferVertex,
+		IndirectBuffer,
+		TransferDst,
+	};
+
+	struct ImageDesc
+	{
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+		uint32_t mipLevels = 1;
+		VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		// Added to the usage derived from the declared accesses
+		VkImageUsageFlags extraUsage = 0;
+		// Only accessed as an attachment and never stored: gets TRANSIENT_ATTACHMENT usage and
+		// lazily allocated memory when the device has it, so tilers may keep it in tile memory only
+		bool transientAttachment = false;
+	};
+
+	struct PassContext
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint32_t frameIndex = 0;
+		uint32_t imageIndex = 0;
+	};
+
+	using PassCallback = std::function<void(const PassContext&)>;
+
+	class PassBuilder
+	{
+	public:
+		PassBuilder& read(ResourceId resource, Usage usage);
+		// discard - the pass overwrites the whole resource, its previous content is not needed
+		PassBuilder& write(ResourceId resource, Usage usage, bool discard = false);
+		// Never culled, e.g. renders into the swapchain
+		PassBuilder& sideEffects();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : m_graph{ graph }, m_pass{ pass } {}
+
+		RenderGraph& m_graph;
+		uint32_t m_pass;
+	};
+
+	RenderGraph(VkDevice device, VkPhysicalDevice physicalDevice);
+	~RenderGraph();
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// Created and owned by the graph, content doesn't live past the frame
+	ResourceId createImage(std::string name, const ImageDesc& desc);
+
+	// Owned elsewhere, the handle is bound with bindImage before execute. Barriers cover all its mip levels
+	ResourceId importImage(std::string name, VkImageAspectFlags aspect);
+	ResourceId importBuffer(std::string name);
+
+	// Synchronized outside of the graph before the frame (e.g. by a semaphore from another queue):
+	// the first access doesn't wait for the end of the previous frame
+	void setExternallySynchronized(ResourceId resource);
+
+	// Content is consumed after the frame, so the passes writing it are kept
+	void markOutput(ResourceId resource);
+
+	void bindImage(ResourceId resource, VkImage image);
+
+	PassBuilder addPass(std::string name, PassCallback callback);
+
+	void compile();
+	void execute(const PassContext& context);
+
+	VkImage image(ResourceId resource) const;
+	VkImageView imageView(ResourceId resource) const;
+	VkDeviceSize imageSize(ResourceId resource) const;
+
+	struct Statistics
+	{
+		uint32_t passes = 0;
+		uint32_t culledPasses = 0;
+		uint32_t barrierBatches = 0;
+		uint32_t imageBarriers = 0;
+		VkDeviceSize transientMemory = 0;
+		VkDeviceSize transientMemoryWithoutAliasing = 0;
+		// Requested by transient attachments, not part of the two above
+		VkDeviceSize lazilyAllocatedMemory = 0;
+	};
+
+	const Statistics& statistics() const { return m_statistics; }
+
+	// Memory the driver actually committed to the lazily allocated attachments so far
+	VkDeviceSize lazilyCommittedMemory() const;
+
+private:
+	struct Access
+	{
+		ResourceId resource = 0;
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageUsageFlags imageUsage = 0;
+		bool write = false;
+		bool discard = false;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool isImage = false;
+		bool transient = false;
+		bool external = false;
+		bool output = false;
+
+		ImageDesc desc;
+		VkImageUsageFlags usage = 0;
+
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkMemoryRequirements memoryRequirements{};
+		int memoryBlock = -1;
+
+		// Alive passes range, used for aliasing
+		int firstPass = -1;
+		int lastPass = -1;
+	};
+
+	// Access state since the last write, what the next access has to wait for
+	struct ResourceState
+	{
+		VkPipelineStageFlags writeStages = 0;
+		VkAccessFlags writeAccess = 0;
+		VkPipelineStageFlags readStages = 0;
+		VkAccessFlags readAccess = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		PassCallback callback;
+		std::vector<Access> accesses;
+		bool sideEffects = false;
+		bool alive = false;
+
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		VkMemoryBarrier memoryBarrier{};
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		std::vector<ResourceId> imageBarrierResources;
+	};
+
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeBits = ~0u;
+		bool lazilyAllocated = false;
+		std::vector<ResourceId> resources;
+	};
+
+	void addAccess(uint32_t pass, ResourceId resource, Usage usage, bool write, bool discard);
+	void cullPasses();
+	void computeLifetimes();
+	void allocateTransientImages();
+	void buildBarriers();
+	void applyAccess(ResourceState& state, const Access& access, const ResourceState* discardSource, Pass* pass);
+	std::optional<uint32_t> findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	VkDevice m_device;
+	VkPhysicalDevice m_physicalDevice;
+
+	std::vector<Resource> m_resources;
+	std::vector<Pass> m_passes;
+	std::vector<MemoryBlock> m_memoryBlocks;
+	bool m_compiled = false;
+
+	Statistics m_statistics;
+};
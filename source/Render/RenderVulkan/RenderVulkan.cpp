@@ -15,8 +15,16 @@
 #include "ShadersGen/Shaders.h"
 
 #include "Utils.h"
+#include "JobSystem.h"
+#include "TaskGraph.h"
+#include "FramePipeline.h"
+#include "FrameArena.h"
 #include "Camera.h"
+#include "Frustum.h"
+#include "FrameSnapshot.h"
+#include "RenderQueue.h"
 #include "Model.h"
+#include "RenderGraph.h"
 
 #include <iostream>
 #include <vector>
@@ -28,9 +36,12 @@
 #include <memory>
 #include <functional>
 #include <cstring>
+#include <cstdio>
 #include <chrono>
 #include <filesystem>
+#include <fstream>
 #include <thread>
+#include <deque>
 
 namespace fs = std::filesystem;
 using namespace std::literals;
@@ -52,6 +63,18 @@ const std::array<const char*, 1> g_deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+const fs::path g_pipelineCachePath = "pipeline_cache.bin";
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE, see vkGetPipelineCacheData
+struct PipelineCacheHeader
+{
+	uint32_t headerSize;
+	uint32_t headerVersion;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 	VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -203,6 +226,44 @@ public:
 		alignas(16) glm::mat4 PVM;
 		alignas(16) glm::mat4 model;
 	};
+
+	struct PushConstantIndirect {
+		alignas(16) glm::mat4 viewProj;
+		alignas(16) glm::vec4 viewPos;
+	};
+
+	// Mirrors ModelData/DrawInstance of shader_indirect.vert (std430)
+	struct IndirectModelData {
+		alignas(16) glm::mat4 model;
+	};
+
+	struct IndirectDrawInstance {
+		uint32_t modelIndex;
+		uint32_t textureIndex;
+	};
+
+	constexpr static inline uint32_t MaxIndirectTextures = 16;
+
+	// Mirrors CullData of cull.comp (std140)
+	struct CullData {
+		alignas(16) glm::vec4 frustumPlanes[6];
+		alignas(16) glm::mat4 prevViewProj;
+		glm::vec2 pyramidSize;
+		uint32_t instanceCount;
+		uint32_t occlusionEnabled;
+	};
+
+	struct CullInstance {
+		uint32_t modelIndex;
+		uint32_t textureIndex;
+		uint32_t commandIndex;
+		uint32_t boundsIndex;
+	};
+
+	struct CullCounters {
+		uint32_t drawn;
+		uint32_t culled;
+	};
 public:
 	std::function<void(VkShaderModule)> m_shaderModuleDeleter =
 		[this](VkShaderModule smodule) {
@@ -239,7 +300,31 @@ public:
 			vkDestroyCommandPool(m_device, commandPool, nullptr);
 	};
 
-	using CommandBufferDeleter = std::function<void(VkCommandBuffer)>;
+	std::function<void(VkPipeline)> m_pipelineDeleter = [this](VkPipeline pipeline) {
+		if (pipeline)
+			vkDestroyPipeline(m_device, pipeline, nullptr);
+	};
+
+	std::function<void(VkPipelineLayout)> m_pipelineLayoutDeleter = [this](VkPipelineLayout pipelineLayout) {
+		if (pipelineLayout)
+			vkDestroyPipelineLayout(m_device, pipelineLayout, nullptr);
+	};
+
+	std::function<void(VkDescriptorSetLayout)> m_descriptorSetLayoutDeleter = [this](VkDescriptorSetLayout descriptorSetLayout) {
+		if (descriptorSetLayout)
+			vkDestroyDescriptorSetLayout(m_device, descriptorSetLayout, nullptr);
+	};
+
+	std::function<void(VkDescriptorPool)> m_descriptorPoolDeleter = [this](VkDescriptorPool descriptorPool) {
+		if (descriptorPool)
+			vkDestroyDescriptorPool(m_device, descriptorPool, nullptr);
+	};
+
+	std::function<void(VkDescriptorUpdateTemplate)> m_descriptorUpdateTemplateDeleter = [this](VkDescriptorUpdateTemplate descriptorUpdateTemplate) {
+		if (descriptorUpdateTemplate)
+			vkDestroyDescriptorUpdateTemplate(m_device, descriptorUpdateTemplate, nullptr);
+	};
+
 	
 	using unique_ptr_shared_module = std::unique_ptr<std::remove_pointer_t<VkShaderModule>, decltype(m_shaderModuleDeleter)>;
 	using unique_ptr_buffer = std::unique_ptr< std::remove_pointer_t<VkBuffer>, decltype(m_bufferDeleter)>;
@@ -248,12 +333,20 @@ public:
 	using unique_ptr_image_view = std::unique_ptr< std::remove_pointer_t<VkImageView>, decltype(m_imageViewDeleter)>;
 	using unique_ptr_sampler = std::unique_ptr< std::remove_pointer_t<VkSampler>, decltype(m_samplerDeleter)>;
 	using unique_ptr_command_pool = std::unique_ptr< std::remove_pointer_t<VkCommandPool>, decltype(m_commandPoolDeleter)>;
-	using unique_ptr_command_buffer = std::unique_ptr< std::remove_pointer_t<VkCommandBuffer>, CommandBufferDeleter>;
+	using unique_ptr_pipeline = std::unique_ptr< std::remove_pointer_t<VkPipeline>, decltype(m_pipelineDeleter)>;
+	using unique_ptr_pipeline_layout = std::unique_ptr< std::remove_pointer_t<VkPipelineLayout>, decltype(m_pipelineLayoutDeleter)>;
+	using unique_ptr_descriptor_set_layout = std::unique_ptr< std::remove_pointer_t<VkDescriptorSetLayout>, decltype(m_descriptorSetLayoutDeleter)>;
+	using unique_ptr_descriptor_pool = std::unique_ptr< std::remove_pointer_t<VkDescriptorPool>, decltype(m_descriptorPoolDeleter)>;
+	using unique_ptr_descriptor_update_template = std::unique_ptr< std::remove_pointer_t<VkDescriptorUpdateTemplate>, decltype(m_descriptorUpdateTemplateDeleter)>;
 public:
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
 
+		// Compute-only family or a second queue of the graphics family, empty on single queue devices
+		std::optional<uint32_t> computeFamily;
+		uint32_t computeQueueIndex = 0;
+
 		bool isComplete() {
 			return graphicsFamily.has_value() && presentFamily.has_value();
 		}
@@ -304,6 +397,49 @@ public:
 		void* uniformBufferMemoryMapping;
 	};
 
+	struct DeviceBuffer
+	{
+		DeviceBuffer(RenderVulkan::Impl* _this) :
+			buffer{ nullptr, _this->m_bufferDeleter },
+			bufferMemory{ nullptr, _this->m_deviceMemoryDeleter }
+		{}
+
+		unique_ptr_buffer buffer;
+		unique_ptr_device_memory bufferMemory;
+	};
+
+	// Upload submission still in flight. Its command buffer or staging buffer is released once m_uploadTimeline reaches value
+	struct PendingUpload
+	{
+		PendingUpload(RenderVulkan::Impl* _this) :
+			staging{ _this }
+		{}
+
+		uint64_t value = 0;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		DeviceBuffer staging;
+	};
+
+	struct HostVisibleBuffer
+	{
+		HostVisibleBuffer(RenderVulkan::Impl* _this) :
+			buffer{ nullptr, _this->m_bufferDeleter },
+			bufferMemory{ nullptr, _this->m_deviceMemoryDeleter }
+		{}
+
+		unique_ptr_buffer buffer;
+		unique_ptr_device_memory bufferMemory;
+		void* mapping = nullptr;
+	};
+
+	// Descriptors of set 0 of shader.vert/shader.frag, laid out for the descriptor update templates
+	struct MeshDescriptorData
+	{
+		VkDescriptorBufferInfo uniformBuffer{};
+		VkDescriptorImageInfo diffuse{};
+		VkDescriptorImageInfo specular{};
+	};
+
 	struct VulkanModel
 	{
 		std::unique_ptr<RenderCommon::Model> model;
@@ -311,6 +447,8 @@ public:
 		std::map<RenderCommon::Texture::Type, MeshTextureImage*> meshTextureImages;
 		std::vector<MeshVertexBuffer> meshVertexBuffers;
 		std::vector<MeshUniformBuffer> meshUniformBuffers;
+		// Per frame in flight, no sets with push descriptors
+		std::vector<MeshDescriptorData> meshDescriptorData;
 		std::vector<VkDescriptorSet> meshDescriptorSet;
 
 		glm::vec3 position{};
@@ -319,28 +457,198 @@ public:
 		std::vector<PushConstantBufferObject> pushConstant{};
 		std::vector<UniformBufferObject> uniformBuffer{};
 
+		// Dense index of the diffuse texture for the render queue sort key
+		uint32_t material = 0;
+
 		ModelInfo info{};
 	};
 
+	struct ComputePipeline
+	{
+		ComputePipeline(RenderVulkan::Impl* _this) :
+			descriptorSetLayout{ nullptr, _this->m_descriptorSetLayoutDeleter },
+			pipelineLayout{ nullptr, _this->m_pipelineLayoutDeleter },
+			pipeline{ nullptr, _this->m_pipelineDeleter }
+		{}
+
+		unique_ptr_descriptor_set_layout descriptorSetLayout;
+		unique_ptr_pipeline_layout pipelineLayout;
+		unique_ptr_pipeline pipeline;
+	};
+
+	// Max-reduced copy of the depth buffer with a full mip chain, rebuilt at the end of every frame
+	struct DepthPyramid
+	{
+		DepthPyramid(RenderVulkan::Impl* _this) :
+			image{ nullptr, _this->m_imageDeleter },
+			imageMemory{ nullptr, _this->m_deviceMemoryDeleter },
+			imageView{ nullptr, _this->m_imageViewDeleter },
+			sampler{ nullptr, _this->m_samplerDeleter },
+			depthSampler{ nullptr, _this->m_samplerDeleter },
+			descriptorPool{ nullptr, _this->m_descriptorPoolDeleter }
+		{}
+
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t mipLevels = 0;
+
+		unique_ptr_image image;
+		unique_ptr_device_memory imageMemory;
+		unique_ptr_image_view imageView;
+		std::vector<unique_ptr_image_view> mipViews;
+		unique_ptr_sampler sampler;
+		unique_ptr_sampler depthSampler;
+
+		unique_ptr_descriptor_pool descriptorPool;
+		VkDescriptorSet depthDescriptorSet = VK_NULL_HANDLE;
+		std::vector<VkDescriptorSet> reduceDescriptorSets;
+
+		// Set once a frame has been rendered into it
+		bool valid = false;
+	};
+
+	// Graphics pipeline variants. Every variant is created by its own thread pool task together with its shader modules,
+	// all tasks share m_pipelineCache. get() blocks only while the variant is still being created
+	struct PipelineLibrary
+	{
+		enum Variant { Regular, Simple, Indirect, SimpleIndirect, VariantCount };
+
+		PipelineLibrary(RenderVulkan::Impl* _this) :
+			m_this{ _this },
+			startTime{ std::chrono::steady_clock::now() }
+		{}
+
+		~PipelineLibrary()
+		{
+			for (auto& pipeline : pipelines)
+			{
+				if (!pipeline.valid())
+					continue;
+
+				// A failed creation has already been reported by get
+				try { m_this->m_pipelineDeleter(pipeline.get()); }
+				catch (const std::exception&) {}
+			}
+		}
+
+		template<class F>
+		void add(Variant variant, F create)
+		{
+			pipelines[variant] = m_this->m_jobSystem.enqueue([this, variant, create] {
+				auto taskStart = std::chrono::steady_clock::now();
+				VkPipeline pipeline = create();
+				auto taskEnd = std::chrono::steady_clock::now();
+
+				createSeconds[variant] = std::chrono::duration<double>(taskEnd - taskStart).count();
+				finishSeconds[variant] = std::chrono::duration<double>(taskEnd - startTime).count();
+				return pipeline;
+			}, utils::JobPriority::Background).share();
+		}
+
+		bool has(Variant variant) const
+		{
+			return pipelines[variant].valid();
+		}
+
+		VkPipeline get(Variant variant) const
+		{
+			return pipelines[variant].get();
+		}
+
+		// Startup stall, accounted in waitSeconds
+		void wait(Variant variant)
+		{
+			auto waitStart = std::chrono::steady_clock::now();
+			pipelines[variant].get();
+			waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+		}
+
+		RenderVulkan::Impl* m_this;
+		std::chrono::steady_clock::time_point startTime;
+		std::array<std::shared_future<VkPipeline>, VariantCount> pipelines;
+
+		// Written by the tasks, read once the variant is ready
+		std::array<double, VariantCount> createSeconds{};
+		std::array<double, VariantCount> finishSeconds{};
+		double waitSeconds = 0;
+	};
+
+	// Consecutive indirect commands that share a pipeline
+	struct IndirectBatch
+	{
+		bool simpleModel = false;
+		uint32_t firstCommand = 0;
+		uint32_t commandCount = 0;
+	};
+
+	struct GpuDrivenScene
+	{
+		GpuDrivenScene(RenderVulkan::Impl* _this) :
+			geometry{ _this },
+			drawInstances{ _this },
+			drawCommands{ _this },
+			cullInstances{ _this },
+			meshBounds{ _this },
+			zeroedCommands{ _this }
+		{}
+
+		DeviceBuffer geometry;
+		VkDeviceSize indexOffset = 0;
+
+		DeviceBuffer drawInstances;
+		DeviceBuffer drawCommands;
+		std::vector<IndirectBatch> batches;
+
+		std::vector<MeshTextureImage*> textures;
+
+		// Per swapchain image, written by the CPU every frame
+		std::vector<HostVisibleBuffer> modelBuffers;
+		std::vector<HostVisibleBuffer> boneBuffers;
+		std::vector<VkDescriptorSet> descriptorSets;
+
+		// Compute culling, created only when it is enabled
+		uint32_t cullInstanceCount = 0;
+		DeviceBuffer cullInstances;
+		DeviceBuffer meshBounds;
+		// drawCommands with zero instanceCount, copied over culledCommands before culling
+		DeviceBuffer zeroedCommands;
+		VkDeviceSize drawCommandsSize = 0;
+
+		// Per swapchain image, written by cull.comp
+		std::vector<DeviceBuffer> culledCommands;
+		std::vector<DeviceBuffer> culledInstances;
+		std::vector<HostVisibleBuffer> cullData;
+		std::vector<HostVisibleBuffer> cullCounters;
+		std::vector<bool> cullCountersWritten;
+		std::vector<VkDescriptorSet> cullDescriptorSets;
+		// Still point to a retired depth pyramid, rewritten once their frame is no longer in flight
+		std::vector<bool> cullPyramidDescriptorsStale;
+	};
+
+	// Recording state of one contiguous model batch, recorded by a single task per frame
 	struct ThreadData {
 		ThreadData(RenderVulkan::Impl* self) :
-			m_this{ self },
-			commandPool{ nullptr, self->m_commandPoolDeleter }
+			m_this{ self }
 		{		
 		}
 
 		ThreadData(ThreadData&&) = default;
-
-		~ThreadData()
-		{
-			commandBuffers.clear();
-		}
 	
 		RenderVulkan::Impl* m_this;
-		unique_ptr_command_pool commandPool;
 
-		std::vector<std::vector<unique_ptr_command_buffer>> commandBuffers;
-		int usedCommandBuffers = 0;
+		// Ring of pools indexed by frame in flight, each one is reset as a whole once the frame timeline passes its frame
+		std::vector<unique_ptr_command_pool> commandPools;
+
+		// Secondary command buffer of each pool, allocated once and freed together with the pool
+		std::vector<VkCommandBuffer> commandBuffers;
+
+		// Models [firstModel, endModel) of m_models
+		size_t firstModel = 0;
+		size_t endModel = 0;
+
+		// Draws of the batch sorted before recording, and the binds the batch recorded
+		RenderCommon::RenderQueue renderQueue;
+		RenderCommon::StateCache stateCache;
 	};
 public:
 	GLFWwindow* m_window = nullptr;
@@ -367,12 +675,23 @@ public:
 	VkRenderPass m_renderPass = VK_NULL_HANDLE;
 
 	VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_descriptorSetLayoutIndirect = VK_NULL_HANDLE;
 	VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
 
+	RenderSettings::DescriptorMode m_descriptorMode = RenderSettings::DescriptorMode::DescriptorSets;
+	bool m_pushDescriptors = false;
+	// Descriptor set or push descriptor template of m_descriptorSetLayout, depending on m_descriptorMode
+	VkDescriptorUpdateTemplate m_descriptorUpdateTemplate = VK_NULL_HANDLE;
+
 	VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
 
-	VkPipeline m_graphicsPipeline = VK_NULL_HANDLE;
-	VkPipeline m_graphicsPipelineSimple = VK_NULL_HANDLE;
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	bool m_pipelineCacheWarm = false;
+
+	VkPipelineLayout m_pipelineLayoutIndirect = VK_NULL_HANDLE;
+
+	// Rebuilt with the swapchain
+	std::unique_ptr<PipelineLibrary> m_pipelines;
 
 	std::vector<VkFramebuffer> m_swapChainFramebuffers;
 
@@ -383,19 +702,41 @@ public:
 	std::vector<VkSemaphore> m_imageAvailableSemaphores;
 	std::vector<VkSemaphore> m_renderFinishedSemaphores;
 
-	std::vector<VkFence> m_inFlightFences;
-	std::vector<VkFence> m_imagesInFlight;
+	// Counts submitted frames, every frame slot remembers the value its last submission signals
+	VkSemaphore m_frameTimeline = VK_NULL_HANDLE;
+	uint64_t m_frameTimelineValue = 0;
+	std::vector<uint64_t> m_frameTimelineValues;
 
-	VkImage m_depthImage = VK_NULL_HANDLE;
-	VkDeviceMemory m_depthImageMemory = VK_NULL_HANDLE;
-	VkImageView m_depthImageView = VK_NULL_HANDLE;
+	// Counts upload submissions. Frames wait on it on the GPU instead of the CPU waiting for the queue to go idle
+	VkSemaphore m_uploadTimeline = VK_NULL_HANDLE;
+	uint64_t m_uploadTimelineValue = 0;
+	uint64_t m_uploadTimelineValueWaited = 0;
+	std::deque<PendingUpload> m_pendingUploads;
+
+	VkQueryPool m_timestampQueryPool = VK_NULL_HANDLE;
+
+	// Queue for the per-frame compute passes, VK_NULL_HANDLE when they are recorded into the graphics command buffer
+	VkQueue m_computeQueue = VK_NULL_HANDLE;
+	uint32_t m_graphicsFamily = 0;
+	uint32_t m_computeFamily = 0;
+	VkCommandPool m_computeCommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_computeCommandBuffers;
+
+	// Signaled with the number of the frame whose compute passes completed
+	VkSemaphore m_computeTimeline = VK_NULL_HANDLE;
+
+	VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
 
 	VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
-	VkImage colorImage = VK_NULL_HANDLE;
-	VkDeviceMemory colorImageMemory = VK_NULL_HANDLE;
-	VkImageView colorImageView = VK_NULL_HANDLE;
+	// Passes of the graphics command buffer, owns the MSAA color and depth attachments. Rebuilt with the swapchain
+	std::unique_ptr<RenderGraph> m_renderGraph;
+	RenderGraph::ResourceId m_colorTarget = 0;
+	RenderGraph::ResourceId m_depthTarget = 0;
+	RenderGraph::ResourceId m_depthPyramidResource = 0;
 public:
+	RenderSettings m_settings;
+
 	bool m_framebufferResized = false;
 	int m_framebufferWidth = g_WIDTH;
 	int m_framebufferHeight = g_HEIGHT;
@@ -406,54 +747,148 @@ public:
 	double m_currentTime{};
 	double m_lastTime{};
 
-	int m_MAX_FRAMES_IN_FLIGHT = 2;
-	size_t m_currentFrame = 0;
+	uint32_t m_framesInFlight = 2;
+	uint32_t m_currentFrame = 0;
+
+	// CPU submit to GPU completion of every frame, see collectFrameLatency
+	struct FrameLatency
+	{
+		bool pending = false;
+		std::chrono::steady_clock::time_point submitTime;
+		uint64_t submitTimestamp = 0;
+	};
+
+	std::vector<FrameLatency> m_frameLatencies;
+	bool m_calibratedTimestamps = false;
+	double m_timestampPeriod = 1.0;
+	uint64_t m_timestampMask = ~uint64_t{};
+	double m_latencySeconds = 0;
+	std::uint64_t m_latencySamples = 0;
 
 	std::vector<VulkanModel> m_models;
 	uint32_t m_modelsMeshCount = 0;
 
-	int m_coreNumber = std::thread::hardware_concurrency();
-	utils::ThreadPool m_threadPool{ m_coreNumber };
+	static constexpr float FarPlane = 200.f;
+
+	// Shared with the other runs, see utils::sharedJobSystem. The second client is the simulation thread
+	utils::JobSystem& m_jobSystem;
+	int m_coreNumber = static_cast<int>(m_jobSystem.workerCount());
 	std::vector<ThreadData> m_threadData;
 
+	// CPU work of a frame between acquire and present, built once by createFrameGraph
+	utils::TaskGraph m_frameGraph;
+	uint32_t m_imageIndex = 0;
+
+	// Camera, transforms, culling and poses the frame is rendered with. Pipelined mode simulates the next one
+	// on m_framePipeline's thread meanwhile, otherwise it's simulated into m_lockstepSnapshot right before the frame
+	const RenderCommon::FrameSnapshot* m_snapshot = nullptr;
+	std::unique_ptr<utils::FramePipeline<RenderCommon::FrameInput, RenderCommon::FrameSnapshot>> m_framePipeline;
+	RenderCommon::FrameSnapshot m_lockstepSnapshot;
+	double m_simulateSeconds = 0;
+	double m_inputLatencySeconds = 0;
+
+	utils::FrameAllocationCheck m_allocationCheck;
+
 	std::map<std::string, MeshTextureImage> m_imagesCache;
+
+	std::unique_ptr<GpuDrivenScene> m_gpuDriven;
+	bool m_multiDrawIndirect = false;
+
+	// Swapchain and the resources sized by it, replaced while older frames may still render with them
+	struct RetiredSwapChain
+	{
+		// Destroyed once the frame timeline reaches it
+		uint64_t frameTimelineValue = 0;
+
+		VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+		std::vector<VkImageView> imageViews;
+		std::vector<VkFramebuffer> framebuffers;
+		std::unique_ptr<RenderGraph> renderGraph;
+		std::unique_ptr<DepthPyramid> depthPyramid;
+	};
+
+	std::deque<RetiredSwapChain> m_retiredSwapChains;
+	std::uint64_t m_swapChainRecreations = 0;
+	double m_swapChainRecreateSeconds = 0;
+
+	std::unique_ptr<ComputePipeline> m_cullPipeline;
+	std::unique_ptr<ComputePipeline> m_depthPyramidPipeline;
+	std::unique_ptr<ComputePipeline> m_depthReducePipeline;
+	std::unique_ptr<DepthPyramid> m_depthPyramid;
+	glm::mat4 m_prevViewProj{ 1.0f };
+
+	// Models with the CPU culling, mesh instances with the compute culling
+	std::uint64_t m_drawnCount = 0;
+	std::uint64_t m_culledCount = 0;
+	std::uint64_t m_culledFrames = 0;
+
+	double m_recordSeconds = 0;
+	double m_commandPoolResetSeconds = 0;
+	std::uint64_t m_recordedFrames = 0;
 public:
-	void cleanupSwapChain() {
-		if (m_depthImageView)
-		{
-			vkDestroyImageView(m_device, m_depthImageView, nullptr);
-			m_depthImageView = VK_NULL_HANDLE;
-		}
+	void destroyRetiredSwapChain(RetiredSwapChain& retired) {
+		retired.depthPyramid.reset();
+		retired.renderGraph.reset();
+
+		for (auto framebuffer : retired.framebuffers)
+			vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+
+		for (auto imageView : retired.imageViews)
+			vkDestroyImageView(m_device, imageView, nullptr);
+
+		vkDestroySwapchainKHR(m_device, retired.swapChain, nullptr);
+	}
+
+	void releaseRetiredSwapChains() {
+		if (m_retiredSwapChains.empty())
+			return;
+
+		uint64_t completedValue = timelineValue(m_frameTimeline);
 
-		if (m_depthImage)
+		while (!m_retiredSwapChains.empty() && m_retiredSwapChains.front().frameTimelineValue <= completedValue)
 		{
-			vkDestroyImage(m_device, m_depthImage, nullptr);
-			m_depthImage = VK_NULL_HANDLE;
+			destroyRetiredSwapChain(m_retiredSwapChains.front());
+			m_retiredSwapChains.pop_front();
 		}
+	}
+
+	// Render pass, pipelines and their layouts only depend on the swapchain format
+	void cleanupGraphicsPipelines() {
+		// Waits for the variants still being created
+		m_pipelines.reset();
 
-		if (m_depthImageMemory)
+		if (m_descriptorUpdateTemplate)
 		{
-			vkFreeMemory(m_device, m_depthImageMemory, nullptr);
-			m_depthImageMemory = VK_NULL_HANDLE;
+			vkDestroyDescriptorUpdateTemplate(m_device, m_descriptorUpdateTemplate, nullptr);
+			m_descriptorUpdateTemplate = VK_NULL_HANDLE;
 		}
 
-		if (colorImageView)
+		if (m_pipelineLayout)
 		{
-			vkDestroyImageView(m_device, colorImageView, nullptr);
-			colorImageView = VK_NULL_HANDLE;
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+			m_pipelineLayout = VK_NULL_HANDLE;
 		}
 
-		if (colorImage)
+		if (m_pipelineLayoutIndirect)
 		{
-			vkDestroyImage(m_device, colorImage, nullptr);
-			colorImage = VK_NULL_HANDLE;
+			vkDestroyPipelineLayout(m_device, m_pipelineLayoutIndirect, nullptr);
+			m_pipelineLayoutIndirect = VK_NULL_HANDLE;
 		}
 
-		if (colorImageMemory)
+		if (m_renderPass)
 		{
-			vkFreeMemory(m_device, colorImageMemory, nullptr);
-			colorImageMemory = VK_NULL_HANDLE;
+			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			m_renderPass = VK_NULL_HANDLE;
 		}
+	}
+
+	void cleanupSwapChain() {
+		for (auto& retired : m_retiredSwapChains)
+			destroyRetiredSwapChain(retired);
+		m_retiredSwapChains.clear();
+
+		m_depthPyramid.reset();
+		m_renderGraph.reset();
 
 		for (auto framebuffer : m_swapChainFramebuffers) {
 			vkDestroyFramebuffer(m_device, framebuffer, nullptr);
@@ -464,24 +899,8 @@ public:
 
 		vkFreeCommandBuffers(m_device, m_commandPool, static_cast<uint32_t>(m_commandBuffers.size()), m_commandBuffers.data());
 		m_commandBuffers.clear();
-		
-		if (m_graphicsPipeline)
-		{
-			vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
-			m_graphicsPipeline = VK_NULL_HANDLE;
-		}
-
-		if (m_pipelineLayout)
-		{
-			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
-			m_pipelineLayout = VK_NULL_HANDLE;
-		}
 
-		if (m_renderPass)
-		{
-			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
-			m_renderPass = VK_NULL_HANDLE;
-		}
+		cleanupGraphicsPipelines();
 
 		for (auto imageView : m_swapChainImageViews)
 			vkDestroyImageView(m_device, imageView, nullptr);
@@ -511,6 +930,12 @@ public:
 			model.meshUniformBuffers.clear();
 		}
 
+		m_gpuDriven.reset();
+
+		m_cullPipeline.reset();
+		m_depthPyramidPipeline.reset();
+		m_depthReducePipeline.reset();
+
 		m_imagesCache.clear();
 
 		if (m_descriptorSetLayout)
@@ -519,14 +944,36 @@ public:
 			m_descriptorSetLayout = VK_NULL_HANDLE;
 		}
 
-		for (size_t i = 0; i < m_MAX_FRAMES_IN_FLIGHT; i++) {
+		if (m_descriptorSetLayoutIndirect)
+		{
+			vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayoutIndirect, nullptr);
+			m_descriptorSetLayoutIndirect = VK_NULL_HANDLE;
+		}
+
+		for (size_t i = 0; i < m_renderFinishedSemaphores.size(); i++) {
 			vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
 			vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
 		}
 		m_renderFinishedSemaphores.clear();
 		m_imageAvailableSemaphores.clear();
-		m_inFlightFences.clear();
+		m_frameTimelineValues.clear();
+
+		m_pendingUploads.clear();
+
+		for (VkSemaphore* semaphore : { &m_frameTimeline, &m_uploadTimeline, &m_computeTimeline })
+		{
+			if (*semaphore)
+			{
+				vkDestroySemaphore(m_device, *semaphore, nullptr);
+				*semaphore = VK_NULL_HANDLE;
+			}
+		}
+
+		if (m_timestampQueryPool)
+		{
+			vkDestroyQueryPool(m_device, m_timestampQueryPool, nullptr);
+			m_timestampQueryPool = VK_NULL_HANDLE;
+		}
 
 		if (m_commandPool)
 		{
@@ -534,6 +981,20 @@ public:
 			m_commandPool = VK_NULL_HANDLE;
 		}
 
+		if (m_computeCommandPool)
+		{
+			vkDestroyCommandPool(m_device, m_computeCommandPool, nullptr);
+			m_computeCommandPool = VK_NULL_HANDLE;
+			m_computeCommandBuffers.clear();
+		}
+
+		if (m_pipelineCache)
+		{
+			savePipelineCache();
+			vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+			m_pipelineCache = VK_NULL_HANDLE;
+		}
+
 		if (m_device)
 		{
 			vkDestroyDevice(m_device, nullptr);
@@ -567,52 +1028,136 @@ public:
 		//glfwTerminate();
 	}
 
-	Impl()
+	Impl(RenderSettings settings) :
+		m_settings{ settings },
+		m_framesInFlight{ static_cast<uint32_t>(std::clamp(settings.framesInFlight, 1, 4)) },
+		m_jobSystem{ utils::sharedJobSystem({ static_cast<size_t>(std::max(settings.workerThreads, 0)), 2, settings.pinWorkerThreads }) }
 	{
 	}
 
 	void init(std::vector<ModelInfo> modelInfos)
 	{
 		auto models = prepareModels(std::move(modelInfos));
+
+		// Decided before anything is created for GPU-driven mode
+		if (m_settings.gpuDriven && indirectTextureCount(models) > MaxIndirectTextures)
+		{
+			std::cerr << "GPU-driven mode supports up to " << MaxIndirectTextures << " textures, the scene has "
+				<< indirectTextureCount(models) << ", falling back to secondary command buffers" << std::endl;
+			m_settings.gpuDriven = false;
+		}
 		createWindow();
 		createInstance();
 		createSurface();
 		pickPhysicalDevice();
 		createLogicalDevice();
+		createTimelineSemaphores();
+		createTimestampQueryPool();
+		createPipelineCache();
 		createSwapChain();
 		createImageViews();
 		createRenderPass();
 		createDescriptorSetLayout();
 		createGraphicsPipeline();
+		if (gpuCulling())
+			createCullingPipelines();
 		createCommandPool();
-		createColorResources();
-		createDepthResources();
+		createComputeCommandBuffers();
+		createRenderGraph();
+		if (occlusionCulling())
+			createDepthPyramid();
 		createFramebuffers();
 		createDescriptorPool();
-		initThreadData();
 		loadModels(std::move(models));
+		initThreadData();
+		if (m_settings.gpuDriven)
+			createGpuDrivenScene();
+		updateCullPyramidDescriptors();
 		createCommandBuffers();
 		createSyncObjects();
+		createFrameGraph();
+		waitForFirstFramePipelines();
 	}
 
+	// Only the resources sized by the swapchain are replaced, the old ones are retired to the frames still in flight
+	// instead of waiting for the device. Pipelines use dynamic viewport and scissor, so they are kept as well as
+	// the command buffers and the recording batches
 	void recreateSwapChain() {
+		glfwGetFramebufferSize(m_window, &m_framebufferWidth, &m_framebufferHeight);
+
+		// Minimized, sleep until the window is restored
+		while (m_framebufferWidth == 0 || m_framebufferHeight == 0)
 		{
+			glfwWaitEvents();
 			glfwGetFramebufferSize(m_window, &m_framebufferWidth, &m_framebufferHeight);
-			std::this_thread::yield();
-		} while (m_framebufferWidth == 0 || m_framebufferHeight == 0);
+		}
 
-		vkDeviceWaitIdle(m_device);
+		auto recreateStartTime = std::chrono::steady_clock::now();
 
-		cleanupSwapChain();
+		RetiredSwapChain retired;
+		retired.frameTimelineValue = m_frameTimelineValue;
+		retired.swapChain = m_swapChain;
+		retired.imageViews = std::move(m_swapChainImageViews);
+		retired.framebuffers = std::move(m_swapChainFramebuffers);
+		retired.renderGraph = std::move(m_renderGraph);
+		retired.depthPyramid = std::move(m_depthPyramid);
+		m_swapChainImageViews.clear();
+		m_swapChainFramebuffers.clear();
+		m_retiredSwapChains.push_back(std::move(retired));
+
+		VkFormat oldFormat = m_swapChainImageFormat;
+		createSwapChain(m_retiredSwapChains.back().swapChain);
+
+		if (m_swapChainImageFormat != oldFormat)
+		{
+			// Render pass and pipelines depend on the format, rare enough to wait for the device
+			vkDeviceWaitIdle(m_device);
+			cleanupGraphicsPipelines();
+			createRenderPass();
+			createGraphicsPipeline();
+			waitForFirstFramePipelines();
+		}
 
-		createSwapChain();
 		createImageViews();
-		createRenderPass();
-		createGraphicsPipeline();
-		createColorResources();
-		createDepthResources();
+		createRenderGraph();
+		if (occlusionCulling())
+		{
+			createDepthPyramid();
+			if (m_gpuDriven)
+				m_gpuDriven->cullPyramidDescriptorsStale.assign(m_gpuDriven->cullDescriptorSets.size(), true);
+		}
 		createFramebuffers();
-		createCommandBuffers();
+
+		releaseRetiredSwapChains();
+
+		m_swapChainRecreateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - recreateStartTime).count();
+		++m_swapChainRecreations;
+	}
+
+	bool gpuCulling() const
+	{
+		return m_settings.gpuDriven && (m_settings.frustumCulling || m_settings.occlusionCulling);
+	}
+
+	bool occlusionCulling() const
+	{
+		return m_settings.gpuDriven && m_settings.occlusionCulling;
+	}
+
+	bool asyncCompute() const
+	{
+		return m_computeQueue != VK_NULL_HANDLE;
+	}
+
+	// A second queue of the graphics family shares ownership, a compute-only family needs transfers
+	bool computeOwnershipTransfers() const
+	{
+		return asyncCompute() && m_computeFamily != m_graphicsFamily;
+	}
+
+	bool lowLatency() const
+	{
+		return m_settings.latencyMode == RenderSettings::LatencyMode::LowLatency;
 	}
 
 	std::vector<VulkanModel> prepareModels(std::vector<ModelInfo> modelInfos)
@@ -649,15 +1194,44 @@ public:
 		return models;
 	}
 
+	// Unique diffuse textures of the GPU-driven texture array, the first one of every model as in loadModels
+	static size_t indirectTextureCount(const std::vector<VulkanModel>& models)
+	{
+		std::set<std::string> paths;
+
+		for (const VulkanModel& model : models)
+		{
+			for (const auto& mesh : model.model->meshes)
+			{
+				auto textureIt = std::find_if(mesh.m_textures.begin(), mesh.m_textures.end(),
+					[](const RenderCommon::Texture& texture) { return texture.type == RenderCommon::Texture::Type::diffuse; });
+
+				if (textureIt != mesh.m_textures.end())
+				{
+					paths.insert(textureIt->path);
+					break;
+				}
+			}
+		}
+
+		return paths.size();
+	}
+
 	void loadModels(std::vector<VulkanModel>&& models)
 	{
+		std::map<MeshTextureImage*, uint32_t> materials;
+
 		for (VulkanModel& model : models)
 		{
 			for (size_t i = 0; i < model.model->meshes.size(); ++i)
 			{
-				MeshVertexBuffer meshBuffer{ this };
-				createVertexBuffer(model.model->meshes[i].m_vertices, model.model->meshes[i].m_indices, meshBuffer.m_vertexBuffer, meshBuffer.m_vertexBufferMemory);
-				model.meshVertexBuffers.push_back(std::move(meshBuffer));
+				// GPU-driven mode draws from one shared geometry buffer instead
+				if (!m_settings.gpuDriven)
+				{
+					MeshVertexBuffer meshBuffer{ this };
+					createVertexBuffer(model.model->meshes[i].m_vertices, model.model->meshes[i].m_indices, meshBuffer.m_vertexBuffer, meshBuffer.m_vertexBufferMemory);
+					model.meshVertexBuffers.push_back(std::move(meshBuffer));
+				}
 
 				for (auto& texture : model.model->meshes[i].m_textures)
 				{
@@ -669,10 +1243,19 @@ public:
 				++m_modelsMeshCount;
 			}
 
-			model.meshUniformBuffers = createMeshUniformBuffers();
-			model.meshDescriptorSet = createDescriptorSets(model.meshUniformBuffers, model.meshTextureImages);
-			model.pushConstant.resize(m_swapChainFramebuffers.size());
-			model.uniformBuffer.resize(m_swapChainFramebuffers.size());
+			if (!m_settings.gpuDriven)
+			{
+				model.meshUniformBuffers = createMeshUniformBuffers();
+				model.meshDescriptorData = createMeshDescriptorData(model.meshUniformBuffers, model.meshTextureImages);
+				if (m_descriptorMode != RenderSettings::DescriptorMode::PushDescriptors)
+					model.meshDescriptorSet = createDescriptorSets(model.meshDescriptorData);
+			}
+			model.pushConstant.resize(m_framesInFlight);
+			model.uniformBuffer.resize(m_framesInFlight);
+
+			auto diffuseIt = model.meshTextureImages.find(RenderCommon::Texture::Type::diffuse);
+			if (diffuseIt != model.meshTextureImages.end())
+				model.material = materials.emplace(diffuseIt->second, utils::intCast<uint32_t>(materials.size())).first->second;
 
 			m_models.emplace_back(std::move(model));
 		}
@@ -840,21 +1423,27 @@ public:
 			throw std::runtime_error("failed to create window surface!");
 	}
 
-	VkSampleCountFlagBits getMaxUsableSampleCount() {
+	// Highest sample count supported for both color and depth that doesn't exceed the requested one
+	VkSampleCountFlagBits getUsableSampleCount(int requested) {
 		VkPhysicalDeviceProperties physicalDeviceProperties;
 		vkGetPhysicalDeviceProperties(m_physicalDevice, &physicalDeviceProperties);
 
 		VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
-		if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
-		if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
-		if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-		if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-		if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-		if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+
+		for (int samples = 8; samples > 1; samples /= 2)
+		{
+			if (samples <= requested && (counts & samples))
+				return static_cast<VkSampleCountFlagBits>(samples);
+		}
 
 		return VK_SAMPLE_COUNT_1_BIT;
 	}
 
+	bool multisampled() const
+	{
+		return m_msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	}
+
 	void pickPhysicalDevice()
 	{
 		uint32_t deviceCount = 0;
@@ -875,7 +1464,7 @@ public:
 				{
 					score = newScore;
 					m_physicalDevice = device;
-					m_msaaSamples = getMaxUsableSampleCount();
+					m_msaaSamples = getUsableSampleCount(m_settings.msaaSamples);
 				}
 				break;
 			}
@@ -917,10 +1506,25 @@ public:
 		isOk = deviceFeatures.geometryShader;
 		if (!isOk) return false;
 
-		isOk = deviceFeatures.samplerAnisotropy;
-		if (!isOk) return false;
+		// Frames and uploads are synchronized with timeline semaphores
+		if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
+			return false;
 
-		return true;
+		VkPhysicalDeviceVulkan12Features vulkan12Features{};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+		VkPhysicalDeviceFeatures2 deviceFeatures2{};
+		deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		deviceFeatures2.pNext = &vulkan12Features;
+		vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+		if (!vulkan12Features.timelineSemaphore)
+			return false;
+
+		isOk = deviceFeatures.samplerAnisotropy;
+		if (!isOk) return false;
+
+		return true;
 	}
 
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -968,6 +1572,21 @@ public:
 			i++;
 		}
 
+		for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+			const auto& queueFamily = queueFamilies[family];
+
+			if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && queueFamily.queueCount > 0) {
+				indices.computeFamily = family;
+				indices.computeQueueIndex = 0;
+				break;
+			}
+		}
+
+		if (!indices.computeFamily && indices.graphicsFamily && queueFamilies[indices.graphicsFamily.value()].queueCount > 1) {
+			indices.computeFamily = indices.graphicsFamily;
+			indices.computeQueueIndex = 1;
+		}
+
 		// TODO: Logic for preferring the same queue
 		assert(indices.graphicsFamily.value() == indices.presentFamily.value());
 
@@ -978,30 +1597,78 @@ public:
 	{
 		QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
 
-		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::vector<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(),
-													  indices.presentFamily.value() };
+		VkPhysicalDeviceFeatures deviceFeatures{};
+		deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+		if (m_settings.gpuDriven)
+		{
+			VkPhysicalDeviceFeatures supportedFeatures{};
+			vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+
+			if (supportedFeatures.drawIndirectFirstInstance && supportedFeatures.shaderSampledImageArrayDynamicIndexing)
+			{
+				deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+				deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+				deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+				m_multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+			}
+			else
+			{
+				std::cerr << "GPU-driven mode needs drawIndirectFirstInstance and shaderSampledImageArrayDynamicIndexing, "
+					"falling back to secondary command buffers" << std::endl;
+				m_settings.gpuDriven = false;
+			}
+		}
+
+		// Culling is the only per-frame compute work, the extra queue is requested only when it runs
+		bool asyncCompute = m_settings.asyncCompute && gpuCulling() && indices.computeFamily.has_value();
+		if (m_settings.asyncCompute && gpuCulling() && !asyncCompute)
+			std::cerr << "No separate compute queue, culling stays on the graphics queue" << std::endl;
 
-		float queuePriority = 1.0f;
-		for (uint32_t queueFamily : uniqueQueueFamilies) {
+		std::map<uint32_t, uint32_t> queueCounts;
+		queueCounts[indices.graphicsFamily.value()] = 1;
+		queueCounts[indices.presentFamily.value()] = std::max(queueCounts[indices.presentFamily.value()], 1u);
+		if (asyncCompute)
+			queueCounts[indices.computeFamily.value()] = std::max(queueCounts[indices.computeFamily.value()], indices.computeQueueIndex + 1);
+
+		std::array<float, 2> queuePriorities = { 1.0f, 1.0f };
+
+		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		for (auto [queueFamily, queueCount] : queueCounts) {
 			VkDeviceQueueCreateInfo queueCreateInfo{};
 			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 			queueCreateInfo.queueFamilyIndex = queueFamily;
-			queueCreateInfo.queueCount = 1;
-			queueCreateInfo.pQueuePriorities = &queuePriority;
+			queueCreateInfo.queueCount = queueCount;
+			queueCreateInfo.pQueuePriorities = queuePriorities.data();
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
-		VkPhysicalDeviceFeatures deviceFeatures{};
-		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		std::vector<const char*> deviceExtensions(g_deviceExtensions.begin(), g_deviceExtensions.end());
+
+		m_calibratedTimestamps = supportsCalibratedTimestamps(indices.graphicsFamily.value());
+		if (m_calibratedTimestamps)
+			deviceExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+		m_pushDescriptors = GLAD_VK_KHR_push_descriptor;
+		if (m_pushDescriptors)
+			deviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+
+		m_descriptorMode = m_settings.descriptorMode;
+		if (m_descriptorMode == RenderSettings::DescriptorMode::PushDescriptors && !m_pushDescriptors)
+			m_descriptorMode = RenderSettings::DescriptorMode::UpdateTemplate;
+
+		VkPhysicalDeviceVulkan12Features vulkan12Features{};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		vulkan12Features.timelineSemaphore = VK_TRUE;
 
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &vulkan12Features;
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount = utils::intCast<uint32_t>(queueCreateInfos.size());
 		createInfo.pEnabledFeatures = &deviceFeatures;
-		createInfo.enabledExtensionCount = utils::intCast<uint32_t>(g_deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = g_deviceExtensions.data();
+		createInfo.enabledExtensionCount = utils::intCast<uint32_t>(deviceExtensions.size());
+		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 
 		// Deprecated for new vulkan implementations
@@ -1019,9 +1686,64 @@ public:
 		vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
 		vkGetDeviceQueue(m_device, indices.presentFamily.value(), 0, &m_presentQueue);
 
+		m_graphicsFamily = indices.graphicsFamily.value();
+		if (asyncCompute)
+		{
+			m_computeFamily = indices.computeFamily.value();
+			vkGetDeviceQueue(m_device, m_computeFamily, indices.computeQueueIndex, &m_computeQueue);
+		}
+
 		gladLoaderLoadVulkan(m_instance, m_physicalDevice, m_device);
 	}
 
+	// Latency is measured with GPU timestamps only when they can be related to a timestamp taken on the CPU at submit
+	bool supportsCalibratedTimestamps(uint32_t queueFamily)
+	{
+		if (!GLAD_VK_EXT_calibrated_timestamps)
+			return false;
+
+		uint32_t timeDomainCount{};
+		vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(m_physicalDevice, &timeDomainCount, nullptr);
+
+		std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+		vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(m_physicalDevice, &timeDomainCount, timeDomains.data());
+
+		if (std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) == timeDomains.end())
+			return false;
+
+		uint32_t queueFamilyCount{};
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, nullptr);
+
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+		uint32_t validBits = queueFamilies.at(queueFamily).timestampValidBits;
+		if (validBits == 0)
+			return false;
+
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+		m_timestampPeriod = properties.limits.timestampPeriod;
+		m_timestampMask = validBits < 64 ? (uint64_t{ 1 } << validBits) - 1 : ~uint64_t{};
+
+		return true;
+	}
+
+	void createTimestampQueryPool()
+	{
+		if (!m_calibratedTimestamps)
+			return;
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = m_framesInFlight;
+
+		if (vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_timestampQueryPool))
+			throw std::runtime_error("failed to create timestamp query pool!");
+	}
+
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
 		SwapChainSupportDetails details{};
 		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, m_surface, &details.capabilities);
@@ -1056,15 +1778,37 @@ public:
 	}
 
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+		VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+		switch (m_settings.presentMode)
+		{
+		case RenderSettings::PresentMode::Immediate: requestedPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR; break;
+		case RenderSettings::PresentMode::Mailbox: requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR; break;
+		case RenderSettings::PresentMode::Fifo: requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR; break;
+		}
+
 		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+			if (availablePresentMode == requestedPresentMode) {
 				return availablePresentMode;
 			}
 		}
 
+		// The only mode every implementation has to support
 		return VK_PRESENT_MODE_FIFO_KHR;
 	}
 
+	static const char* presentModeName(VkPresentModeKHR presentMode)
+	{
+		switch (presentMode)
+		{
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo relaxed";
+		default: return "unknown";
+		}
+	}
+
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
 		if (capabilities.currentExtent.width != UINT32_MAX) {
 			return capabilities.currentExtent;
@@ -1085,14 +1829,18 @@ public:
 		}
 	}
 
-	void createSwapChain() {
+	// oldSwapChain is retired by the new one, the presentation engine may hand its resources over
+	void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(m_physicalDevice);
 
 		VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 		VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		// Low latency keeps the presentation queue as short as the surface allows,
+		// max throughput gives every frame in flight an image to render into
+		uint32_t imageCount = lowLatency() ? swapChainSupport.capabilities.minImageCount
+			: std::max(swapChainSupport.capabilities.minImageCount + 1, m_framesInFlight);
 
 		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
 			imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -1131,6 +1879,9 @@ public:
 
 		createInfo.presentMode = presentMode;
 		createInfo.clipped = VK_TRUE;
+		createInfo.oldSwapchain = oldSwapChain;
+
+		m_presentMode = presentMode;
 
 		if (vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain))
 			throw std::runtime_error("failed to create swap chain!");
@@ -1138,8 +1889,6 @@ public:
 		vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
 		m_swapChainImages.resize(imageCount);
 		vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, m_swapChainImages.data());
-
-		//m_MAX_FRAMES_IN_FLIGHT = utils::intCast<int>(m_swapChainImages.size());
 	}
 
 	void createImageViews() {
@@ -1150,16 +1899,30 @@ public:
 		}
 	}
 
+	// Attachments: MSAA color, depth, swapchain image as the resolve target.
+	// Without multisampling the color attachment is the swapchain image itself
 	void createRenderPass() {
 		VkAttachmentDescription colorAttachment{};
 		colorAttachment.format = m_swapChainImageFormat;
 		colorAttachment.samples = m_msaaSamples;
 		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		if (multisampled())
+		{
+			// Only the resolved image leaves the pass, the samples may stay in tile memory
+			colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			// The render graph transitions the attachments before the pass
+			colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+		else
+		{
+			colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		}
 
 		VkAttachmentReference colorAttachmentRef{};
 		colorAttachmentRef.attachment = 0;
@@ -1169,10 +1932,11 @@ public:
 		depthAttachment.format = findDepthFormat();
 		depthAttachment.samples = m_msaaSamples;
 		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// The depth pyramid is built from the depth of the finished frame
+		depthAttachment.storeOp = occlusionCulling() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 		VkAttachmentReference depthAttachmentRef{};
@@ -1199,17 +1963,21 @@ public:
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &colorAttachmentRef;
 		subpass.pDepthStencilAttachment = &depthAttachmentRef;
-		subpass.pResolveAttachments = &colorAttachmentResolveRef;
+		subpass.pResolveAttachments = multisampled() ? &colorAttachmentResolveRef : nullptr;
 
 		VkSubpassDependency dependency{};
 		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 		dependency.dstSubpass = 0;
+		// Only the swapchain image, the render graph synchronizes the other attachments
 		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		dependency.srcAccessMask = 0;
 		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
-		std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, colorAttachmentResolve };
+		std::vector<VkAttachmentDescription> attachments = { colorAttachment, depthAttachment };
+		if (multisampled())
+			attachments.push_back(colorAttachmentResolve);
+
 		VkRenderPassCreateInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
@@ -1224,6 +1992,15 @@ public:
 	}
 
 	void createDescriptorSetLayout() {
+		// Sets are never allocated from a push descriptor layout
+		m_descriptorSetLayout = createMeshDescriptorSetLayout(m_descriptorMode == RenderSettings::DescriptorMode::PushDescriptors
+			? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0);
+
+		if (m_settings.gpuDriven)
+			createDescriptorSetLayoutIndirect();
+	}
+
+	VkDescriptorSetLayout createMeshDescriptorSetLayout(VkDescriptorSetLayoutCreateFlags flags) {
 		VkDescriptorSetLayoutBinding uboLayoutBinding{};
 		uboLayoutBinding.binding = 0;
 		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -1250,50 +2027,168 @@ public:
 
 		VkDescriptorSetLayoutCreateInfo layoutInfo{};
 		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.flags = flags;
 		layoutInfo.bindingCount = utils::intCast<uint32_t>(bindings.size());;
 		layoutInfo.pBindings = bindings.data();;
 
-		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout))
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &descriptorSetLayout))
 			throw std::runtime_error("failed to create descriptor set layout!");
+
+		return descriptorSetLayout;
+	}
+
+	// One update writes a whole MeshDescriptorData. Push descriptor templates are bound to the pipeline layout
+	VkDescriptorUpdateTemplate createMeshDescriptorTemplate(VkDescriptorUpdateTemplateType type, VkDescriptorSetLayout setLayout, VkPipelineLayout pipelineLayout) {
+		std::array<VkDescriptorUpdateTemplateEntry, 3> entries{};
+
+		entries[0].dstBinding = 0;
+		entries[0].descriptorCount = 1;
+		entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		entries[0].offset = offsetof(MeshDescriptorData, uniformBuffer);
+
+		entries[1].dstBinding = 1;
+		entries[1].descriptorCount = 1;
+		entries[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		entries[1].offset = offsetof(MeshDescriptorData, diffuse);
+
+		entries[2].dstBinding = 2;
+		entries[2].descriptorCount = 1;
+		entries[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		entries[2].offset = offsetof(MeshDescriptorData, specular);
+
+		for (auto& entry : entries)
+			entry.stride = sizeof(MeshDescriptorData);
+
+		VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+		templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+		templateInfo.descriptorUpdateEntryCount = utils::intCast<uint32_t>(entries.size());
+		templateInfo.pDescriptorUpdateEntries = entries.data();
+		templateInfo.templateType = type;
+		templateInfo.descriptorSetLayout = setLayout;
+		templateInfo.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		templateInfo.pipelineLayout = pipelineLayout;
+		templateInfo.set = 0;
+
+		VkDescriptorUpdateTemplate descriptorUpdateTemplate = VK_NULL_HANDLE;
+		if (vkCreateDescriptorUpdateTemplate(m_device, &templateInfo, nullptr, &descriptorUpdateTemplate))
+			throw std::runtime_error("failed to create descriptor update template!");
+
+		return descriptorUpdateTemplate;
+	}
+
+	void createDescriptorSetLayoutIndirect() {
+		std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+
+		// 0 - model data, 1 - bone palettes, 2 - draw instances
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		}
+
+		bindings[3].binding = 3;
+		bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[3].descriptorCount = MaxIndirectTextures;
+		bindings[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = utils::intCast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+
+		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayoutIndirect))
+			throw std::runtime_error("failed to create indirect descriptor set layout!");
 	}
 
+	// Layouts are created here, the pipelines themselves on the thread pool
 	void createGraphicsPipeline() {
-		unique_ptr_shared_module vertShaderModule{ createShaderModule(s_shader_vert), m_shaderModuleDeleter };
-		unique_ptr_shared_module fragShaderModule{ createShaderModule(s_shader_frag), m_shaderModuleDeleter };
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(PushConstantBufferObject);
 
-		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = vertShaderModule.get();
-		vertShaderStageInfo.pName = "main";
+		pipelineLayoutInfo.pushConstantRangeCount = 1; // Optional
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange; // Optional
 
-		VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = fragShaderModule.get();
-		fragShaderStageInfo.pName = "main";
+		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout))
+			throw std::runtime_error("failed to create pipeline layout!");
 
-		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+		if (m_descriptorMode != RenderSettings::DescriptorMode::DescriptorSets)
+		{
+			auto templateType = m_descriptorMode == RenderSettings::DescriptorMode::PushDescriptors
+				? VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR : VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+			m_descriptorUpdateTemplate = createMeshDescriptorTemplate(templateType, m_descriptorSetLayout, m_pipelineLayout);
+		}
 
+		if (m_settings.gpuDriven)
+			createIndirectPipelineLayout();
 
-		unique_ptr_shared_module vertShaderModuleSimple{ createShaderModule(s_shader_simple_vert), m_shaderModuleDeleter };
-		unique_ptr_shared_module fragShaderModuleSimple{ createShaderModule(s_shader_simple_frag), m_shaderModuleDeleter };
+		// The variants read the render pass, which outlives the library
+		m_pipelines = std::make_unique<PipelineLibrary>(this);
 
-		VkPipelineShaderStageCreateInfo vertShaderStageInfoSimple{};
-		vertShaderStageInfoSimple.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfoSimple.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfoSimple.module = vertShaderModuleSimple.get();
-		vertShaderStageInfoSimple.pName = "main";
+		// Only the variants the mode draws with, GPU-driven frames don't record the secondary command buffers
+		if (m_settings.gpuDriven)
+		{
+			m_pipelines->add(PipelineLibrary::Indirect, [this, layout = m_pipelineLayoutIndirect] {
+				return createGraphicsPipelineVariant(s_shader_indirect_vert, s_shader_indirect_frag, layout);
+			});
+			m_pipelines->add(PipelineLibrary::SimpleIndirect, [this, layout = m_pipelineLayoutIndirect] {
+				return createGraphicsPipelineVariant(s_shader_simple_indirect_vert, s_shader_simple_indirect_frag, layout);
+			});
+		}
+		else
+		{
+			m_pipelines->add(PipelineLibrary::Regular, [this, layout = m_pipelineLayout] {
+				return createGraphicsPipelineVariant(s_shader_vert, s_shader_frag, layout);
+			});
+			m_pipelines->add(PipelineLibrary::Simple, [this, layout = m_pipelineLayout] {
+				return createGraphicsPipelineVariant(s_shader_simple_vert, s_shader_simple_frag, layout);
+			});
+		}
+	}
 
-		VkPipelineShaderStageCreateInfo fragShaderStageInfoSimple{};
-		fragShaderStageInfoSimple.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfoSimple.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfoSimple.module = fragShaderModuleSimple.get();
-		fragShaderStageInfoSimple.pName = "main";
+	void createIndirectPipelineLayout() {
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(PushConstantIndirect);
 
-		VkPipelineShaderStageCreateInfo shaderStagesSimple[] = { vertShaderStageInfoSimple, fragShaderStageInfoSimple };
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayoutIndirect;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayoutIndirect))
+			throw std::runtime_error("failed to create indirect pipeline layout!");
+	}
+
+	// Runs on a thread pool worker. All variants share the fixed-function state, only the shaders and the layout differ
+	template<size_t V, size_t F>
+	VkPipeline createGraphicsPipelineVariant(const std::array<unsigned char, V>& vertCode, const std::array<unsigned char, F>& fragCode, VkPipelineLayout layout) {
+		unique_ptr_shared_module vertShaderModule{ createShaderModule(vertCode), m_shaderModuleDeleter };
+		unique_ptr_shared_module fragShaderModule{ createShaderModule(fragCode), m_shaderModuleDeleter };
+
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = vertShaderModule.get();
+		shaderStages[0].pName = "main";
+
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = fragShaderModule.get();
+		shaderStages[1].pName = "main";
 
-		
 		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 
 		auto bindingDescription = getBindingDescription();
@@ -1310,24 +2205,18 @@ public:
 		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 		inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-		VkViewport viewport{};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)m_swapChainExtent.width;
-		viewport.height = (float)m_swapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-
-		VkRect2D scissor{};
-		scissor.offset = { 0, 0 };
-		scissor.extent = m_swapChainExtent;
-
+		// Set while recording, so the pipelines don't depend on the swapchain extent and survive a resize
 		VkPipelineViewportStateCreateInfo viewportState{};
 		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
 		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
+
+		std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+		VkPipelineDynamicStateCreateInfo dynamicState{};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = utils::intCast<uint32_t>(dynamicStates.size());
+		dynamicState.pDynamicStates = dynamicStates.data();
 
 		VkPipelineRasterizationStateCreateInfo rasterizer{};
 		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -1384,27 +2273,10 @@ public:
 		colorBlending.blendConstants[2] = 0.0f; // Optional
 		colorBlending.blendConstants[3] = 0.0f; // Optional
 
-
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 1;
-		pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
-
-		VkPushConstantRange pushConstantRange{};
-		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-		pushConstantRange.offset = 0;
-		pushConstantRange.size = sizeof(PushConstantBufferObject);
-
-		pipelineLayoutInfo.pushConstantRangeCount = 1; // Optional
-		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange; // Optional
-
-		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout))
-			throw std::runtime_error("failed to create pipeline layout!");
-
 		VkGraphicsPipelineCreateInfo pipelineInfo{};
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 		pipelineInfo.stageCount = 2;
-		pipelineInfo.pStages = shaderStages;
+		pipelineInfo.pStages = shaderStages.data();
 
 		pipelineInfo.pVertexInputState = &vertexInputInfo;
 		pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -1413,146 +2285,507 @@ public:
 		pipelineInfo.pMultisampleState = &multisampling;
 		pipelineInfo.pDepthStencilState = &depthStencil;
 		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.pDynamicState = nullptr; // Optional
-		pipelineInfo.layout = m_pipelineLayout;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = layout;
 		pipelineInfo.renderPass = m_renderPass;
 		pipelineInfo.subpass = 0;
 		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 		pipelineInfo.basePipelineIndex = -1; // Optional
 
-		if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline))
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline))
 			throw std::runtime_error("failed to create graphics pipeline!");
 
-		pipelineInfo.pStages = shaderStagesSimple;
-
-		if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipelineSimple))
-			throw std::runtime_error("failed to create graphics pipeline!");
+		return pipeline;
 	}
 
-	template<size_t N>
-	VkShaderModule createShaderModule(const std::array<unsigned char, N>& code) {
-		VkShaderModuleCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	// Only the variants the scene draws with, the others keep compiling while the first frames render
+	void waitForFirstFramePipelines() {
+		bool simple = std::any_of(m_models.begin(), m_models.end(), [](const VulkanModel& model) { return model.info.simpleModel; });
+		bool regular = std::any_of(m_models.begin(), m_models.end(), [](const VulkanModel& model) { return !model.info.simpleModel; });
 
-		VkShaderModule shaderModule{};
-		if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule))
-			throw std::runtime_error("failed to create shader module!");
+		if (simple)
+			m_pipelines->wait(m_settings.gpuDriven ? PipelineLibrary::SimpleIndirect : PipelineLibrary::Simple);
 
-		return shaderModule;
+		if (regular)
+			m_pipelines->wait(m_settings.gpuDriven ? PipelineLibrary::Indirect : PipelineLibrary::Regular);
 	}
 
-	void createFramebuffers() {
-		m_swapChainFramebuffers.resize(m_swapChainImageViews.size());
+	void printPipelineStatistics() {
+		double lastFinish = 0;
+		double createSum = 0;
+		int variants = 0;
 
-		for (size_t i = 0; i < m_swapChainImageViews.size(); i++) {
-			std::array<VkImageView, 3> attachments = {
-				colorImageView,
-				m_depthImageView,
-				m_swapChainImageViews[i]
-			};
+		for (int i = 0; i < PipelineLibrary::VariantCount; ++i)
+		{
+			auto variant = static_cast<PipelineLibrary::Variant>(i);
+			if (!m_pipelines->has(variant))
+				continue;
 
-			VkFramebufferCreateInfo framebufferInfo{};
-			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = m_renderPass;
-			framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-			framebufferInfo.pAttachments = attachments.data();
-			framebufferInfo.width = m_swapChainExtent.width;
-			framebufferInfo.height = m_swapChainExtent.height;
-			framebufferInfo.layers = 1;
-			//std::cout << framebufferInfo.height << "\n\n";
-			if (vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_swapChainFramebuffers[i]))
-				throw std::runtime_error("failed to create framebuffer!");
+			m_pipelines->get(variant);
+			lastFinish = std::max(lastFinish, m_pipelines->finishSeconds[variant]);
+			createSum += m_pipelines->createSeconds[variant];
+			++variants;
 		}
-	}
-
-	unique_ptr_command_pool createCommandPoolPtr() {
-		unique_ptr_command_pool commandPoolPtr{ nullptr, m_commandPoolDeleter };
-		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_physicalDevice);
 
-		VkCommandPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		std::cout << "Vulkan graphics pipelines: " << variants << " variants created concurrently in " << lastFinish * 1000.0
+			<< " ms (" << createSum * 1000.0 << " ms if serial), first frame waited " << m_pipelines->waitSeconds * 1000.0
+			<< " ms (" << (m_pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+	}
 
-		// TODO
-		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Optional
+	template<size_t N>
+	std::unique_ptr<ComputePipeline> createComputePipeline(const std::array<unsigned char, N>& code, const std::vector<VkDescriptorType>& descriptorTypes) {
+		auto computePipeline = std::make_unique<ComputePipeline>(this);
 
-		VkCommandPool commandPool = VK_NULL_HANDLE;
-		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &commandPool))
-			throw std::runtime_error("failed to create command pool!");
+		std::vector<VkDescriptorSetLayoutBinding> bindings(descriptorTypes.size());
+		for (uint32_t i = 0; i < bindings.size(); ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = descriptorTypes[i];
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
 
-		commandPoolPtr.reset(commandPool);
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = utils::intCast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
 
-		return commandPoolPtr;
-	}
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &descriptorSetLayout))
+			throw std::runtime_error("failed to create compute descriptor set layout!");
+		computePipeline->descriptorSetLayout.reset(descriptorSetLayout);
 
-	void createCommandPool() {
-		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_physicalDevice);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
 
-		VkCommandPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &pipelineLayout))
+			throw std::runtime_error("failed to create compute pipeline layout!");
+		computePipeline->pipelineLayout.reset(pipelineLayout);
 
-		// TODO
-		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Optional
+		unique_ptr_shared_module shaderModule{ createShaderModule(code), m_shaderModuleDeleter };
 
-		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool))
-			throw std::runtime_error("failed to create command pool!");
-	}
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shaderModule.get();
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = pipelineLayout;
 
-	bool hasStencilComponent(VkFormat format) {
-		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
-	}
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if (vkCreateComputePipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline))
+			throw std::runtime_error("failed to create compute pipeline!");
+		computePipeline->pipeline.reset(pipeline);
 
-	VkFormat findDepthFormat() {
-		return findSupportedFormat(
-			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-		);
+		return computePipeline;
 	}
 
-	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
-		for (VkFormat format : candidates) {
-			VkFormatProperties props{};
-			vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &props);
+	// Created concurrently like the graphics variants, the culling pass needs all of them before the first frame
+	void createCullingPipelines() {
+		auto cullPipeline = m_jobSystem.enqueue([this] {
+			return createComputePipeline(s_cull_comp, {
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			});
+		}, utils::JobPriority::Background);
 
-			if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
-				return format;
-			}
-			else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
-				return format;
-			}
+		if (occlusionCulling())
+		{
+			auto depthPyramidPipeline = m_jobSystem.enqueue([this] {
+				if (m_msaaSamples == VK_SAMPLE_COUNT_1_BIT)
+					return createComputePipeline(s_hiz_depth_comp, { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE });
+				else
+					return createComputePipeline(s_hiz_depth_ms_comp, { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE });
+			}, utils::JobPriority::Background);
+			auto depthReducePipeline = m_jobSystem.enqueue([this] {
+				return createComputePipeline(s_hiz_reduce_comp, { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE });
+			}, utils::JobPriority::Background);
+
+			m_depthPyramidPipeline = depthPyramidPipeline.get();
+			m_depthReducePipeline = depthReducePipeline.get();
 		}
 
-		throw std::runtime_error("failed to find supported format!");
+		m_cullPipeline = cullPipeline.get();
 	}
 
-	void createColorResources() {
-		VkFormat colorFormat = m_swapChainImageFormat;
+	static uint32_t previousPowerOfTwo(uint32_t value) {
+		uint32_t result = 1;
+		while (result * 2 <= value)
+			result *= 2;
 
-		createImage(m_swapChainExtent.width, m_swapChainExtent.height, 1, m_msaaSamples, colorFormat,
-					VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
+		return result;
+	}
 
-		colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	VkSampler createNearestSampler(float maxLod) {
+		VkSamplerCreateInfo samplerInfo{};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = maxLod;
+
+		VkSampler sampler = VK_NULL_HANDLE;
+		if (vkCreateSampler(m_device, &samplerInfo, nullptr, &sampler))
+			throw std::runtime_error("failed to create sampler!");
+
+		return sampler;
 	}
 
-	void createDepthResources() {
-		VkFormat depthFormat = findDepthFormat();
+	void createDepthPyramid() {
+		auto pyramid = std::make_unique<DepthPyramid>(this);
 
-		createImage(m_swapChainExtent.width, m_swapChainExtent.height, 1, m_msaaSamples, depthFormat,
-			VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depthImage, m_depthImageMemory);
+		// Power of two size, so every level is exactly half of the previous one
+		pyramid->width = previousPowerOfTwo(m_swapChainExtent.width);
+		pyramid->height = previousPowerOfTwo(m_swapChainExtent.height);
+		pyramid->mipLevels = static_cast<uint32_t>(std::log2(std::max(pyramid->width, pyramid->height))) + 1;
 
-		m_depthImageView = createImageView(m_depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory imageMemory = VK_NULL_HANDLE;
+		// Built on the graphics queue, sampled by the culling pass
+		createImage(pyramid->width, pyramid->height, pyramid->mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT,
+			VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory, true);
+		pyramid->image.reset(image);
+		pyramid->imageMemory.reset(imageMemory);
+
+		pyramid->imageView.reset(createImageView(image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, pyramid->mipLevels));
+		m_renderGraph->bindImage(m_depthPyramidResource, image);
+		for (uint32_t i = 0; i < pyramid->mipLevels; ++i)
+			pyramid->mipViews.emplace_back(createImageView(image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, i), m_imageViewDeleter);
+
+		pyramid->sampler.reset(createNearestSampler(VK_LOD_CLAMP_NONE));
+		pyramid->depthSampler.reset(createNearestSampler(0.0f));
+
+		std::array<VkDescriptorPoolSize, 2> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[0].descriptorCount = 1;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[1].descriptorCount = pyramid->mipLevels * 2;
 
-		transitionImageLayout(m_depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = pyramid->mipLevels;
+
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &descriptorPool))
+			throw std::runtime_error("failed to create depth pyramid descriptor pool!");
+		pyramid->descriptorPool.reset(descriptorPool);
+
+		// Set 0 reads the depth buffer, set i reduces level i into level i + 1
+		std::vector<VkDescriptorSetLayout> layouts(pyramid->mipLevels, m_depthReducePipeline->descriptorSetLayout.get());
+		layouts[0] = m_depthPyramidPipeline->descriptorSetLayout.get();
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = pyramid->mipLevels;
+		allocInfo.pSetLayouts = layouts.data();
+
+		std::vector<VkDescriptorSet> descriptorSets(pyramid->mipLevels);
+		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
+			throw std::runtime_error("failed to allocate depth pyramid descriptor sets!");
+
+		pyramid->depthDescriptorSet = descriptorSets[0];
+		pyramid->reduceDescriptorSets.assign(descriptorSets.begin() + 1, descriptorSets.end());
+
+		std::vector<VkDescriptorImageInfo> imageInfos(1 + pyramid->mipLevels);
+		imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		imageInfos[0].imageView = m_renderGraph->imageView(m_depthTarget);
+		imageInfos[0].sampler = pyramid->depthSampler.get();
+
+		for (uint32_t i = 0; i < pyramid->mipLevels; ++i)
+		{
+			imageInfos[i + 1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfos[i + 1].imageView = pyramid->mipViews[i].get();
+		}
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites;
+		auto addWrite = [&](VkDescriptorSet set, uint32_t binding, VkDescriptorType type, const VkDescriptorImageInfo* imageInfo) {
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = set;
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.descriptorType = type;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pImageInfo = imageInfo;
+			descriptorWrites.push_back(descriptorWrite);
+		};
+
+		addWrite(pyramid->depthDescriptorSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &imageInfos[0]);
+		addWrite(pyramid->depthDescriptorSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &imageInfos[1]);
+
+		for (uint32_t i = 0; i < pyramid->reduceDescriptorSets.size(); ++i)
+		{
+			addWrite(pyramid->reduceDescriptorSets[i], 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &imageInfos[i + 1]);
+			addWrite(pyramid->reduceDescriptorSets[i], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &imageInfos[i + 2]);
+		}
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+		m_depthPyramid = std::move(pyramid);
+	}
+
+	std::vector<char> loadPipelineCacheData()
+	{
+		if (!fs::exists(g_pipelineCachePath))
+			return {};
+
+		std::ifstream file(g_pipelineCachePath, std::ios::binary);
+		std::vector<char> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+		// Driver rejects a foreign cache anyway, but some drivers crash on it, so validate the header first
+		PipelineCacheHeader header{};
+		if (data.size() < sizeof(header))
+			return {};
+
+		std::memcpy(&header, data.data(), sizeof(header));
+
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+		if (header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+			header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+			std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		{
+			std::cout << "Vulkan pipeline cache " << g_pipelineCachePath << " belongs to another device or driver, ignoring it" << std::endl;
+			return {};
+		}
+
+		return data;
+	}
+
+	void createPipelineCache()
+	{
+		std::vector<char> initialData = loadPipelineCacheData();
+
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = initialData.size();
+		cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+		if (vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_pipelineCache))
+			throw std::runtime_error("failed to create pipeline cache!");
+
+		m_pipelineCacheWarm = !initialData.empty();
+	}
+
+	void savePipelineCache()
+	{
+		size_t dataSize = 0;
+		if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, nullptr) || dataSize == 0)
+			return;
+
+		std::vector<char> data(dataSize);
+		if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, data.data()))
+			return;
+
+		// Destructor path, so a failed write only costs a cold start next time
+		std::ofstream file(g_pipelineCachePath, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), utils::intCast<std::streamsize>(dataSize));
+	}
+
+	template<size_t N>
+	VkShaderModule createShaderModule(const std::array<unsigned char, N>& code) {
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+		VkShaderModule shaderModule{};
+		if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule))
+			throw std::runtime_error("failed to create shader module!");
+
+		return shaderModule;
+	}
+
+	void createFramebuffers() {
+		m_swapChainFramebuffers.resize(m_swapChainImageViews.size());
+
+		for (size_t i = 0; i < m_swapChainImageViews.size(); i++) {
+			std::vector<VkImageView> attachments;
+			if (multisampled())
+				attachments = { m_renderGraph->imageView(m_colorTarget), m_renderGraph->imageView(m_depthTarget), m_swapChainImageViews[i] };
+			else
+				attachments = { m_swapChainImageViews[i], m_renderGraph->imageView(m_depthTarget) };
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = m_renderPass;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			framebufferInfo.pAttachments = attachments.data();
+			framebufferInfo.width = m_swapChainExtent.width;
+			framebufferInfo.height = m_swapChainExtent.height;
+			framebufferInfo.layers = 1;
+			//std::cout << framebufferInfo.height << "\n\n";
+			if (vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_swapChainFramebuffers[i]))
+				throw std::runtime_error("failed to create framebuffer!");
+		}
+	}
+
+	unique_ptr_command_pool createCommandPoolPtr(VkCommandPoolCreateFlags flags) {
+		unique_ptr_command_pool commandPoolPtr{ nullptr, m_commandPoolDeleter };
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_physicalDevice);
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		poolInfo.flags = flags;
+
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &commandPool))
+			throw std::runtime_error("failed to create command pool!");
+
+		commandPoolPtr.reset(commandPool);
+
+		return commandPoolPtr;
+	}
+
+	void createCommandPool() {
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_physicalDevice);
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+		// TODO
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Optional
+
+		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool))
+			throw std::runtime_error("failed to create command pool!");
+	}
+
+	bool hasStencilComponent(VkFormat format) {
+		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+	}
+
+	VkFormat findDepthFormat() {
+		return findSupportedFormat(
+			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+		);
+	}
+
+	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+		for (VkFormat format : candidates) {
+			VkFormatProperties props{};
+			vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &props);
+
+			if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
+				return format;
+			}
+			else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
+				return format;
+			}
+		}
+
+		throw std::runtime_error("failed to find supported format!");
+	}
+
+	// The frame's passes in submission order. Barriers between them, the attachment layouts and
+	// the attachment memory come from the graph, the passes only record their own work
+	void createRenderGraph() {
+		auto graph = std::make_unique<RenderGraph>(m_device, m_physicalDevice);
+
+		if (multisampled())
+		{
+			RenderGraph::ImageDesc colorDesc;
+			colorDesc.format = m_swapChainImageFormat;
+			colorDesc.extent = m_swapChainExtent;
+			colorDesc.samples = m_msaaSamples;
+			colorDesc.transientAttachment = true;
+			m_colorTarget = graph->createImage("msaa color", colorDesc);
+		}
+
+		VkFormat depthFormat = findDepthFormat();
+
+		RenderGraph::ImageDesc depthDesc;
+		depthDesc.format = depthFormat;
+		depthDesc.extent = m_swapChainExtent;
+		depthDesc.samples = m_msaaSamples;
+		depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+		if (hasStencilComponent(depthFormat))
+			depthDesc.aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		// The depth pyramid samples it after the pass
+		depthDesc.transientAttachment = !occlusionCulling();
+		m_depthTarget = graph->createImage("depth", depthDesc);
+
+		// Read by the next frame's culling
+		m_depthPyramidResource = graph->importImage("depth pyramid", VK_IMAGE_ASPECT_COLOR_BIT);
+		graph->markOutput(m_depthPyramidResource);
+
+		RenderGraph::ResourceId culledCommands = graph->importBuffer("culled commands");
+		RenderGraph::ResourceId culledInstances = graph->importBuffer("culled instances");
+
+		if (gpuCulling() && !asyncCompute())
+		{
+			auto culling = graph->addPass("culling", [this](const RenderGraph::PassContext& context) {
+				if (m_gpuDriven)
+					recordCulling(context.commandBuffer, context.frameIndex);
+			});
+
+			culling.write(culledCommands, RenderGraph::Usage::TransferDst, true)
+				.write(culledCommands, RenderGraph::Usage::StorageBufferCompute, true)
+				.write(culledInstances, RenderGraph::Usage::StorageBufferCompute, true);
+
+			if (occlusionCulling())
+				culling.read(m_depthPyramidResource, RenderGraph::Usage::SampledCompute);
+		}
+		else if (gpuCulling())
+		{
+			// Written on the compute queue, the graphics submission waits on the compute timeline
+			graph->setExternallySynchronized(culledCommands);
+			graph->setExternallySynchronized(culledInstances);
+		}
+
+		auto mainPass = graph->addPass("main", [this](const RenderGraph::PassContext& context) {
+			recordMainPass(context);
+		});
+
+		mainPass.write(m_depthTarget, RenderGraph::Usage::DepthAttachment, true)
+			.sideEffects();
+
+		if (multisampled())
+			mainPass.write(m_colorTarget, RenderGraph::Usage::ColorAttachment, true);
+
+		if (gpuCulling())
+		{
+			mainPass.read(culledCommands, RenderGraph::Usage::IndirectBuffer)
+				.read(culledInstances, RenderGraph::Usage::StorageBufferVertex);
+		}
+
+		if (occlusionCulling())
+		{
+			graph->addPass("depth pyramid", [this](const RenderGraph::PassContext& context) {
+				recordDepthPyramid(context.commandBuffer);
+			})
+				.read(m_depthTarget, RenderGraph::Usage::DepthSampledCompute)
+				.write(m_depthPyramidResource, RenderGraph::Usage::StorageImageCompute, true);
+		}
+
+		graph->compile();
+		m_renderGraph = std::move(graph);
 	}
 
 	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples,
-					 VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+					 VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory,
+					 bool sharedWithCompute = false) {
 
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1569,6 +2802,13 @@ public:
 		imageInfo.samples = numSamples;
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+		std::array<uint32_t, 2> queueFamilies = { m_graphicsFamily, m_computeFamily };
+		if (sharedWithCompute && computeOwnershipTransfers()) {
+			imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			imageInfo.queueFamilyIndexCount = utils::intCast<uint32_t>(queueFamilies.size());
+			imageInfo.pQueueFamilyIndices = queueFamilies.data();
+		}
+
 		if (vkCreateImage(m_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create image!");
 		}
@@ -1826,9 +3066,7 @@ public:
 
 		generateMipmaps(textureImage.textureImage.get(), VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, textureImage.mipLevels);
 
-		// TODO guard
-		vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-		vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+		releaseAfterUploads(stagingBuffer, stagingBufferMemory);
 
 		textureImage.textureImageView.reset(createTextureImageView(textureImage.textureImage.get(), textureImage.mipLevels));
 		textureImage.textureSampler.reset(createTextureSampler(textureImage.mipLevels));
@@ -1840,14 +3078,14 @@ public:
 		return &findIt->second;
 	}
 
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0) {
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
 		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 		viewInfo.format = format;
 		viewInfo.subresourceRange.aspectMask = aspectFlags;
-		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
 		viewInfo.subresourceRange.levelCount = mipLevels;
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.subresourceRange.layerCount = 1;
@@ -1898,13 +3136,21 @@ public:
 		return textureSampler;
 	}
 
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+					  bool sharedWithCompute = false) {
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = size;
 		bufferInfo.usage = usage;
 		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+		std::array<uint32_t, 2> queueFamilies = { m_graphicsFamily, m_computeFamily };
+		if (sharedWithCompute && computeOwnershipTransfers()) {
+			bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferInfo.queueFamilyIndexCount = utils::intCast<uint32_t>(queueFamilies.size());
+			bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+		}
+
 		if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create buffer!");
 		}
@@ -1943,18 +3189,58 @@ public:
 		return commandBuffer;
 	}
 
+	// Doesn't wait for the upload: the next frame submission waits on m_uploadTimeline instead
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
 		vkEndCommandBuffer(commandBuffer);
 
+		uint64_t signalValue = ++m_uploadTimelineValue;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &signalValue;
+
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &m_uploadTimeline;
+
+		if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE))
+			throw std::runtime_error("failed to submit upload command buffer!");
+
+		m_pendingUploads.emplace_back(this);
+		m_pendingUploads.back().value = signalValue;
+		m_pendingUploads.back().commandBuffer = commandBuffer;
+
+		releaseFinishedUploads();
+	}
+
+	// The staging buffer is read by the uploads submitted so far, a signal covers every earlier submission on the queue
+	void releaseAfterUploads(VkBuffer stagingBuffer, VkDeviceMemory stagingBufferMemory)
+	{
+		m_pendingUploads.emplace_back(this);
+		m_pendingUploads.back().value = m_uploadTimelineValue;
+		m_pendingUploads.back().staging.buffer.reset(stagingBuffer);
+		m_pendingUploads.back().staging.bufferMemory.reset(stagingBufferMemory);
+	}
+
+	void releaseFinishedUploads()
+	{
+		if (m_pendingUploads.empty())
+			return;
 
-		vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(m_graphicsQueue);
+		uint64_t completedValue = timelineValue(m_uploadTimeline);
 
-		vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+		while (!m_pendingUploads.empty() && m_pendingUploads.front().value <= completedValue)
+		{
+			if (m_pendingUploads.front().commandBuffer)
+				vkFreeCommandBuffers(m_device, m_commandPool, 1, &m_pendingUploads.front().commandBuffer);
+
+			m_pendingUploads.pop_front();
+		}
 	}
 
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
@@ -1998,9 +3284,65 @@ public:
 
 		copyBuffer(stagingBuffer, vertexBuffer.get(), bufferSize);
 
-		// TODO guard
-		vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-		vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+		releaseAfterUploads(stagingBuffer, stagingBufferMemory);
+	}
+
+	void createDeviceLocalBuffer(const void* content, VkDeviceSize bufferSize, VkBufferUsageFlags usage, DeviceBuffer& deviceBuffer,
+								 bool sharedWithCompute = false) {
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer, stagingBufferMemory);
+
+		void* data = nullptr;
+		vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
+		memcpy(data, content, utils::intCast<size_t>(bufferSize));
+		vkUnmapMemory(m_device, stagingBufferMemory);
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory bufMem = VK_NULL_HANDLE;
+
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufMem, sharedWithCompute);
+
+		deviceBuffer.buffer.reset(buffer);
+		deviceBuffer.bufferMemory.reset(bufMem);
+
+		copyBuffer(stagingBuffer, deviceBuffer.buffer.get(), bufferSize);
+
+		releaseAfterUploads(stagingBuffer, stagingBufferMemory);
+	}
+
+	DeviceBuffer createDeviceBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags usage) {
+		DeviceBuffer deviceBuffer{ this };
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+
+		createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+
+		deviceBuffer.buffer.reset(buffer);
+		deviceBuffer.bufferMemory.reset(bufferMemory);
+
+		return deviceBuffer;
+	}
+
+	HostVisibleBuffer createHostVisibleBuffer(VkDeviceSize bufferSize, VkBufferUsageFlags usage, bool sharedWithCompute = false) {
+		HostVisibleBuffer hostBuffer{ this };
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+
+		createBuffer(bufferSize, usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			buffer, bufferMemory, sharedWithCompute);
+
+		hostBuffer.buffer.reset(buffer);
+		hostBuffer.bufferMemory.reset(bufferMemory);
+		vkMapMemory(m_device, bufferMemory, 0, bufferSize, 0, &hostBuffer.mapping);
+
+		return hostBuffer;
 	}
 
 	void createDescriptorPool() {
@@ -2009,135 +3351,555 @@ public:
 		for (int i = 0; i < 500; ++i)
 		{
 			poolSizes[i].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			poolSizes[i].descriptorCount = static_cast<uint32_t>(m_swapChainImages.size()) * 1000;
+			poolSizes[i].descriptorCount = m_framesInFlight * 1000;
 			poolSizes[++i].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			poolSizes[i].descriptorCount = static_cast<uint32_t>(m_swapChainImages.size()) * 1000;
+			poolSizes[i].descriptorCount = m_framesInFlight * 1000;
 		}
 
+		VkDescriptorPoolSize storagePoolSize{};
+		storagePoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		storagePoolSize.descriptorCount = m_framesInFlight * 16;
+		poolSizes.push_back(storagePoolSize);
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(m_swapChainImages.size()) * m_modelsMeshCount * 1000;// *m_model;
+		poolInfo.maxSets = m_framesInFlight * m_modelsMeshCount * 1000;// *m_model;
 
 		if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool))
 			throw std::runtime_error("failed to create descriptor pool!");
 	}
 
-	std::vector<VkDescriptorSet> createDescriptorSets(const std::vector<MeshUniformBuffer>& uniformBuffers, const std::map<RenderCommon::Texture::Type, MeshTextureImage*>& textures) {
-		std::vector<VkDescriptorSetLayout> layouts(m_swapChainImages.size(), m_descriptorSetLayout);
-		VkDescriptorSetAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = m_descriptorPool;
-		allocInfo.descriptorSetCount = static_cast<uint32_t>(m_swapChainImages.size());
-		allocInfo.pSetLayouts = layouts.data();
-
-		std::vector<VkDescriptorSet> descriptorSets;
-		descriptorSets.resize(m_swapChainImages.size());
-		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
-			throw std::runtime_error("failed to allocate descriptor sets!");
-
+	std::vector<MeshDescriptorData> createMeshDescriptorData(const std::vector<MeshUniformBuffer>& uniformBuffers, const std::map<RenderCommon::Texture::Type, MeshTextureImage*>& textures) {
 		auto findIt = textures.find(RenderCommon::Texture::Type::diffuse);
 		if (findIt == textures.end())
 			throw std::runtime_error{ "Can't find diffuse texture" };
 
 		auto& diffuseTexture = *findIt->second;
-		const MeshTextureImage* specularTexture = nullptr;
+		// Models without a specular map sample the diffuse one
+		const MeshTextureImage* specularTexture = &diffuseTexture;
 		findIt = textures.find(RenderCommon::Texture::Type::specular);
 		if (findIt != textures.end())
 			specularTexture = findIt->second;
 
-		for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = uniformBuffers[i].uniformBuffer.get();
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(UniformBufferObject);
+		std::vector<MeshDescriptorData> descriptorData(m_framesInFlight);
 
-			VkDescriptorImageInfo imageInfo{};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = diffuseTexture.textureImageView.get();
-			imageInfo.sampler = diffuseTexture.textureSampler.get();
-
-			VkDescriptorImageInfo imageInfoSpecular{};
-			if (specularTexture)
-			{
-				imageInfoSpecular.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageInfoSpecular.imageView = specularTexture->textureImageView.get();
-				imageInfoSpecular.sampler = specularTexture->textureSampler.get();
-			}
+		for (size_t i = 0; i < m_framesInFlight; i++) {
+			descriptorData[i].uniformBuffer.buffer = uniformBuffers[i].uniformBuffer.get();
+			descriptorData[i].uniformBuffer.offset = 0;
+			descriptorData[i].uniformBuffer.range = sizeof(UniformBufferObject);
 
-			std::vector<VkWriteDescriptorSet> descriptorWrites{2};
-
-			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[0].dstSet = descriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
-			descriptorWrites[0].dstArrayElement = 0;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[0].descriptorCount = 1;
-			descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[1].dstSet = descriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
-			descriptorWrites[1].dstArrayElement = 0;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pImageInfo = &imageInfo;
-
-			if (specularTexture)
-			{
-				descriptorWrites.push_back({});
-				descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[2].dstSet = descriptorSets[i];
-				descriptorWrites[2].dstBinding = 2;
-				descriptorWrites[2].dstArrayElement = 0;
-				descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[2].descriptorCount = 1;
-				descriptorWrites[2].pImageInfo = &imageInfoSpecular;
-			}
-			else
-			{
-				descriptorWrites.push_back({});
-				descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[2].dstSet = descriptorSets[i];
-				descriptorWrites[2].dstBinding = 2;
-				descriptorWrites[2].dstArrayElement = 0;
-				descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[2].descriptorCount = 1;
-				descriptorWrites[2].pImageInfo = &imageInfo;
-			}
+			descriptorData[i].diffuse.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			descriptorData[i].diffuse.imageView = diffuseTexture.textureImageView.get();
+			descriptorData[i].diffuse.sampler = diffuseTexture.textureSampler.get();
 
-			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+			descriptorData[i].specular.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			descriptorData[i].specular.imageView = specularTexture->textureImageView.get();
+			descriptorData[i].specular.sampler = specularTexture->textureSampler.get();
 		}
 
-		return descriptorSets;
+		return descriptorData;
 	}
 
-	std::vector<MeshUniformBuffer> createMeshUniformBuffers() {
-		std::vector<MeshUniformBuffer> uniformBuffers;
+	std::vector<VkDescriptorSet> createDescriptorSets(const std::vector<MeshDescriptorData>& descriptorData) {
+		std::vector<VkDescriptorSetLayout> layouts(m_framesInFlight, m_descriptorSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_descriptorPool;
+		allocInfo.descriptorSetCount = m_framesInFlight;
+		allocInfo.pSetLayouts = layouts.data();
 
-		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+		std::vector<VkDescriptorSet> descriptorSets;
+		descriptorSets.resize(m_framesInFlight);
+		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
+			throw std::runtime_error("failed to allocate descriptor sets!");
 
-		uniformBuffers.reserve(m_swapChainImages.size());
+		for (size_t i = 0; i < m_framesInFlight; i++)
+			writeMeshDescriptors(descriptorSets[i], descriptorData[i]);
 
-		for (size_t i = 0; i < m_swapChainImages.size(); i++) {
-			VkBuffer buffer = VK_NULL_HANDLE;
-			VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+		return descriptorSets;
+	}
 
-			createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				buffer, bufferMemory);
+	void writeMeshDescriptors(VkDescriptorSet descriptorSet, const MeshDescriptorData& descriptorData) {
+		std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = descriptorSet;
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &descriptorData.uniformBuffer;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = descriptorSet;
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pImageInfo = &descriptorData.diffuse;
+
+		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[2].dstSet = descriptorSet;
+		descriptorWrites[2].dstBinding = 2;
+		descriptorWrites[2].dstArrayElement = 0;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pImageInfo = &descriptorData.specular;
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
 
-			uniformBuffers.emplace_back(this);
-			uniformBuffers.back().uniformBuffer.reset(buffer);
-			uniformBuffers.back().uniformBuffersMemory.reset(bufferMemory);
+	// Writes the descriptors of every model with each of the three methods. The sets and the command buffer
+	// belong to the benchmark and are never submitted
+	void benchmarkDescriptorUpdates() {
+		if (m_settings.gpuDriven || m_models.empty())
+			return;
+
+		constexpr int rounds = 200;
+		uint32_t setCount = utils::intCast<uint32_t>(m_models.size());
+
+		auto measure = [&](auto&& update) {
+			auto start = std::chrono::steady_clock::now();
+
+			for (int round = 0; round < rounds; ++round)
+			{
+				for (uint32_t i = 0; i < setCount; ++i)
+					update(i, m_models[i].meshDescriptorData[round % m_framesInFlight]);
+			}
+
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(rounds) * setCount);
+		};
+
+		unique_ptr_descriptor_set_layout setLayout{ createMeshDescriptorSetLayout(0), m_descriptorSetLayoutDeleter };
+
+		std::array<VkDescriptorPoolSize, 2> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[0].descriptorCount = setCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[1].descriptorCount = setCount * 2;
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = utils::intCast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = setCount;
+
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &descriptorPool))
+			throw std::runtime_error("failed to create benchmark descriptor pool!");
+		unique_ptr_descriptor_pool descriptorPoolPtr{ descriptorPool, m_descriptorPoolDeleter };
+
+		std::vector<VkDescriptorSetLayout> layouts(setCount, setLayout.get());
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = setCount;
+		allocInfo.pSetLayouts = layouts.data();
+
+		std::vector<VkDescriptorSet> descriptorSets(setCount);
+		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
+			throw std::runtime_error("failed to allocate benchmark descriptor sets!");
+
+		double writeTime = measure([&](uint32_t i, const MeshDescriptorData& data) {
+			writeMeshDescriptors(descriptorSets[i], data);
+		});
+
+		unique_ptr_descriptor_update_template setTemplate{
+			createMeshDescriptorTemplate(VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET, setLayout.get(), VK_NULL_HANDLE),
+			m_descriptorUpdateTemplateDeleter };
+
+		double templateTime = measure([&](uint32_t i, const MeshDescriptorData& data) {
+			vkUpdateDescriptorSetWithTemplate(m_device, descriptorSets[i], setTemplate.get(), &data);
+		});
+
+		std::cout << "Vulkan descriptor update microbenchmark (" << setCount << " sets x " << rounds << " rounds), per set: vkUpdateDescriptorSets "
+			<< writeTime << " ns, update template " << templateTime << " ns, push descriptors ";
+
+		if (!m_pushDescriptors)
+		{
+			std::cout << "unsupported" << std::endl;
+			return;
+		}
+
+		unique_ptr_descriptor_set_layout pushLayout{ createMeshDescriptorSetLayout(VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR), m_descriptorSetLayoutDeleter };
+
+		VkDescriptorSetLayout pushLayoutHandle = pushLayout.get();
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &pushLayoutHandle;
+
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &pipelineLayout))
+			throw std::runtime_error("failed to create benchmark pipeline layout!");
+		unique_ptr_pipeline_layout pipelineLayoutPtr{ pipelineLayout, m_pipelineLayoutDeleter };
+
+		unique_ptr_descriptor_update_template pushTemplate{
+			createMeshDescriptorTemplate(VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR, pushLayout.get(), pipelineLayout),
+			m_descriptorUpdateTemplateDeleter };
+
+		auto commandPool = createCommandPoolPtr(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+		VkCommandBufferAllocateInfo commandBufferInfo{};
+		commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferInfo.commandPool = commandPool.get();
+		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandBufferInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		if (vkAllocateCommandBuffers(m_device, &commandBufferInfo, &commandBuffer))
+			throw std::runtime_error("failed to allocate benchmark command buffer!");
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo))
+			throw std::runtime_error("failed to begin benchmark command buffer!");
+
+		double pushTime = measure([&](uint32_t, const MeshDescriptorData& data) {
+			vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, pushTemplate.get(), pipelineLayout, 0, &data);
+		});
+
+		vkEndCommandBuffer(commandBuffer);
+
+		std::cout << pushTime << " ns" << std::endl;
+	}
+
+	static const char* descriptorModeName(RenderSettings::DescriptorMode mode) {
+		switch (mode)
+		{
+		case RenderSettings::DescriptorMode::DescriptorSets: return "descriptor sets";
+		case RenderSettings::DescriptorMode::UpdateTemplate: return "descriptor update templates";
+		case RenderSettings::DescriptorMode::PushDescriptors: return "push descriptors";
+		}
+
+		return "unknown";
+	}
+
+	std::vector<MeshUniformBuffer> createMeshUniformBuffers() {
+		std::vector<MeshUniformBuffer> uniformBuffers;
+
+		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+
+		uniformBuffers.reserve(m_framesInFlight);
+
+		for (size_t i = 0; i < m_framesInFlight; i++) {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+
+			createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				buffer, bufferMemory);
+
+			uniformBuffers.emplace_back(this);
+			uniformBuffers.back().uniformBuffer.reset(buffer);
+			uniformBuffers.back().uniformBuffersMemory.reset(bufferMemory);
 			vkMapMemory(m_device, uniformBuffers.back().uniformBuffersMemory.get(), 0, sizeof(UniformBufferObject), 0, &uniformBuffers.back().uniformBufferMemoryMapping);
 		}
 
 		return uniformBuffers;
 	}
 
+	void createGpuDrivenScene() {
+		auto scene = std::make_unique<GpuDrivenScene>(this);
+
+		struct MeshRange
+		{
+			uint32_t firstIndex = 0;
+			uint32_t indexCount = 0;
+			int32_t vertexOffset = 0;
+			uint32_t boundsIndex = 0;
+		};
+
+		// Every unique mesh is stored once in the shared geometry buffer
+		std::map<std::pair<std::string, size_t>, MeshRange> meshRanges;
+		std::vector<RenderCommon::Vertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<glm::vec4> meshBounds;
+
+		// Instances with the same pipeline, texture and mesh are merged into one instanced command.
+		// The pipeline goes first in the key, so commands of one pipeline are consecutive.
+		using GroupKey = std::tuple<bool, uint32_t, std::string, size_t>;
+		std::map<GroupKey, std::vector<uint32_t>> groups;
+		std::map<MeshTextureImage*, uint32_t> textureIndices;
+
+		for (uint32_t modelIndex = 0; modelIndex < m_models.size(); ++modelIndex)
+		{
+			VulkanModel& model = m_models[modelIndex];
+
+			auto diffuseIt = model.meshTextureImages.find(RenderCommon::Texture::Type::diffuse);
+			if (diffuseIt == model.meshTextureImages.end())
+				throw std::runtime_error{ "Can't find diffuse texture" };
+
+			auto textureIt = textureIndices.emplace(diffuseIt->second, utils::intCast<uint32_t>(textureIndices.size())).first;
+			if (textureIt->second == scene->textures.size())
+				scene->textures.push_back(diffuseIt->second);
+
+			for (size_t j = 0; j < model.model->meshes.size(); ++j)
+			{
+				auto meshKey = std::make_pair(model.info.modelPath, j);
+				if (meshRanges.find(meshKey) == meshRanges.end())
+				{
+					const RenderCommon::Mesh& mesh = model.model->meshes[j];
+
+					MeshRange range;
+					range.firstIndex = utils::intCast<uint32_t>(indices.size());
+					range.indexCount = utils::intCast<uint32_t>(mesh.m_indices.size());
+					range.vertexOffset = utils::intCast<int32_t>(vertices.size());
+					range.boundsIndex = utils::intCast<uint32_t>(meshBounds.size());
+					meshRanges.emplace(meshKey, range);
+
+					meshBounds.push_back(mesh.m_boundingSphere);
+
+					vertices.insert(vertices.end(), mesh.m_vertices.begin(), mesh.m_vertices.end());
+					indices.insert(indices.end(), mesh.m_indices.begin(), mesh.m_indices.end());
+				}
+
+				groups[GroupKey{ model.info.simpleModel, textureIt->second, model.info.modelPath, j }].push_back(modelIndex);
+			}
+		}
+
+		// init() falls back to per-model draws for scenes with more textures
+		assert(scene->textures.size() <= MaxIndirectTextures);
+
+		std::vector<VkDrawIndexedIndirectCommand> commands;
+		std::vector<IndirectDrawInstance> drawInstances;
+		std::vector<CullInstance> cullInstances;
+
+		for (const auto& [groupKey, modelIndices] : groups)
+		{
+			const auto& [simpleModel, textureIndex, modelPath, meshIndex] = groupKey;
+			const MeshRange& range = meshRanges.at({ modelPath, meshIndex });
+
+			if (scene->batches.empty() || scene->batches.back().simpleModel != simpleModel)
+			{
+				IndirectBatch batch;
+				batch.simpleModel = simpleModel;
+				batch.firstCommand = utils::intCast<uint32_t>(commands.size());
+				scene->batches.push_back(batch);
+			}
+			++scene->batches.back().commandCount;
+
+			VkDrawIndexedIndirectCommand command{};
+			command.indexCount = range.indexCount;
+			command.instanceCount = utils::intCast<uint32_t>(modelIndices.size());
+			command.firstIndex = range.firstIndex;
+			command.vertexOffset = range.vertexOffset;
+			command.firstInstance = utils::intCast<uint32_t>(drawInstances.size());
+			commands.push_back(command);
+
+			for (uint32_t modelIndex : modelIndices)
+			{
+				drawInstances.push_back({ modelIndex, textureIndex });
+				cullInstances.push_back({ modelIndex, textureIndex, utils::intCast<uint32_t>(commands.size() - 1), range.boundsIndex });
+			}
+		}
+
+		if (commands.empty())
+			return;
+
+		createVertexBuffer(vertices, indices, scene->geometry.buffer, scene->geometry.bufferMemory);
+		scene->indexOffset = sizeof(vertices[0]) * vertices.size();
+
+		createDeviceLocalBuffer(drawInstances.data(), sizeof(drawInstances[0]) * drawInstances.size(),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene->drawInstances);
+		createDeviceLocalBuffer(commands.data(), sizeof(commands[0]) * commands.size(),
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, scene->drawCommands);
+
+		VkDeviceSize modelBufferSize = sizeof(IndirectModelData) * m_models.size();
+		VkDeviceSize boneBufferSize = sizeof(glm::mat4) * UniformBufferObject::MaxBoneTransforms * m_models.size();
+
+		// Model matrices are read by the cull shader on the compute queue and by the vertex shader on the graphics queue.
+		// The cull data and counters stay exclusive, only the compute queue touches them
+		for (size_t i = 0; i < m_framesInFlight; i++)
+		{
+			scene->modelBuffers.push_back(createHostVisibleBuffer(modelBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, gpuCulling()));
+			scene->boneBuffers.push_back(createHostVisibleBuffer(boneBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+
+			// Models without animation keep identity palettes
+			auto* bones = static_cast<glm::mat4*>(scene->boneBuffers.back().mapping);
+			std::fill(bones, bones + UniformBufferObject::MaxBoneTransforms * m_models.size(), glm::mat4(1.0f));
+		}
+
+		if (gpuCulling())
+		{
+			scene->cullInstanceCount = utils::intCast<uint32_t>(cullInstances.size());
+
+			// Static culling inputs are uploaded on the graphics queue and read by the compute queue without ownership transfers.
+			// The per-frame outputs stay exclusive and are released to the graphics queue every frame
+			createDeviceLocalBuffer(cullInstances.data(), sizeof(cullInstances[0]) * cullInstances.size(),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene->cullInstances, true);
+			createDeviceLocalBuffer(meshBounds.data(), sizeof(meshBounds[0]) * meshBounds.size(),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene->meshBounds, true);
+
+			for (auto& command : commands)
+				command.instanceCount = 0;
+
+			scene->drawCommandsSize = sizeof(commands[0]) * commands.size();
+			createDeviceLocalBuffer(commands.data(), sizeof(commands[0]) * commands.size(),
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT, scene->zeroedCommands, true);
+
+			for (size_t i = 0; i < m_framesInFlight; i++)
+			{
+				scene->culledCommands.push_back(createDeviceBuffer(sizeof(commands[0]) * commands.size(),
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+				scene->culledInstances.push_back(createDeviceBuffer(sizeof(drawInstances[0]) * drawInstances.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+				scene->cullData.push_back(createHostVisibleBuffer(sizeof(CullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+				scene->cullCounters.push_back(createHostVisibleBuffer(sizeof(CullCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+			}
+
+			scene->cullCountersWritten.resize(m_framesInFlight, false);
+		}
+
+		scene->descriptorSets = createDescriptorSetsIndirect(*scene);
+
+		if (gpuCulling())
+		{
+			scene->cullDescriptorSets = createCullDescriptorSets(*scene);
+			scene->cullPyramidDescriptorsStale.assign(scene->cullDescriptorSets.size(), false);
+		}
+
+		m_gpuDriven = std::move(scene);
+	}
+
+	std::vector<VkDescriptorSet> createDescriptorSetsIndirect(const GpuDrivenScene& scene) {
+		std::vector<VkDescriptorSetLayout> layouts(m_framesInFlight, m_descriptorSetLayoutIndirect);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_descriptorPool;
+		allocInfo.descriptorSetCount = m_framesInFlight;
+		allocInfo.pSetLayouts = layouts.data();
+
+		std::vector<VkDescriptorSet> descriptorSets(m_framesInFlight);
+		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
+			throw std::runtime_error("failed to allocate indirect descriptor sets!");
+
+		// Unused array slots still need a valid descriptor
+		std::array<VkDescriptorImageInfo, MaxIndirectTextures> imageInfos{};
+		for (size_t i = 0; i < imageInfos.size(); ++i)
+		{
+			const MeshTextureImage* texture = scene.textures[i < scene.textures.size() ? i : 0];
+			imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfos[i].imageView = texture->textureImageView.get();
+			imageInfos[i].sampler = texture->textureSampler.get();
+		}
+
+		for (size_t i = 0; i < m_framesInFlight; i++) {
+			std::array<VkDescriptorBufferInfo, 3> bufferInfos{};
+			bufferInfos[0].buffer = scene.modelBuffers[i].buffer.get();
+			bufferInfos[0].range = VK_WHOLE_SIZE;
+			bufferInfos[1].buffer = scene.boneBuffers[i].buffer.get();
+			bufferInfos[1].range = VK_WHOLE_SIZE;
+			bufferInfos[2].buffer = gpuCulling() ? scene.culledInstances[i].buffer.get() : scene.drawInstances.buffer.get();
+			bufferInfos[2].range = VK_WHOLE_SIZE;
+
+			std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+			for (uint32_t j = 0; j < bufferInfos.size(); ++j)
+			{
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstSet = descriptorSets[i];
+				descriptorWrites[j].dstBinding = j;
+				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[j].descriptorCount = 1;
+				descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+			}
+
+			descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[3].dstSet = descriptorSets[i];
+			descriptorWrites[3].dstBinding = 3;
+			descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[3].descriptorCount = MaxIndirectTextures;
+			descriptorWrites[3].pImageInfo = imageInfos.data();
+
+			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+
+		return descriptorSets;
+	}
+
+	std::vector<VkDescriptorSet> createCullDescriptorSets(const GpuDrivenScene& scene) {
+		std::vector<VkDescriptorSetLayout> layouts(m_framesInFlight, m_cullPipeline->descriptorSetLayout.get());
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = m_descriptorPool;
+		allocInfo.descriptorSetCount = m_framesInFlight;
+		allocInfo.pSetLayouts = layouts.data();
+
+		std::vector<VkDescriptorSet> descriptorSets(m_framesInFlight);
+		if (vkAllocateDescriptorSets(m_device, &allocInfo, descriptorSets.data()))
+			throw std::runtime_error("failed to allocate cull descriptor sets!");
+
+		for (size_t i = 0; i < m_framesInFlight; i++) {
+			std::array<VkDescriptorBufferInfo, 7> bufferInfos{};
+			bufferInfos[0].buffer = scene.cullData[i].buffer.get();
+			bufferInfos[1].buffer = scene.modelBuffers[i].buffer.get();
+			bufferInfos[2].buffer = scene.cullInstances.buffer.get();
+			bufferInfos[3].buffer = scene.meshBounds.buffer.get();
+			bufferInfos[4].buffer = scene.culledCommands[i].buffer.get();
+			bufferInfos[5].buffer = scene.culledInstances[i].buffer.get();
+			bufferInfos[6].buffer = scene.cullCounters[i].buffer.get();
+
+			std::array<VkWriteDescriptorSet, 7> descriptorWrites{};
+			for (uint32_t j = 0; j < bufferInfos.size(); ++j)
+			{
+				bufferInfos[j].range = VK_WHOLE_SIZE;
+
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstSet = descriptorSets[i];
+				descriptorWrites[j].dstBinding = j;
+				descriptorWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[j].descriptorCount = 1;
+				descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+			}
+
+			vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+
+		return descriptorSets;
+	}
+
+	// Binding 7 of the cull sets follows the depth pyramid, which is recreated with the swap chain
+	// Without a frame all sets are written, only while none of them is in flight
+	void updateCullPyramidDescriptors(std::optional<uint32_t> frame = std::nullopt) {
+		if (!m_gpuDriven || m_gpuDriven->cullDescriptorSets.empty())
+			return;
+
+		VkDescriptorImageInfo imageInfo{};
+		if (m_depthPyramid)
+		{
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			imageInfo.imageView = m_depthPyramid->imageView.get();
+			imageInfo.sampler = m_depthPyramid->sampler.get();
+		}
+		else
+		{
+			// Not sampled without occlusion culling, any valid image will do
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = m_gpuDriven->textures[0]->textureImageView.get();
+			imageInfo.sampler = m_gpuDriven->textures[0]->textureSampler.get();
+		}
+
+		std::vector<VkDescriptorSet> sets = m_gpuDriven->cullDescriptorSets;
+		if (frame)
+			sets = { m_gpuDriven->cullDescriptorSets[*frame] };
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(sets.size());
+		for (size_t i = 0; i < descriptorWrites.size(); ++i)
+		{
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = sets[i];
+			descriptorWrites[i].dstBinding = 7;
+			descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pImageInfo = &imageInfo;
+		}
+
+		vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
 		VkPhysicalDeviceMemoryProperties memProperties;
 		vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
@@ -2151,7 +3913,7 @@ public:
 		throw std::runtime_error("failed to find suitable memory type!");
 	}
 
-	unique_ptr_command_buffer createCommandBufferPtrSecondary(VkCommandPool commandPool, CommandBufferDeleter cmdBufferDeleter)
+	VkCommandBuffer allocateSecondaryCommandBuffer(VkCommandPool commandPool)
 	{
 		VkCommandBufferAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -2163,16 +3925,37 @@ public:
 		if (vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer))
 			throw std::runtime_error("failed to allocate command buffers!");
 
-		unique_ptr_command_buffer commadBufferPtr{ nullptr, cmdBufferDeleter };
+		return commandBuffer;
+	}
 
-		commadBufferPtr.reset(commandBuffer);
+	void createComputeCommandBuffers()
+	{
+		if (!m_computeQueue)
+			return;
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = m_computeFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+		if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_computeCommandPool))
+			throw std::runtime_error("failed to create compute command pool!");
+
+		m_computeCommandBuffers.resize(m_framesInFlight);
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = m_computeCommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = m_framesInFlight;
 
-		return commadBufferPtr;
+		if (vkAllocateCommandBuffers(m_device, &allocInfo, m_computeCommandBuffers.data()))
+			throw std::runtime_error("failed to allocate compute command buffers!");
 	}
 
 	void createCommandBuffers()
 	{
-		m_commandBuffers.resize(m_swapChainFramebuffers.size());
+		m_commandBuffers.resize(m_framesInFlight);
 
 		VkCommandBufferAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -2188,216 +3971,710 @@ public:
 		VkSemaphoreCreateInfo semaphoreInfo{};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-		m_imageAvailableSemaphores.resize(m_MAX_FRAMES_IN_FLIGHT);
-		m_renderFinishedSemaphores.resize(m_MAX_FRAMES_IN_FLIGHT);
-		m_inFlightFences.resize(m_MAX_FRAMES_IN_FLIGHT);
-		m_imagesInFlight.resize(m_swapChainImages.size(), VK_NULL_HANDLE);
+		// Binary semaphores only where the swapchain requires them
+		m_imageAvailableSemaphores.resize(m_framesInFlight);
+		m_renderFinishedSemaphores.resize(m_framesInFlight);
+		m_frameTimelineValues.resize(m_framesInFlight, 0);
+		m_frameLatencies.resize(m_framesInFlight);
+
+		for (size_t i = 0; i < m_framesInFlight; i++) {
+			if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]) ||
+				vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i])) {
+
+				throw std::runtime_error("failed to create synchronization objects for a frame!");
+			}
+		}
+	}
+
+	VkSemaphore createTimelineSemaphore()
+	{
+		VkSemaphoreTypeCreateInfo typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore))
+			throw std::runtime_error("failed to create timeline semaphore!");
+
+		return semaphore;
+	}
+
+	void createTimelineSemaphores()
+	{
+		m_frameTimeline = createTimelineSemaphore();
+		m_uploadTimeline = createTimelineSemaphore();
+		if (m_computeQueue)
+			m_computeTimeline = createTimelineSemaphore();
+	}
+
+	void waitTimeline(VkSemaphore semaphore, uint64_t value)
+	{
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+
+		if (vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX))
+			throw std::runtime_error("failed to wait for timeline semaphore!");
+	}
+
+	uint64_t timelineValue(VkSemaphore semaphore)
+	{
+		uint64_t value{};
+		if (vkGetSemaphoreCounterValue(m_device, semaphore, &value))
+			throw std::runtime_error("failed to get timeline semaphore value!");
+
+		return value;
+	}
+
+	void showFPS()
+	{
+		static double lastFpsUpdateTime = 0;
+		static double nbFrames = 0;
+		double delta = m_currentTime - lastFpsUpdateTime;
+
+		nbFrames++;
+
+		if (delta >= 1.0) { // If last fps update was more than 1 sec ago
+			double fps = static_cast<double>(nbFrames) / delta;
+
+			char title[64];
+			std::snprintf(title, sizeof(title), "VULAKN FPS: %f", fps);
+			glfwSetWindowTitle(m_window, title);
+			lastFpsUpdateTime = m_currentTime;
+			nbFrames = 0;
+		}
+	}
+
+	void updateDeltaTime()
+	{
+		m_currentTime = glfwGetTime();
+		m_deltaTime = m_currentTime - m_lastTime;
+		m_lastTime = m_currentTime;
+	}
+
+	void processInput()
+	{
+		if (glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS)
+			camera.ProcessKeyboard(Camera_Movement::FORWARD, m_deltaTime);
+		if (glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS)
+			camera.ProcessKeyboard(Camera_Movement::BACKWARD, m_deltaTime);
+		if (glfwGetKey(m_window, GLFW_KEY_A) == GLFW_PRESS)
+			camera.ProcessKeyboard(Camera_Movement::LEFT, m_deltaTime);
+		if (glfwGetKey(m_window, GLFW_KEY_D) == GLFW_PRESS)
+			camera.ProcessKeyboard(Camera_Movement::RIGHT, m_deltaTime);
+
+		if (glfwGetKey(m_window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
+			glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		else
+			glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+	}
+
+	// Rough CPU cost of recording a model, used to balance the recording batches
+	static size_t modelRecordingCost(const VulkanModel& vulkanModel)
+	{
+		constexpr size_t boneUpdateCost = 4096;
+		constexpr size_t meshCost = 256;
+		constexpr size_t indicesPerCostUnit = 64;
+
+		size_t cost = vulkanModel.info.simpleModel ? 0 : boneUpdateCost;
+
+		for (auto& mesh : vulkanModel.model->meshes)
+			cost += meshCost + mesh.m_indices.size() / indicesPerCostUnit;
+
+		return cost;
+	}
+
+	void initThreadData()
+	{
+		// GPU-driven mode records everything into the primary command buffer
+		if (m_settings.gpuDriven)
+			return;
+
+		std::vector<size_t> costs;
+		size_t totalCost = 0;
+
+		for (auto& vulkanModel : m_models)
+		{
+			costs.push_back(modelRecordingCost(vulkanModel));
+			totalCost += costs.back();
+		}
+
+		// One batch per core, split into contiguous ranges of about the same cost
+		size_t batchCount = std::min(static_cast<size_t>(m_coreNumber), m_models.size());
+		size_t model = 0;
+		size_t accumulatedCost = 0;
+
+		for (size_t i = 0; i < batchCount; ++i)
+		{
+			ThreadData threadData{ this };
+
+			for (uint32_t j = 0; j < m_framesInFlight; ++j)
+			{
+				threadData.commandPools.push_back(createCommandPoolPtr(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT));
+				threadData.commandBuffers.push_back(allocateSecondaryCommandBuffer(threadData.commandPools.back().get()));
+			}
+
+			size_t targetCost = totalCost * (i + 1) / batchCount;
+			size_t lastModel = m_models.size() - (batchCount - i - 1);
+
+			threadData.firstModel = model;
+			while (model < lastModel && (accumulatedCost < targetCost || model == threadData.firstModel))
+				accumulatedCost += costs[model++];
+			threadData.endModel = model;
+
+			m_threadData.emplace_back(std::move(threadData));
+		}
+	}
+
+	glm::mat4 projectionMatrix()
+	{
+		glm::mat4 proj = glm::perspective(glm::radians(45.f), m_framebufferWidth / static_cast<float>(m_framebufferHeight), 0.1f, FarPlane);
+		proj[1][1] *= -1;
+
+		return proj;
+	}
+
+	RenderCommon::FrameInput sampleFrameInput()
+	{
+		RenderCommon::FrameInput input;
+		input.time = m_currentTime;
+		input.view = camera.GetViewMatrix();
+		input.projection = projectionMatrix();
+		input.cameraPosition = camera.Position;
+		input.sampleTime = std::chrono::steady_clock::now();
+
+		return input;
+	}
+
+	// GPU-driven mode culls on the GPU, the snapshot keeps every model visible then
+	void simulate(const RenderCommon::FrameInput& input, RenderCommon::FrameSnapshot& snapshot)
+	{
+		RenderCommon::simulateFrame(input, m_models, m_settings.frustumCulling && !m_settings.gpuDriven, true, m_jobSystem, snapshot);
+	}
+
+	void nextSnapshot(const RenderCommon::FrameInput& input)
+	{
+		if (m_framePipeline)
+		{
+			m_snapshot = &m_framePipeline->next(input);
+		}
+		else
+		{
+			auto simulateStartTime = std::chrono::steady_clock::now();
+			simulate(input, m_lockstepSnapshot);
+			m_simulateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - simulateStartTime).count();
+
+			m_snapshot = &m_lockstepSnapshot;
+		}
+
+		if (m_settings.frustumCulling && !m_settings.gpuDriven)
+		{
+			m_drawnCount += m_snapshot->drawnModels;
+			m_culledCount += m_snapshot->culledModels;
+			++m_culledFrames;
+		}
+	}
+
+	void updateModelPushConstants(uint32_t currentFrame, VulkanModel& vulkanModel, const RenderCommon::ModelState& state)
+	{
+		const RenderCommon::FrameInput& input = m_snapshot->input;
+
+		vulkanModel.pushConstant[currentFrame].PVM = input.projection * input.view * state.model;
+		vulkanModel.pushConstant[currentFrame].model = state.model;
+	}
+
+	void updateUniformBuffer(uint32_t currentFrame, VulkanModel& vulkanMode, const RenderCommon::ModelState& state) {
+		size_t boneCount = std::min(state.bones.size(), UniformBufferObject::MaxBoneTransforms);
+		std::copy_n(state.bones.begin(), boneCount, vulkanMode.uniformBuffer[currentFrame].BoneTransform);
+
+		std::memcpy(vulkanMode.meshUniformBuffers[currentFrame].uniformBufferMemoryMapping,
+					vulkanMode.uniformBuffer[currentFrame].BoneTransform,
+					boneCount * sizeof(glm::mat4));
+
+		std::memcpy((char*)vulkanMode.meshUniformBuffers[currentFrame].uniformBufferMemoryMapping + offsetof(UniformBufferObject, viewPos),
+					&m_snapshot->input.cameraPosition, sizeof(m_snapshot->input.cameraPosition));
+	}
+
+	// Push constants are updated by the transforms stage of the frame graph, visibility comes from the snapshot
+	void recordModelBatch(ThreadData& threadData, uint32_t currentFrame, const VkCommandBufferInheritanceInfo& inheritanceInfo)
+	{
+		VkCommandBuffer commandBuffer = threadData.commandBuffers[currentFrame];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo))
+			throw std::runtime_error("failed to begin recording command buffer!");
+
+		// Dynamic state isn't inherited from the primary command buffer
+		setViewportAndScissor(commandBuffer);
+
+		auto& renderQueue = threadData.renderQueue;
+		auto& stateCache = threadData.stateCache;
+
+		renderQueue.clear();
+		for (uint32_t i = utils::intCast<uint32_t>(threadData.firstModel); i < threadData.endModel; ++i)
+		{
+			const VulkanModel& vulkanModel = m_models[i];
+			const RenderCommon::ModelState& state = m_snapshot->models[i];
+
+			if (!state.visible)
+				continue;
+
+			float depth = glm::length(glm::vec3(state.model[3]) - m_snapshot->input.cameraPosition) / FarPlane;
+
+			for (uint32_t j = 0; j < vulkanModel.model->meshes.size(); ++j)
+			{
+				if (state.meshVisible[j])
+					renderQueue.push(RenderCommon::makeSortKey(vulkanModel.info.simpleModel ? PipelineLibrary::Simple : PipelineLibrary::Regular, vulkanModel.material, depth, j), i, j);
+			}
+		}
+		renderQueue.sort();
+
+		// A secondary command buffer starts without bound state
+		stateCache.invalidate();
+
+		for (const RenderCommon::DrawItem& item : renderQueue.items())
+		{
+			VulkanModel& vulkanModel = m_models[item.model];
+			auto variant = vulkanModel.info.simpleModel ? PipelineLibrary::Simple : PipelineLibrary::Regular;
+
+			if (stateCache.bind(RenderCommon::StateSlot::Pipeline, variant))
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines->get(variant));
+
+			// Both pipelines share the layout, so the model's push constants and set stay bound across a pipeline switch
+			if (stateCache.bind(RenderCommon::StateSlot::ModelData, item.model))
+			{
+				vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantBufferObject), &vulkanModel.pushConstant[currentFrame]);
+
+				const MeshDescriptorData& descriptorData = vulkanModel.meshDescriptorData[currentFrame];
+
+				switch (m_descriptorMode)
+				{
+				case RenderSettings::DescriptorMode::DescriptorSets:
+					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &vulkanModel.meshDescriptorSet[currentFrame], 0, nullptr);
+					break;
+				case RenderSettings::DescriptorMode::UpdateTemplate:
+					// The GPU is done with the frame's set, so it's rewritten in place, no allocation from the pool
+					vkUpdateDescriptorSetWithTemplate(m_device, vulkanModel.meshDescriptorSet[currentFrame], m_descriptorUpdateTemplate, &descriptorData);
+					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &vulkanModel.meshDescriptorSet[currentFrame], 0, nullptr);
+					break;
+				case RenderSettings::DescriptorMode::PushDescriptors:
+					vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, m_descriptorUpdateTemplate, m_pipelineLayout, 0, &descriptorData);
+					break;
+				}
+			}
+
+			const RenderCommon::Mesh& mesh = vulkanModel.model->meshes[item.mesh];
+			VkBuffer meshBuffer = vulkanModel.meshVertexBuffers[item.mesh].m_vertexBuffer.get();
+
+			if (stateCache.bind(RenderCommon::StateSlot::Geometry, (std::uint64_t(item.model) << 32) | item.mesh))
+			{
+				VkBuffer vertexBuffers[] = { meshBuffer };
+				VkDeviceSize offsets[] = { 0 };
+
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+				vkCmdBindIndexBuffer(commandBuffer, meshBuffer, sizeof(mesh.m_vertices[0]) * mesh.m_vertices.size(), VK_INDEX_TYPE_UINT32);
+			}
+
+			vkCmdDrawIndexed(commandBuffer, utils::intCast<uint32_t>(mesh.m_indices.size()), 1, 0, 0, 0);
+		}
+
+		if (vkEndCommandBuffer(commandBuffer))
+			throw std::runtime_error("failed to record command buffer!");
+	}
+
+	void updateModelTransforms(uint32_t currentFrame)
+	{
+		m_jobSystem.parallelFor(0, m_models.size(), 32, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				updateModelPushConstants(currentFrame, m_models[i], m_snapshot->models[i]);
+		});
+	}
+
+	// Poses of the visible models go to the frame's uniform buffers
+	void updateModelAnimation(uint32_t currentFrame)
+	{
+		m_jobSystem.parallelFor(0, m_models.size(), 8, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+			{
+				if (m_snapshot->models[i].visible)
+					updateUniformBuffer(currentFrame, m_models[i], m_snapshot->models[i]);
+			}
+		});
+	}
+
+	void recordBatch(size_t batch)
+	{
+		VkCommandBufferInheritanceInfo cmdBufferInheritanceInfo{};
+		cmdBufferInheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		cmdBufferInheritanceInfo.renderPass = m_renderPass;
+		cmdBufferInheritanceInfo.framebuffer = m_swapChainFramebuffers[m_imageIndex];
+
+		recordModelBatch(m_threadData[batch], m_currentFrame, cmdBufferInheritanceInfo);
+	}
+
+	// Records the batches of frame 0 on the old mutex based utils::ThreadPool and on utils::JobSystem
+	// for every worker count of utils::workerCountSweep. Needs an idle device, the pools are reset between rounds
+	void benchmarkRecordingScaling()
+	{
+		if (m_settings.gpuDriven || m_threadData.empty())
+			return;
+
+		constexpr int rounds = 50;
+		constexpr uint32_t frame = 0;
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = m_renderPass;
+
+		auto measure = [&](auto&& recordBatches) {
+			auto start = std::chrono::steady_clock::now();
+
+			for (int round = 0; round < rounds; ++round)
+			{
+				for (auto& threadData : m_threadData)
+					vkResetCommandPool(m_device, threadData.commandPools[frame].get(), 0);
+
+				recordBatches();
+			}
+
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+		};
+
+		std::vector<std::pair<size_t, double>> msByWorkers;
+
+		std::cout << "Vulkan recording of " << m_threadData.size() << " batches, ms per frame by workers (ThreadPool / JobSystem):";
+
+		for (size_t workers : utils::workerCountSweep(std::max(std::thread::hardware_concurrency(), 1u)))
+		{
+			double poolTime = 0;
+			{
+				utils::ThreadPool pool{ workers };
+
+				poolTime = measure([&] {
+					std::vector<std::future<void>> futures;
+					for (auto& threadData : m_threadData)
+						futures.push_back(pool.enqueue([&, batch = &threadData] { recordModelBatch(*batch, frame, inheritanceInfo); }));
+
+					for (auto& task : futures)
+						task.get();
+				});
+			}
+
+			double jobTime = 0;
+			{
+				utils::JobSystem jobs{ workers };
+
+				jobTime = measure([&] {
+					jobs.parallelFor(0, m_threadData.size(), 1, [&](size_t first, size_t end) {
+						for (size_t i = first; i < end; ++i)
+							recordModelBatch(m_threadData[i], frame, inheritanceInfo);
+					});
+				});
+			}
+
+			msByWorkers.emplace_back(workers, jobTime);
+
+			std::cout << " " << workers << ": " << poolTime << " / " << jobTime;
+		}
+
+		std::cout << ", JobSystem knee at " << utils::scalingKnee(msByWorkers) << " workers" << std::endl;
+	}
+
+	void updateGpuDrivenTransforms(uint32_t currentFrame)
+	{
+		auto* modelData = static_cast<IndirectModelData*>(m_gpuDriven->modelBuffers[currentFrame].mapping);
+
+		m_jobSystem.parallelFor(0, m_models.size(), 32, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				modelData[i].model = m_snapshot->models[i].model;
+		});
+	}
 
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	void updateGpuDrivenBones(uint32_t currentFrame)
+	{
+		auto* boneData = static_cast<glm::mat4*>(m_gpuDriven->boneBuffers[currentFrame].mapping);
 
-		for (size_t i = 0; i < m_MAX_FRAMES_IN_FLIGHT; i++) {
-			if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]) ||
-				vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i]) ||
-				vkCreateFence(m_device, &fenceInfo, nullptr, &m_inFlightFences[i])) {
+		m_jobSystem.parallelFor(0, m_models.size(), 8, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+			{
+				const auto& bones = m_snapshot->models[i].bones;
+				size_t boneCount = std::min(bones.size(), UniformBufferObject::MaxBoneTransforms);
 
-				throw std::runtime_error("failed to create synchronization objects for a frame!");
+				std::copy_n(bones.begin(), boneCount, boneData + i * UniformBufferObject::MaxBoneTransforms);
 			}
-		}
+		});
 	}
 
-	void showFPS()
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t currentFrame)
 	{
-		static double lastFpsUpdateTime = 0;
-		static double nbFrames = 0;
-		double delta = m_currentTime - lastFpsUpdateTime;
+		// The frame's timeline value has been waited, so the counters of its previous use are final
+		if (m_gpuDriven->cullCountersWritten[currentFrame])
+		{
+			auto* counters = static_cast<const CullCounters*>(m_gpuDriven->cullCounters[currentFrame].mapping);
+			m_drawnCount += counters->drawn;
+			m_culledCount += counters->culled;
+			++m_culledFrames;
+		}
+		m_gpuDriven->cullCountersWritten[currentFrame] = true;
 
-		nbFrames++;
+		glm::mat4 viewProj = m_snapshot->input.projection * m_snapshot->input.view;
+		auto frustum = RenderCommon::Frustum::fromMatrix(viewProj, true);
 
-		if (delta >= 1.0) { // If last fps update was more than 1 sec ago
-			double fps = static_cast<double>(nbFrames) / delta;
+		CullData cullData{};
+		std::copy(frustum.planes.begin(), frustum.planes.end(), cullData.frustumPlanes);
+		cullData.prevViewProj = m_prevViewProj;
+		cullData.instanceCount = m_gpuDriven->cullInstanceCount;
 
-			glfwSetWindowTitle(m_window, (std::string("VULAKN FPS: ") + std::to_string(fps)).c_str());
-			lastFpsUpdateTime = m_currentTime;
-			nbFrames = 0;
+		if (m_depthPyramid && m_depthPyramid->valid)
+		{
+			cullData.pyramidSize = glm::vec2(m_depthPyramid->width, m_depthPyramid->height);
+			cullData.occlusionEnabled = 1;
 		}
-	}
 
-	void updateDeltaTime()
-	{
-		m_currentTime = glfwGetTime();
-		m_deltaTime = m_currentTime - m_lastTime;
-		m_lastTime = m_currentTime;
-	}
+		std::memcpy(m_gpuDriven->cullData[currentFrame].mapping, &cullData, sizeof(cullData));
+		m_prevViewProj = viewProj;
 
-	void processInput()
-	{
-		if (glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS)
-			camera.ProcessKeyboard(Camera_Movement::FORWARD, m_deltaTime);
-		if (glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS)
-			camera.ProcessKeyboard(Camera_Movement::BACKWARD, m_deltaTime);
-		if (glfwGetKey(m_window, GLFW_KEY_A) == GLFW_PRESS)
-			camera.ProcessKeyboard(Camera_Movement::LEFT, m_deltaTime);
-		if (glfwGetKey(m_window, GLFW_KEY_D) == GLFW_PRESS)
-			camera.ProcessKeyboard(Camera_Movement::RIGHT, m_deltaTime);
+		VkBufferCopy copyRegion{};
+		copyRegion.size = m_gpuDriven->drawCommandsSize;
+		vkCmdCopyBuffer(commandBuffer, m_gpuDriven->zeroedCommands.buffer.get(), m_gpuDriven->culledCommands[currentFrame].buffer.get(), 1, &copyRegion);
+		vkCmdFillBuffer(commandBuffer, m_gpuDriven->cullCounters[currentFrame].buffer.get(), 0, VK_WHOLE_SIZE, 0);
 
-		if (glfwGetKey(m_window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-			glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-		else
-			glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-	}
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-	void initThreadData()
-	{
-		for (int i = 0; i < m_coreNumber; ++i)
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline->pipeline.get());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline->pipelineLayout.get(), 0, 1,
+			&m_gpuDriven->cullDescriptorSets[currentFrame], 0, nullptr);
+		vkCmdDispatch(commandBuffer, (m_gpuDriven->cullInstanceCount + 63) / 64, 1, 1);
+
+		// The graphics submission waits on the compute timeline, only the ownership has to be handed over.
+		// Recorded inline the render graph orders the draws after the dispatch
+		if (asyncCompute() && computeOwnershipTransfers())
 		{
-			ThreadData threadData{ this };
-			threadData.commandPool = createCommandPoolPtr();
-			m_threadData.emplace_back(std::move(threadData));
+			auto barriers = cullingOwnershipBarriers(currentFrame);
+			for (auto& bufferBarrier : barriers)
+				bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
 
-			for (size_t j = 0; j < m_swapChainFramebuffers.size(); ++j)
-			{
-				m_threadData[i].commandBuffers.push_back({});
-				
-			}
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				0, 0, nullptr, utils::intCast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
 		}
 	}
 
-	bool updateModelPushConstants(uint32_t currentImage, VulkanModel& vulkanModel)
+	// Release (compute queue) and acquire (graphics queue) halves of the transfer of the culling outputs.
+	// Nothing is transferred back, the next culling pass of the frame rewrites both buffers
+	std::array<VkBufferMemoryBarrier, 2> cullingOwnershipBarriers(uint32_t currentFrame)
 	{
-		glm::mat4 view = camera.GetViewMatrix();
-		glm::mat4 proj = glm::perspective(glm::radians(45.f), m_framebufferWidth / static_cast<float>(m_framebufferHeight), 0.1f, 200.f);
+		std::array<VkBufferMemoryBarrier, 2> barriers{};
+		std::array<VkBuffer, 2> buffers = { m_gpuDriven->culledCommands[currentFrame].buffer.get(), m_gpuDriven->culledInstances[currentFrame].buffer.get() };
 
-		proj[1][1] *= -1;
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, vulkanModel.position);
-		model = glm::scale(model, vulkanModel.scale);
+		for (size_t i = 0; i < barriers.size(); ++i)
+		{
+			barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barriers[i].srcQueueFamilyIndex = m_computeFamily;
+			barriers[i].dstQueueFamilyIndex = m_graphicsFamily;
+			barriers[i].buffer = buffers[i];
+			barriers[i].offset = 0;
+			barriers[i].size = VK_WHOLE_SIZE;
+		}
 
-		if(vulkanModel.info.simpleModel)
-			model = glm::rotate(model, (float)m_currentTime, glm::vec3(0.5f, 1.0f, 0.0f));
+		return barriers;
+	}
 
-		glm::mat4 PVM = proj * view * model;
+	void acquireCullingResults(VkCommandBuffer commandBuffer, uint32_t currentFrame)
+	{
+		if (!computeOwnershipTransfers())
+			return;
 
-		vulkanModel.pushConstant[currentImage].PVM = PVM;
-		vulkanModel.pushConstant[currentImage].model = model;
+		auto barriers = cullingOwnershipBarriers(currentFrame);
+		barriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-		return true;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			0, 0, nullptr, utils::intCast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
 	}
 
-	void updateUniformBuffer(uint32_t currentImage, VulkanModel& vulkanMode) {
-		std::vector<aiMatrix4x4> boneTransforms;
-		vulkanMode.model->BoneTransform(m_currentTime, boneTransforms);
+	// Per-frame compute work of the async compute queue, submitted ahead of the frame's graphics work
+	void recordFrameCompute(uint32_t currentFrame)
+	{
+		VkCommandBuffer commandBuffer = m_computeCommandBuffers[currentFrame];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-		for (size_t i = 0; i < boneTransforms.size(); ++i)
-			vulkanMode.uniformBuffer[currentImage].BoneTransform[i] = RenderCommon::Assimp2Glm(boneTransforms[i]);
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo))
+			throw std::runtime_error("failed to begin recording compute command buffer!");
 
-		std::memcpy(vulkanMode.meshUniformBuffers[currentImage].uniformBufferMemoryMapping,
-					vulkanMode.uniformBuffer[currentImage].BoneTransform,
-					boneTransforms.size() * sizeof(boneTransforms[0]));
+		recordCulling(commandBuffer, currentFrame);
 
-		std::memcpy((char*)vulkanMode.meshUniformBuffers[currentImage].uniformBufferMemoryMapping + offsetof(UniformBufferObject, viewPos),
-					&camera.Position, sizeof(camera.Position));
+		if (vkEndCommandBuffer(commandBuffer))
+			throw std::runtime_error("failed to record compute command buffer!");
 	}
 
-	void updateSecondaryCommandBuffers(uint32_t currentImage)
+	// Frustum culling only depends on the frame's own data and overlaps the previous frame's graphics work.
+	// The occlusion test reads the depth pyramid built at the end of the previous frame, so it waits for that frame
+	void submitFrameCompute(uint32_t currentFrame, uint64_t frameValue)
 	{
-		for (auto& threadData : m_threadData)
-			threadData.usedCommandBuffers = 0;
-
-		VkCommandBufferInheritanceInfo cmdBufferInheritanceInfo{};
-		cmdBufferInheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
-		cmdBufferInheritanceInfo.renderPass = m_renderPass;
-		cmdBufferInheritanceInfo.framebuffer = m_swapChainFramebuffers[currentImage];
-		
-		std::vector<std::future<void>> futures;
+		utils::FrameVector<VkSemaphore> waitSemaphores;
+		utils::FrameVector<uint64_t> waitValues;
+		utils::FrameVector<VkPipelineStageFlags> waitStages;
 
-		for (size_t i = 0; i < m_models.size(); ++i)
+		if (m_uploadTimelineValue)
 		{
-			auto renderTask = m_threadPool.enqueue([&](VulkanModel* vulkanModel) {
-				int threadId = m_threadPool.threadIndex();
-				auto& threadData = m_threadData[threadId];
-				auto& commandBuffers = threadData.commandBuffers[currentImage];
-
-				++threadData.usedCommandBuffers;
-				int currentCommandBufferIndex = threadData.usedCommandBuffers - 1;
+			waitSemaphores.push_back(m_uploadTimeline);
+			waitValues.push_back(m_uploadTimelineValue);
+			waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
 
-				if (commandBuffers.size() < threadData.usedCommandBuffers)
-				{
-					commandBuffers.emplace_back(createCommandBufferPtrSecondary(threadData.commandPool.get(), [this, wtf = &m_threadData[threadId]](VkCommandBuffer buffer) {
-						if (buffer && wtf->commandPool)
-							vkFreeCommandBuffers(m_device, wtf->commandPool.get(), 1, &buffer);
-					}));
-				}
+		if (occlusionCulling() && frameValue > 1)
+		{
+			waitSemaphores.push_back(m_frameTimeline);
+			waitValues.push_back(frameValue - 1);
+			waitStages.push_back(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
 
-				auto& commandBuffer = commandBuffers[currentCommandBufferIndex];
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = utils::intCast<uint32_t>(waitValues.size());
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &frameValue;
 
-				VkCommandBufferBeginInfo beginInfo{};
-				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT; // Optional
-				beginInfo.pInheritanceInfo = &cmdBufferInheritanceInfo; // Optional
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = utils::intCast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &m_computeCommandBuffers[currentFrame];
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &m_computeTimeline;
 
-				if (vkBeginCommandBuffer(commandBuffer.get(), &beginInfo))
-					throw std::runtime_error("failed to begin recording command buffer!");
+		if (vkQueueSubmit(m_computeQueue, 1, &submitInfo, VK_NULL_HANDLE))
+			throw std::runtime_error("failed to submit compute command buffer!");
+	}
 
-				if(vulkanModel->info.simpleModel)
-					vkCmdBindPipeline(commandBuffer.get(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipelineSimple);
-				else
-					vkCmdBindPipeline(commandBuffer.get(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+	// The render graph moves the depth buffer to the read-only layout and the pyramid to GENERAL
+	void recordDepthPyramid(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_depthPyramidPipeline->pipeline.get());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_depthPyramidPipeline->pipelineLayout.get(), 0, 1,
+			&m_depthPyramid->depthDescriptorSet, 0, nullptr);
+		vkCmdDispatch(commandBuffer, (m_depthPyramid->width + 7) / 8, (m_depthPyramid->height + 7) / 8, 1);
 
-				if (updateModelPushConstants(currentImage, *vulkanModel))
-					vkCmdPushConstants(commandBuffer.get(), m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantBufferObject), &vulkanModel->pushConstant[currentImage]);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_depthReducePipeline->pipeline.get());
 
-				updateUniformBuffer(currentImage, *vulkanModel);
+		for (uint32_t i = 1; i < m_depthPyramid->mipLevels; ++i)
+		{
+			VkImageMemoryBarrier levelBarrier{};
+			levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			levelBarrier.image = m_depthPyramid->image.get();
+			levelBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			levelBarrier.subresourceRange.baseMipLevel = i - 1;
+			levelBarrier.subresourceRange.levelCount = 1;
+			levelBarrier.subresourceRange.layerCount = 1;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+
+			uint32_t levelWidth = std::max(m_depthPyramid->width >> i, 1u);
+			uint32_t levelHeight = std::max(m_depthPyramid->height >> i, 1u);
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_depthReducePipeline->pipelineLayout.get(), 0, 1,
+				&m_depthPyramid->reduceDescriptorSets[i - 1], 0, nullptr);
+			vkCmdDispatch(commandBuffer, (levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+		}
 
-				for (size_t j = 0; j < vulkanModel->model->meshes.size(); ++j)
-				{
-					VkBuffer vertexBuffers[] = { vulkanModel->meshVertexBuffers[j].m_vertexBuffer.get() };
-					VkDeviceSize offsets[] = { 0 };
+		m_depthPyramid->valid = true;
+	}
 
-					vkCmdBindVertexBuffers(commandBuffer.get(), 0, 1, vertexBuffers, offsets);
-					vkCmdBindIndexBuffer(commandBuffer.get(), vulkanModel->meshVertexBuffers[j].m_vertexBuffer.get(),
-						sizeof(vulkanModel->model->meshes[j].m_vertices[0]) * vulkanModel->model->meshes[j].m_vertices.size(), VK_INDEX_TYPE_UINT32);
+	void recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t currentFrame)
+	{
+		PushConstantIndirect pushConstant{};
+		pushConstant.viewProj = m_snapshot->input.projection * m_snapshot->input.view;
+		pushConstant.viewPos = glm::vec4(m_snapshot->input.cameraPosition, 1.0f);
 
-					vkCmdBindDescriptorSets(commandBuffer.get(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &vulkanModel->meshDescriptorSet[currentImage], 0, nullptr);
+		VkBuffer vertexBuffers[] = { m_gpuDriven->geometry.buffer.get() };
+		VkDeviceSize offsets[] = { 0 };
 
-					vkCmdDrawIndexed(commandBuffer.get(), utils::intCast<uint32_t>(vulkanModel->model->meshes[j].m_indices.size()), 1, 0, 0, 0);
-				}
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, m_gpuDriven->geometry.buffer.get(), m_gpuDriven->indexOffset, VK_INDEX_TYPE_UINT32);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayoutIndirect, 0, 1, &m_gpuDriven->descriptorSets[currentFrame], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, m_pipelineLayoutIndirect, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantIndirect), &pushConstant);
 
-				if (vkEndCommandBuffer(commandBuffer.get()))
-					throw std::runtime_error("failed to record command buffer!");
+		constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
 
+		VkBuffer drawCommands = gpuCulling() ? m_gpuDriven->culledCommands[currentFrame].buffer.get() : m_gpuDriven->drawCommands.buffer.get();
 
-				}, &m_models[i]);
+		for (const IndirectBatch& batch : m_gpuDriven->batches)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				m_pipelines->get(batch.simpleModel ? PipelineLibrary::SimpleIndirect : PipelineLibrary::Indirect));
 
-			futures.emplace_back(std::move(renderTask));
-		}
+			VkDeviceSize offset = VkDeviceSize{ batch.firstCommand } * stride;
 
-		for (auto& task : futures)
-		{
-			task.get();
+			if (m_multiDrawIndirect)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, drawCommands, offset, batch.commandCount, stride);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < batch.commandCount; ++i)
+					vkCmdDrawIndexedIndirect(commandBuffer, drawCommands, offset + VkDeviceSize{ i } * stride, 1, stride);
+			}
 		}
 	}
 
-	void updateCommandBuffers(uint32_t currentImage)
+	void setViewportAndScissor(VkCommandBuffer commandBuffer)
 	{
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // Optional
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+		VkViewport viewport{};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)m_swapChainExtent.width;
+		viewport.height = (float)m_swapChainExtent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
 
-		if (vkBeginCommandBuffer(m_commandBuffers[currentImage], &beginInfo))
-			throw std::runtime_error("failed to begin recording command buffer!");
+		VkRect2D scissor{};
+		scissor.offset = { 0, 0 };
+		scissor.extent = m_swapChainExtent;
 
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	void recordMainPass(const RenderGraph::PassContext& context)
+	{
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = m_renderPass;
-		renderPassInfo.framebuffer = m_swapChainFramebuffers[currentImage];
+		renderPassInfo.framebuffer = m_swapChainFramebuffers[context.imageIndex];
 		renderPassInfo.renderArea.offset = { 0, 0 };
 		renderPassInfo.renderArea.extent = m_swapChainExtent;
 
-		updateSecondaryCommandBuffers(currentImage);
-
 		std::array<VkClearValue, 2> clearValues{};
 		clearValues[0].color = VkClearColorValue{ 135 / 255.f, 206 / 255.f, 235 / 255.f };
 		clearValues[1].depthStencil = { 1.0f, 0 };
@@ -2405,41 +4682,157 @@ public:
 		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 		renderPassInfo.pClearValues = clearValues.data();
 
-		vkCmdBeginRenderPass(m_commandBuffers[currentImage], &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		if (m_settings.gpuDriven)
+		{
+			vkCmdBeginRenderPass(context.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+			setViewportAndScissor(context.commandBuffer);
 
-		std::vector<VkCommandBuffer> commandBuffers;
-		commandBuffers.reserve(m_models.size());
+			if (m_gpuDriven)
+				recordIndirectDraws(context.commandBuffer, context.frameIndex);
+		}
+		else
+		{
+			vkCmdBeginRenderPass(context.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		for (auto& threadData : m_threadData)
-			for(size_t i = 0; i < threadData.usedCommandBuffers; ++i)
-				commandBuffers.push_back(threadData.commandBuffers[currentImage][i].get());
+			// Batches are executed in model order, whichever worker recorded them
+			utils::FrameVector<VkCommandBuffer> commandBuffers;
+			commandBuffers.reserve(m_threadData.size());
+
+			for (auto& threadData : m_threadData)
+				commandBuffers.push_back(threadData.commandBuffers[context.frameIndex]);
+
+			if (!commandBuffers.empty())
+				vkCmdExecuteCommands(context.commandBuffer, utils::intCast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+		}
+
+		vkCmdEndRenderPass(context.commandBuffer);
+	}
+
+	// Per-frame resources are indexed by the frame in flight, only the framebuffer follows the acquired image.
+	// The secondary command buffers are already recorded by the batch stages of the frame graph
+	void recordPrimaryCommandBuffer(uint32_t currentFrame, uint32_t imageIndex)
+	{
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // Optional
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		if (vkBeginCommandBuffer(m_commandBuffers[currentFrame], &beginInfo))
+			throw std::runtime_error("failed to begin recording command buffer!");
+
+		if (m_timestampQueryPool)
+			vkCmdResetQueryPool(m_commandBuffers[currentFrame], m_timestampQueryPool, currentFrame, 1);
+
+		if (m_gpuDriven && asyncCompute())
+		{
+			recordFrameCompute(currentFrame);
+			acquireCullingResults(m_commandBuffers[currentFrame], currentFrame);
+		}
+
+		RenderGraph::PassContext context;
+		context.commandBuffer = m_commandBuffers[currentFrame];
+		context.frameIndex = currentFrame;
+		context.imageIndex = imageIndex;
 
-		vkCmdExecuteCommands(m_commandBuffers[currentImage], commandBuffers.size(), commandBuffers.data());
+		m_renderGraph->execute(context);
 
-		vkCmdEndRenderPass(m_commandBuffers[currentImage]);
+		if (m_timestampQueryPool)
+			vkCmdWriteTimestamp(m_commandBuffers[currentFrame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, currentFrame);
 
-		if (vkEndCommandBuffer(m_commandBuffers[currentImage]))
+		if (vkEndCommandBuffer(m_commandBuffers[currentFrame]))
 			throw std::runtime_error("failed to record command buffer!");
 	}
 
+	// Stages of a frame between acquire and present, run on the job system with the frame and image of drawFrame.
+	// Input stays on the main thread, GLFW only allows it there, and the simulation produces m_snapshot before the graph runs
+	void createFrameGraph()
+	{
+		auto primary = m_frameGraph.addNode("primary", [this] { recordPrimaryCommandBuffer(m_currentFrame, m_imageIndex); });
+		auto submit = m_frameGraph.addNode("submit", [this] { submitFrame(); });
+		m_frameGraph.addDependency(primary, submit);
+
+		if (m_settings.gpuDriven)
+		{
+			// Instance data goes to the GPU buffers, recording only references them
+			auto transforms = m_frameGraph.addNode("transforms", [this] { updateGpuDrivenTransforms(m_currentFrame); });
+			auto animation = m_frameGraph.addNode("animation", [this] { updateGpuDrivenBones(m_currentFrame); });
+
+			m_frameGraph.addDependency(transforms, submit);
+			m_frameGraph.addDependency(animation, submit);
+			return;
+		}
+
+		auto transforms = m_frameGraph.addNode("transforms", [this] { updateModelTransforms(m_currentFrame); });
+		auto animation = m_frameGraph.addNode("animation", [this] { updateModelAnimation(m_currentFrame); });
+
+		m_frameGraph.addDependency(animation, submit);
+
+		// Push constants are recorded by value, so the batches overlap with animation
+		for (size_t i = 0; i < m_threadData.size(); ++i)
+		{
+			auto batch = m_frameGraph.addNode("record batch", [this, i] { recordBatch(i); });
+
+			m_frameGraph.addDependency(transforms, batch);
+			m_frameGraph.addDependency(batch, primary);
+		}
+	}
+
+	// Attachment footprint at the current resolution and sample count, and the store bandwidth the DONT_CARE
+	// store ops save compared to storing every attachment
+	void printAttachmentMemory(double averageFps)
+	{
+		constexpr double mib = 1024.0 * 1024.0;
+
+		VkDeviceSize colorSize = multisampled() ? m_renderGraph->imageSize(m_colorTarget) : 0;
+		VkDeviceSize depthSize = m_renderGraph->imageSize(m_depthTarget);
+
+		VkDeviceSize storedSize = occlusionCulling() ? depthSize : 0;
+		VkDeviceSize storedSizeWithoutDontCare = colorSize + depthSize;
+
+		const auto& graphStats = m_renderGraph->statistics();
+
+		std::cout << "Vulkan attachments " << m_swapChainExtent.width << "x" << m_swapChainExtent.height << " x" << m_msaaSamples
+			<< " samples: MSAA color " << colorSize / mib << " MiB, depth " << depthSize / mib << " MiB, lazily allocated "
+			<< graphStats.lazilyAllocatedMemory / mib << " MiB (committed " << m_renderGraph->lazilyCommittedMemory() / mib << " MiB), device local "
+			<< graphStats.transientMemory / mib << " MiB; stored per frame " << storedSize / mib << " MiB instead of "
+			<< storedSizeWithoutDontCare / mib << " MiB, saving " << (storedSizeWithoutDontCare - storedSize) * averageFps / (mib * 1024.0) << " GiB/s" << std::endl;
+	}
+
 	// Rendering loop
 	double startRenderLoop(std::vector<ModelInfo> modelInfos)
 	{
 		init(std::move(modelInfos));
 
+		if (m_settings.pipelinedSimulation)
+			m_framePipeline = std::make_unique<utils::FramePipeline<RenderCommon::FrameInput, RenderCommon::FrameSnapshot>>(
+				[this](const RenderCommon::FrameInput& input, RenderCommon::FrameSnapshot& snapshot) { simulate(input, snapshot); },
+				[this] { m_jobSystem.attachThread(); },
+				[this] { m_jobSystem.detachThread(); });
+
 		std::uint64_t frameCount = 0;
 		auto startTime = glfwGetTime();
 		while (!glfwWindowShouldClose(m_window)) {		
 			if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 				break;
 
+			utils::FrameArena::local().reset();
+			m_allocationCheck.beginFrame();
+
+			if (lowLatency())
+				waitForPreviousFrame();
+
 			updateDeltaTime();
 			processInput();
 			showFPS();
 
+			// Doesn't touch GPU resources, so it runs before drawFrame waits for the frame's slot
+			nextSnapshot(sampleFrameInput());
+
 			drawFrame();
 			frameCount++;
 
+			m_allocationCheck.endFrame();
+
 			glfwPollEvents();
 
 			auto endSeconds = glfwGetTime();
@@ -2455,12 +4848,246 @@ public:
 
 		vkDeviceWaitIdle(m_device);
 
+		if (m_recordedFrames)
+			std::cout << "Vulkan average frame update, recording and submit time: " << m_recordSeconds * 1000.0 / m_recordedFrames << " ms, command pool reset: "
+				<< m_commandPoolResetSeconds * 1000.0 / m_recordedFrames << " ms ("
+				<< (m_settings.gpuDriven ? "GPU-driven indirect draws" : "secondary command buffers") << ")" << std::endl;
+
+		if (m_recordedFrames)
+		{
+			std::cout << "Vulkan frame graph, average ms per stage:";
+			for (const auto& stage : m_frameGraph.statistics())
+			{
+				std::cout << " " << stage.name;
+				if (stage.nodes > 1)
+					std::cout << " x" << stage.nodes;
+				std::cout << " " << stage.averageMs;
+			}
+			std::cout << "; whole graph " << m_frameGraph.averageRunMs() << std::endl;
+		}
+
+		if (!m_settings.gpuDriven)
+		{
+			std::cout << "Vulkan per-model descriptors: " << descriptorModeName(m_descriptorMode) << std::endl;
+			if (m_settings.scalingBenchmarks)
+				benchmarkDescriptorUpdates();
+		}
+
+		printPipelineStatistics();
+
+		const auto& graphStats = m_renderGraph->statistics();
+		std::cout << "Vulkan render graph: " << graphStats.passes << " passes (" << graphStats.culledPasses << " culled), "
+			<< graphStats.barrierBatches << " barrier batches with " << graphStats.imageBarriers << " image barriers, transient memory: "
+			<< graphStats.transientMemory / (1024.0 * 1024.0) << " MiB (" << graphStats.transientMemoryWithoutAliasing / (1024.0 * 1024.0)
+			<< " MiB without aliasing)" << std::endl;
+
+		printAttachmentMemory(averageFps);
+
+		std::cout << "Vulkan frames in flight: " << m_framesInFlight << " (" << (lowLatency() ? "low latency" : "max throughput")
+			<< "), present mode: " << presentModeName(m_presentMode) << ", swapchain images: " << m_swapChainImages.size() << std::endl;
+
+		if (m_swapChainRecreations)
+			std::cout << "Vulkan swapchain recreations: " << m_swapChainRecreations << ", average "
+				<< m_swapChainRecreateSeconds * 1000.0 / m_swapChainRecreations << " ms (old swapchains retired by the frame timeline)" << std::endl;
+
+		collectFrameLatencies();
+
+		if (m_recordedFrames)
+		{
+			std::cout << "Vulkan average input sample to submit latency: " << m_inputLatencySeconds * 1000.0 / m_recordedFrames << " ms, ";
+			if (m_framePipeline)
+				std::cout << "pipelined simulation: " << m_framePipeline->averageSimulateMs() << " ms per frame on its thread, main thread waited "
+					<< m_framePipeline->averageWaitMs() << " ms per frame" << std::endl;
+			else
+				std::cout << "lock-step simulation: " << m_simulateSeconds * 1000.0 / m_recordedFrames << " ms per frame" << std::endl;
+		}
+
+		if (utils::heapAllocationCounting && m_allocationCheck.steadyFrames())
+			std::cout << "Vulkan steady-state frames with heap allocations: " << m_allocationCheck.allocatingFrames() << " of "
+				<< m_allocationCheck.steadyFrames() << ", " << m_allocationCheck.allocations()
+				<< " allocations" << (enableValidationLayers ? " (validation layers allocate through the counted operator new too)" : "") << std::endl;
+
+		std::cout << "Vulkan average FPS: " << averageFps;
+		if (m_latencySamples)
+			std::cout << ", CPU submit to GPU complete latency: " << m_latencySeconds * 1000.0 / m_latencySamples << " ms"
+				<< (m_calibratedTimestamps ? " (calibrated GPU timestamps)" : " (timeline observation, upper bound)");
+		std::cout << std::endl;
+
+		if (m_culledFrames)
+			std::cout << "Vulkan " << (gpuCulling() ? (occlusionCulling() ? "compute frustum and occlusion culling, mesh instances" : "compute frustum culling, mesh instances")
+				: "frustum culling, models") << " per frame: " << m_drawnCount / m_culledFrames << " drawn, " << m_culledCount / m_culledFrames << " culled"
+				<< (asyncCompute() ? (computeOwnershipTransfers() ? " (dedicated compute queue)" : " (second graphics family queue)") : "") << std::endl;
+
+		if (!m_settings.gpuDriven)
+		{
+			RenderCommon::StateCache stateChanges;
+			for (auto& threadData : m_threadData)
+				stateChanges.merge(threadData.stateCache);
+
+			stateChanges.print(std::cout, "Vulkan", m_recordedFrames);
+		}
+
+		if (m_settings.scalingBenchmarks)
+		{
+			utils::benchmarkTaskThroughput(m_coreNumber);
+			benchmarkRecordingScaling();
+		}
+
+		// m_snapshot points into the pipeline, it's needed by the recording benchmark
+		m_snapshot = nullptr;
+		m_framePipeline.reset();
+
+		if (m_settings.scalingBenchmarks)
+			RenderCommon::benchmarkSimulationScaling("Vulkan", sampleFrameInput(), m_models, m_settings.frustumCulling && !m_settings.gpuDriven, true);
+
 		return averageFps;
 	}
 
+	// Called once the frame timeline has passed the frame, so none of its command buffers are pending
+	void resetFrameCommandPools()
+	{
+		auto resetStartTime = std::chrono::steady_clock::now();
+
+		for (auto& threadData : m_threadData)
+			vkResetCommandPool(m_device, threadData.commandPools[m_currentFrame].get(), 0);
+
+		m_commandPoolResetSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - resetStartTime).count();
+	}
+
+	// Low latency mode: input and animation are sampled only once the GPU is done, so the frame isn't queued behind older ones
+	void waitForPreviousFrame()
+	{
+		waitTimeline(m_frameTimeline, m_frameTimelineValue);
+	}
+
+	void markFrameSubmit()
+	{
+		auto& latency = m_frameLatencies[m_currentFrame];
+		latency.pending = true;
+
+		if (m_calibratedTimestamps)
+		{
+			VkCalibratedTimestampInfoEXT timestampInfo{};
+			timestampInfo.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+			timestampInfo.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+
+			uint64_t maxDeviation{};
+			vkGetCalibratedTimestampsEXT(m_device, 1, &timestampInfo, &latency.submitTimestamp, &maxDeviation);
+		}
+
+		latency.submitTime = std::chrono::steady_clock::now();
+
+		m_inputLatencySeconds += std::chrono::duration<double>(latency.submitTime - m_snapshot->input.sampleTime).count();
+	}
+
+	// Accounts every submitted frame the frame timeline has passed. With calibrated timestamps the latency is
+	// the GPU end-of-frame timestamp minus the GPU clock read at submit, otherwise it's the time until the CPU saw the timeline value
+	void collectFrameLatencies()
+	{
+		auto now = std::chrono::steady_clock::now();
+		uint64_t completedValue = timelineValue(m_frameTimeline);
+
+		for (uint32_t frame = 0; frame < m_framesInFlight; ++frame)
+		{
+			auto& latency = m_frameLatencies[frame];
+			if (!latency.pending || m_frameTimelineValues[frame] > completedValue)
+				continue;
+
+			if (m_calibratedTimestamps)
+			{
+				uint64_t endTimestamp{};
+				if (vkGetQueryPoolResults(m_device, m_timestampQueryPool, frame, 1, sizeof(endTimestamp), &endTimestamp,
+					sizeof(endTimestamp), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+					continue;
+
+				m_latencySeconds += static_cast<double>((endTimestamp - latency.submitTimestamp) & m_timestampMask) * m_timestampPeriod * 1e-9;
+			}
+			else
+			{
+				m_latencySeconds += std::chrono::duration<double>(now - latency.submitTime).count();
+			}
+
+			latency.pending = false;
+			++m_latencySamples;
+		}
+	}
+
+	// Signals the frame's render finished semaphore for present and the frame timeline
+	void submitFrame()
+	{
+		m_frameTimelineValues[m_currentFrame] = ++m_frameTimelineValue;
+
+		markFrameSubmit();
+
+		bool frameCompute = asyncCompute() && m_gpuDriven && gpuCulling();
+		if (frameCompute)
+			submitFrameCompute(m_currentFrame, m_frameTimelineValue);
+
+		// Values for the binary swapchain semaphore are ignored
+		utils::FrameVector<VkSemaphore> waitSemaphores = { m_imageAvailableSemaphores[m_currentFrame] };
+		utils::FrameVector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+		utils::FrameVector<uint64_t> waitValues = { 0 };
+
+		// The upload timeline is waited only when something was uploaded since the previous frame
+		if (m_uploadTimelineValue > m_uploadTimelineValueWaited)
+		{
+			waitSemaphores.push_back(m_uploadTimeline);
+			waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			waitValues.push_back(m_uploadTimelineValue);
+			m_uploadTimelineValueWaited = m_uploadTimelineValue;
+		}
+
+		// Indirect draws consume the culling results, the depth pyramid build overwrites what the culling pass read
+		if (frameCompute)
+		{
+			waitSemaphores.push_back(m_computeTimeline);
+			waitStages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			waitValues.push_back(m_frameTimelineValue);
+		}
+
+		VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame], m_frameTimeline };
+		std::array<uint64_t, 2> signalValues = { 0, m_frameTimelineValue };
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = utils::intCast<uint32_t>(waitValues.size());
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = utils::intCast<uint32_t>(signalValues.size());
+		timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+
+		submitInfo.waitSemaphoreCount = utils::intCast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &m_commandBuffers[m_currentFrame];
+
+		submitInfo.signalSemaphoreCount = utils::intCast<uint32_t>(signalValues.size());
+		submitInfo.pSignalSemaphores = signalSemaphores;
+
+		if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE))
+			throw std::runtime_error("failed to submit draw command buffer!");
+	}
+
 	void drawFrame() {
 		while (true)
 		{
+			waitTimeline(m_frameTimeline, m_frameTimelineValues[m_currentFrame]);
+
+			collectFrameLatencies();
+			releaseFinishedUploads();
+			releaseRetiredSwapChains();
+
+			if (m_gpuDriven && !m_gpuDriven->cullPyramidDescriptorsStale.empty() && m_gpuDriven->cullPyramidDescriptorsStale[m_currentFrame])
+			{
+				updateCullPyramidDescriptors(m_currentFrame);
+				m_gpuDriven->cullPyramidDescriptorsStale[m_currentFrame] = false;
+			}
+
 			uint32_t imageIndex{};
 			VkResult result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
 
@@ -2472,33 +5099,18 @@ public:
 				throw std::runtime_error("failed to acquire swap chain image!");
 			}
 
-			if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-				vkWaitForFences(m_device, 1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
-			}
-
-			m_imagesInFlight[imageIndex] = m_inFlightFences[m_currentFrame];
+			resetFrameCommandPools();
 
-			updateCommandBuffers(imageIndex);
+			m_imageIndex = imageIndex;
 
-			VkSubmitInfo submitInfo{};
-			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			auto recordStartTime = std::chrono::steady_clock::now();
 
-			VkSemaphore waitSemaphores[] = { m_imageAvailableSemaphores[m_currentFrame] };
-			VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-			submitInfo.waitSemaphoreCount = 1;
-			submitInfo.pWaitSemaphores = waitSemaphores;
-			submitInfo.pWaitDstStageMask = waitStages;
+			m_frameGraph.run(m_jobSystem);
 
-			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &m_commandBuffers[imageIndex];
+			m_recordSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - recordStartTime).count();
+			++m_recordedFrames;
 
 			VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame] };
-			submitInfo.signalSemaphoreCount = 1;
-			submitInfo.pSignalSemaphores = signalSemaphores;
-
-			vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
-			if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]))
-				throw std::runtime_error("failed to submit draw command buffer!");
 
 			VkPresentInfoKHR presentInfo{};
 			presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -2512,23 +5124,23 @@ public:
 			presentInfo.pResults = nullptr; // Optional
 			result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
 
+			// The frame is already submitted, the next one renders into the new swapchain
 			if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized) {
 				m_framebufferResized = false;
 				recreateSwapChain();
-				continue;
 			}
 			else if (result != VK_SUCCESS) {
 				throw std::runtime_error("failed to present swap chain image!");
 			}
 
-			m_currentFrame = (m_currentFrame + 1) % m_MAX_FRAMES_IN_FLIGHT;
+			m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
 			break;
 		}
 	}
 };
 
-RenderVulkan::RenderVulkan()
-	: m_impl{ std::make_unique<RenderVulkan::Impl>() }
+RenderVulkan::RenderVulkan(RenderSettings settings)
+	: m_impl{ std::make_unique<RenderVulkan::Impl>(settings) }
 {
 
 }
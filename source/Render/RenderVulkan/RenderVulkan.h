@@ -6,7 +6,7 @@
 class RenderVulkan : public IRender
 {
 public:
-	RenderVulkan();
+	RenderVulkan(RenderSettings settings = {});
 	~RenderVulkan();
 
 	double startRenderLoop(std::vector<ModelInfo> modelInfos) override;
@@ -0,0 +1,77 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define MAX_BONES 100
+
+struct ModelData {
+    mat4 model;
+};
+
+struct DrawInstance {
+    uint modelIndex;
+    uint textureIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ModelDataBuffer {
+    ModelData models[];
+};
+
+layout(std430, binding = 1) readonly buffer BoneBuffer {
+    mat4 gBones[];
+};
+
+layout(std430, binding = 2) readonly buffer DrawInstanceBuffer {
+    DrawInstance drawInstances[];
+};
+
+layout( push_constant ) uniform PushConstantIndirect {
+  mat4 viewProj;
+  vec4 viewPos;
+} pushConstant;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormals;
+layout(location = 2) in vec2 inTexCoord;
+
+
+layout (location = 3) in uvec4 aBoneIDs;
+layout (location = 4) in uvec4 aBoneIDs2;
+
+layout (location = 5) in vec4 aWeights;
+layout (location = 6) in vec4 aWeights2;
+
+
+layout(location = 0) out vec3 FragPos;
+layout(location = 1) out vec3 Normal;
+layout(location = 2) out vec2 TexCoords;
+layout(location = 3) out vec3 viewPos;
+layout(location = 4) flat out uint textureIndex;
+
+
+void main() {
+    // gl_InstanceIndex already includes firstInstance of the indirect command
+    DrawInstance drawInstance = drawInstances[gl_InstanceIndex];
+    mat4 model = models[drawInstance.modelIndex].model;
+    uint boneBase = drawInstance.modelIndex * MAX_BONES;
+
+    mat4 boneTransform = gBones[boneBase + aBoneIDs[0]] * aWeights[0];
+    boneTransform     += gBones[boneBase + aBoneIDs[1]] * aWeights[1];
+    boneTransform     += gBones[boneBase + aBoneIDs[2]] * aWeights[2];
+    boneTransform     += gBones[boneBase + aBoneIDs[3]] * aWeights[3];
+
+    boneTransform     += gBones[boneBase + aBoneIDs2[0]] * aWeights2[0];
+    boneTransform     += gBones[boneBase + aBoneIDs2[1]] * aWeights2[1];
+    boneTransform     += gBones[boneBase + aBoneIDs2[2]] * aWeights2[2];
+    boneTransform     += gBones[boneBase + aBoneIDs2[3]] * aWeights2[3];
+
+    gl_Position = pushConstant.viewProj * model * boneTransform * vec4(inPosition, 1.0);
+    TexCoords = inTexCoord;
+
+    FragPos = vec3(model * vec4(inPosition, 1.0));
+
+    vec4 NormalBone = boneTransform * vec4(inNormals, 0.0);
+    Normal = (model * NormalBone).xyz;
+
+    viewPos = pushConstant.viewPos.xyz;
+    textureIndex = drawInstance.textureIndex;
+}
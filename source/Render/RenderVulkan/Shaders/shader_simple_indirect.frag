@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define MAX_TEXTURES 16
+
+layout(location = 0) in vec3 FragPos;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 TexCoords;
+layout(location = 3) in vec3 viewPos;
+layout(location = 4) flat in uint textureIndex;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 3) uniform sampler2D textures[MAX_TEXTURES];
+
+void main() {
+    outColor = texture(textures[textureIndex], TexCoords);
+}
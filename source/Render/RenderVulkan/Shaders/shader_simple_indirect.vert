@@ -0,0 +1,48 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+struct ModelData {
+    mat4 model;
+};
+
+struct DrawInstance {
+    uint modelIndex;
+    uint textureIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ModelDataBuffer {
+    ModelData models[];
+};
+
+layout(std430, binding = 2) readonly buffer DrawInstanceBuffer {
+    DrawInstance drawInstances[];
+};
+
+layout( push_constant ) uniform PushConstantIndirect {
+  mat4 viewProj;
+  vec4 viewPos;
+} pushConstant;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormals;
+layout(location = 2) in vec2 inTexCoord;
+
+
+layout(location = 0) out vec3 FragPos;
+layout(location = 1) out vec3 Normal;
+layout(location = 2) out vec2 TexCoords;
+layout(location = 3) out vec3 viewPos;
+layout(location = 4) flat out uint textureIndex;
+
+
+void main() {
+    DrawInstance drawInstance = drawInstances[gl_InstanceIndex];
+    mat4 model = models[drawInstance.modelIndex].model;
+
+    gl_Position = pushConstant.viewProj * model * vec4(inPosition, 1.0);
+    TexCoords = inTexCoord;
+
+    Normal = inNormals;
+    viewPos = pushConstant.viewPos.xyz;
+    textureIndex = drawInstance.textureIndex;
+}
@@ -0,0 +1,192 @@
+#include "FrameArena.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#ifndef NDEBUG
+namespace
+{
+	std::atomic<std::uint64_t> g_heapAllocations{ 0 };
+
+	void* countedAllocate(std::size_t size)
+	{
+		g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		if (void* memory = std::malloc(size ? size : 1))
+			return memory;
+
+		throw std::bad_alloc{};
+	}
+
+	void* countedAllocate(std::size_t size, std::align_val_t alignment)
+	{
+		g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		auto align = static_cast<std::size_t>(alignment);
+		// aligned_alloc wants a multiple of the alignment
+		size = (std::max<std::size_t>(size, 1) + align - 1) & ~(align - 1);
+
+#ifdef _WIN32
+		void* memory = _aligned_malloc(size, align);
+#else
+		void* memory = std::aligned_alloc(align, size);
+#endif
+		if (memory)
+			return memory;
+
+		throw std::bad_alloc{};
+	}
+
+	void alignedFree(void* memory)
+	{
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		std::free(memory);
+#endif
+	}
+
+	template<class... Args>
+	void* countedAllocateNothrow(Args... args) noexcept
+	{
+		try
+		{
+			return countedAllocate(args...);
+		}
+		catch (const std::bad_alloc&)
+		{
+			return nullptr;
+		}
+	}
+}
+
+void* operator new(std::size_t size) { return countedAllocate(size); }
+void* operator new[](std::size_t size) { return countedAllocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocateNothrow(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocateNothrow(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+
+// Over-aligned types, _aligned_malloc memory can't go to free() on Windows
+void* operator new(std::size_t size, std::align_val_t alignment) { return countedAllocate(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return countedAllocate(size, alignment); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocateNothrow(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocateNothrow(size, alignment); }
+void operator delete(void* memory, std::align_val_t) noexcept { alignedFree(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { alignedFree(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { alignedFree(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { alignedFree(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { alignedFree(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { alignedFree(memory); }
+#endif
+
+namespace utils
+{
+	FrameArena::FrameArena(size_t blockSize) :
+		m_blockSize{ blockSize }
+	{
+		if (!blockSize)
+			throw std::runtime_error{ "FrameArena needs a non-zero block size" };
+	}
+
+	void* FrameArena::allocate(size_t size, size_t alignment)
+	{
+		if (alignment > alignof(std::max_align_t))
+			throw std::bad_alloc{};
+
+		for (; m_block < m_blocks.size(); ++m_block, m_offset = 0)
+		{
+			Block& block = m_blocks[m_block];
+
+			auto base = reinterpret_cast<std::uintptr_t>(block.data.get());
+			size_t offset = static_cast<size_t>(((base + m_offset + alignment - 1) & ~(std::uintptr_t(alignment) - 1)) - base);
+
+			if (offset <= block.size && size <= block.size - offset)
+			{
+				m_offset = offset + size;
+				return block.data.get() + offset;
+			}
+		}
+
+		// The frame outgrew the arena, blocks are doubled so a few are enough to reach the peak
+		size_t blockSize = std::max({ m_blockSize, size, capacity() });
+
+		Block block;
+		block.data = std::make_unique<unsigned char[]>(blockSize);
+		block.size = blockSize;
+		m_blocks.push_back(std::move(block));
+
+		m_offset = size;
+		return m_blocks.back().data.get();
+	}
+
+	void FrameArena::reset()
+	{
+		rewind(0, 0);
+	}
+
+	size_t FrameArena::capacity() const
+	{
+		size_t total = 0;
+		for (auto& block : m_blocks)
+			total += block.size;
+
+		return total;
+	}
+
+	FrameArena& FrameArena::local()
+	{
+		thread_local FrameArena arena;
+		return arena;
+	}
+
+	void FrameArena::rewind(size_t block, size_t offset)
+	{
+		m_block = block;
+		m_offset = offset;
+
+		if (block != 0 || offset != 0 || m_blocks.size() <= 1)
+			return;
+
+		size_t total = capacity();
+
+		m_blocks.clear();
+
+		Block merged;
+		merged.data = std::make_unique<unsigned char[]>(total);
+		merged.size = total;
+		m_blocks.push_back(std::move(merged));
+	}
+
+	std::uint64_t heapAllocationCount()
+	{
+#ifndef NDEBUG
+		return g_heapAllocations.load(std::memory_order_relaxed);
+#else
+		return 0;
+#endif
+	}
+
+	FrameArena::Scope::Scope(FrameArena& arena) :
+		m_arena{ arena },
+		m_block{ arena.m_block },
+		m_offset{ arena.m_offset }
+	{
+	}
+
+	FrameArena::Scope::~Scope()
+	{
+		m_arena.rewind(m_block, m_offset);
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace utils
+{
+	// Bump allocator for transient data of a frame. Every thread has its own arena, see local().
+	// Nothing is freed on its own: the owner of the frame loop resets its arena at frame start, jobs release
+	// what they allocated by closing a Scope. Once an arena has grown to the peak of a frame it doesn't touch
+	// the heap anymore
+	class FrameArena
+	{
+	public:
+		explicit FrameArena(size_t blockSize = 64 * 1024);
+
+		FrameArena(const FrameArena&) = delete;
+		FrameArena& operator=(const FrameArena&) = delete;
+
+		void* allocate(size_t size, size_t alignment);
+
+		// Frees everything. Blocks added during the frame are merged into one, so the next frame fits in it
+		void reset();
+
+		size_t capacity() const;
+
+		// Arena of the calling thread
+		static FrameArena& local();
+
+		// Releases everything allocated while it's open. Scopes nest
+		class Scope
+		{
+		public:
+			explicit Scope(FrameArena& arena = local());
+			~Scope();
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			FrameArena& m_arena;
+			size_t m_block;
+			size_t m_offset;
+		};
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<unsigned char[]> data;
+			size_t size = 0;
+		};
+
+		void rewind(size_t block, size_t offset);
+
+		std::vector<Block> m_blocks;
+		size_t m_blockSize;
+
+		// Bump position
+		size_t m_block = 0;
+		size_t m_offset = 0;
+	};
+
+	// Standard allocator on a FrameArena, deallocate is a no-op
+	template<class T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+
+		ArenaAllocator() noexcept : m_arena{ &FrameArena::local() } {}
+		explicit ArenaAllocator(FrameArena& arena) noexcept : m_arena{ &arena } {}
+
+		template<class U>
+		ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_arena{ other.arena() } {}
+
+		T* allocate(size_t count)
+		{
+			if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+				throw std::bad_alloc{};
+
+			return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T*, size_t) noexcept {}
+
+		FrameArena* arena() const noexcept { return m_arena; }
+
+		template<class U>
+		bool operator==(const ArenaAllocator<U>& other) const noexcept { return m_arena == other.arena(); }
+
+		template<class U>
+		bool operator!=(const ArenaAllocator<U>& other) const noexcept { return m_arena != other.arena(); }
+
+	private:
+		FrameArena* m_arena;
+	};
+
+	template<class T>
+	using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+#ifdef NDEBUG
+	constexpr bool heapAllocationCounting = false;
+#else
+	// Debug builds replace the global operator new to count calls, used to check that steady-state frames don't allocate
+	constexpr bool heapAllocationCounting = true;
+#endif
+
+	// Global operator new calls of all threads so far, always 0 without heapAllocationCounting
+	std::uint64_t heapAllocationCount();
+
+	// Counts the frames after the warm-up that still allocated from the heap, on any thread
+	class FrameAllocationCheck
+	{
+	public:
+		explicit FrameAllocationCheck(std::uint64_t warmupFrames = 100) : m_warmupFrames{ warmupFrames } {}
+
+		void beginFrame() { m_frameStart = heapAllocationCount(); }
+
+		void endFrame()
+		{
+			if (++m_frames <= m_warmupFrames)
+				return;
+
+			std::uint64_t allocations = heapAllocationCount() - m_frameStart;
+			if (allocations)
+			{
+				++m_allocatingFrames;
+				m_allocations += allocations;
+			}
+		}
+
+		std::uint64_t steadyFrames() const { return m_frames > m_warmupFrames ? m_frames - m_warmupFrames : 0; }
+		std::uint64_t allocatingFrames() const { return m_allocatingFrames; }
+		std::uint64_t allocations() const { return m_allocations; }
+
+	private:
+		std::uint64_t m_warmupFrames;
+		std::uint64_t m_frameStart = 0;
+		std::uint64_t m_frames = 0;
+		std::uint64_t m_allocatingFrames = 0;
+		std::uint64_t m_allocations = 0;
+	};
+}
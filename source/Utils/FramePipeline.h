@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+
+#include "FrameArena.h"
+
+namespace utils
+{
+	// Simulates frame N+1 on its own thread while the caller renders frame N. Snapshots are double-buffered:
+	// the one next() returns isn't touched until the following next() call
+	template<class Input, class Snapshot>
+	class FramePipeline
+	{
+	public:
+		using Simulate = std::function<void(const Input&, Snapshot&)>;
+
+		// threadInit and threadExit run on the simulation thread, e.g. to attach it to a job system
+		FramePipeline(Simulate simulate, std::function<void()> threadInit = {}, std::function<void()> threadExit = {}) :
+			m_simulate{ std::move(simulate) },
+			m_threadInit{ std::move(threadInit) },
+			m_threadExit{ std::move(threadExit) }
+		{
+			m_thread = std::thread{ [this] { threadLoop(); } };
+		}
+
+		~FramePipeline()
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_mutex };
+				m_stop = true;
+			}
+			m_condition.notify_all();
+			m_thread.join();
+		}
+
+		FramePipeline(const FramePipeline&) = delete;
+		FramePipeline& operator=(const FramePipeline&) = delete;
+
+		// Waits for the snapshot of the previous input and starts simulating input. The first call has nothing
+		// in flight yet, so it simulates input on the calling thread and returns it. The thread starts with the
+		// second call's input, that call returns the first snapshot once more
+		const Snapshot& next(const Input& input)
+		{
+			auto waitStart = std::chrono::steady_clock::now();
+
+			std::unique_lock<std::mutex> lock{ m_mutex };
+			m_condition.wait(lock, [this] { return !m_busy; });
+
+			m_waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+			++m_frames;
+
+			if (m_exception)
+				std::rethrow_exception(std::exchange(m_exception, nullptr));
+
+			if (m_frames == 1)
+			{
+				m_simulate(input, m_snapshots[m_front]);
+				return m_snapshots[m_front];
+			}
+
+			if (m_started)
+				m_front = 1 - m_front;
+
+			m_started = true;
+			m_input = input;
+			m_busy = true;
+			lock.unlock();
+			m_condition.notify_all();
+
+			return m_snapshots[m_front];
+		}
+
+		// Time next() blocked on the simulation thread, and the simulation time itself
+		double averageWaitMs() const { return m_frames ? m_waitSeconds * 1000.0 / m_frames : 0.0; }
+		double averageSimulateMs() const { return m_simulated ? m_simulateSeconds * 1000.0 / m_simulated : 0.0; }
+
+	private:
+		void threadLoop()
+		{
+			if (m_threadInit)
+				m_threadInit();
+
+			std::unique_lock<std::mutex> lock{ m_mutex };
+
+			while (true)
+			{
+				m_condition.wait(lock, [this] { return m_busy || m_stop; });
+				if (m_stop)
+					break;
+
+				Snapshot& back = m_snapshots[1 - m_front];
+				lock.unlock();
+
+				auto simulateStart = std::chrono::steady_clock::now();
+				std::exception_ptr exception;
+
+				try
+				{
+					FrameArena::Scope scope;
+					m_simulate(m_input, back);
+				}
+				catch (...)
+				{
+					exception = std::current_exception();
+				}
+
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - simulateStart).count();
+
+				lock.lock();
+				m_simulateSeconds += seconds;
+				++m_simulated;
+				m_exception = exception;
+				m_busy = false;
+				m_condition.notify_all();
+			}
+
+			lock.unlock();
+
+			if (m_threadExit)
+				m_threadExit();
+		}
+
+		Simulate m_simulate;
+		std::function<void()> m_threadInit;
+		std::function<void()> m_threadExit;
+
+		std::array<Snapshot, 2> m_snapshots;
+		int m_front = 0;
+		Input m_input{};
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_busy = false;
+		bool m_started = false;
+		bool m_stop = false;
+		std::exception_ptr m_exception;
+
+		double m_waitSeconds = 0;
+		double m_simulateSeconds = 0;
+		std::uint64_t m_frames = 0;
+		std::uint64_t m_simulated = 0;
+
+		std::thread m_thread;
+	};
+}
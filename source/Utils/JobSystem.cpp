@@ -0,0 +1,531 @@
+#include "JobSystem.h"
+#include "Utils.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace utils
+{
+	namespace
+	{
+		// Rounds of cpuRelax before a worker parks, and before a waiting thread starts yielding
+		constexpr int SpinCount = 2000;
+
+		thread_local const JobSystem* t_jobSystem = nullptr;
+		thread_local int t_threadIndex = -1;
+
+		void cpuRelax()
+		{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+			_mm_pause();
+#else
+			std::this_thread::yield();
+#endif
+		}
+
+		// Best effort, the thread keeps running anywhere when the platform refuses
+		void pinThread(std::thread& thread, size_t cpu)
+		{
+#if defined(_WIN32)
+			SetThreadAffinityMask(thread.native_handle(), DWORD_PTR{ 1 } << (cpu % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu % CPU_SETSIZE, &cpus);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+			(void)thread;
+			(void)cpu;
+#endif
+		}
+
+		size_t hardwareThreads()
+		{
+			return std::max(std::thread::hardware_concurrency(), 1u);
+		}
+	}
+
+	JobDeque::JobDeque() :
+		m_jobs{ std::make_unique<Slot[]>(Capacity) }
+	{
+	}
+
+	void JobDeque::store(int64_t index, const Job& job)
+	{
+		std::array<std::uint64_t, sizeof(Job) / sizeof(std::uint64_t)> words;
+		std::memcpy(words.data(), &job, sizeof(Job));
+
+		Slot& slot = m_jobs[index & (Capacity - 1)];
+		for (size_t i = 0; i < words.size(); ++i)
+			slot.words[i].store(words[i], std::memory_order_relaxed);
+	}
+
+	Job JobDeque::load(int64_t index) const
+	{
+		std::array<std::uint64_t, sizeof(Job) / sizeof(std::uint64_t)> words;
+
+		const Slot& slot = m_jobs[index & (Capacity - 1)];
+		for (size_t i = 0; i < words.size(); ++i)
+			words[i] = slot.words[i].load(std::memory_order_relaxed);
+
+		Job job;
+		std::memcpy(static_cast<void*>(&job), words.data(), sizeof(Job));
+		return job;
+	}
+
+	bool JobDeque::push(const Job& job)
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t top = m_top.load(std::memory_order_acquire);
+
+		if (bottom - top >= Capacity)
+			return false;
+
+		store(bottom, job);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	bool JobDeque::pop(Job& job)
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		job = load(bottom);
+
+		if (top < bottom)
+			return true;
+
+		// Last job, races with the thieves for it
+		bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+		return won;
+	}
+
+	bool JobDeque::steal(Job& job)
+	{
+		int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom)
+			return false;
+
+		// The owner may be rewriting the slot once another thief took it, the copy is dropped then as the CAS fails
+		Job stolen = load(top);
+
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+
+		job = stolen;
+		return true;
+	}
+
+	JobSystem::JobSystem(size_t threads, size_t clientThreads) :
+		JobSystem{ JobSystemConfig{ threads, clientThreads } }
+	{
+	}
+
+	JobSystem::JobSystem(const JobSystemConfig& config) :
+		m_ownerThread{ std::this_thread::get_id() }
+	{
+		size_t threads = config.workers ? config.workers : hardwareThreads();
+
+		// One deque per worker, then the owner thread and the attached threads
+		size_t clientThreads = std::max(config.clientThreads, size_t{ 1 });
+		for (auto& deques : m_deques)
+		{
+			for (size_t i = 0; i < threads + clientThreads; ++i)
+				deques.push_back(std::make_unique<JobDeque>());
+		}
+
+		m_clientSlots.assign(clientThreads, false);
+		m_clientSlots[0] = true;
+
+		// At least one worker stays free for frame jobs, see backgroundLimit for a single worker
+		m_backgroundWorkers = static_cast<int>(threads - 1);
+
+		for (size_t i = 0; i < threads; ++i)
+		{
+			m_workers.emplace_back([this, i] { workerLoop(static_cast<int>(i)); });
+
+			if (config.pinWorkers)
+				pinThread(m_workers.back(), (i + 1) % hardwareThreads());
+		}
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_sleepMutex };
+			m_stop = true;
+		}
+		m_wakeCondition.notify_all();
+
+		for (auto& worker : m_workers)
+			worker.join();
+	}
+
+	size_t JobSystem::chunkSize(size_t count, size_t grainSize) const
+	{
+		constexpr size_t ChunksPerThread = 4;
+
+		size_t maxChunks = m_deques[0].size() * ChunksPerThread;
+		return std::max({ grainSize, (count + maxChunks - 1) / maxChunks, size_t{ 1 } });
+	}
+
+	void JobSystem::attachThread()
+	{
+		if (localIndex() >= 0)
+			throw std::runtime_error{ "thread is already attached to the job system" };
+
+		std::lock_guard<std::mutex> lock{ m_clientMutex };
+
+		auto slot = std::find(m_clientSlots.begin(), m_clientSlots.end(), false);
+		if (slot == m_clientSlots.end())
+			throw std::runtime_error{ "no free client slot in the job system" };
+
+		*slot = true;
+		t_jobSystem = this;
+		t_threadIndex = static_cast<int>(m_workers.size() + (slot - m_clientSlots.begin()));
+	}
+
+	void JobSystem::detachThread()
+	{
+		if (t_jobSystem != this || t_threadIndex < static_cast<int>(m_workers.size()))
+			throw std::runtime_error{ "thread isn't attached to the job system" };
+
+		std::lock_guard<std::mutex> lock{ m_clientMutex };
+
+		m_clientSlots[t_threadIndex - m_workers.size()] = false;
+		t_jobSystem = nullptr;
+		t_threadIndex = -1;
+	}
+
+	int JobSystem::localIndex() const
+	{
+		if (t_jobSystem == this)
+			return t_threadIndex;
+
+		if (std::this_thread::get_id() == m_ownerThread)
+			return static_cast<int>(m_workers.size());
+
+		return -1;
+	}
+
+	int JobSystem::threadIndex() const
+	{
+		int index = localIndex();
+		if (index < 0)
+			throw std::runtime_error{ "Invalid thread for threadIndex" };
+
+		return index;
+	}
+
+	void JobSystem::submit(const Job& job, JobPriority priority)
+	{
+		int index = localIndex();
+		if (index < 0)
+			throw std::runtime_error{ "job submitted from a thread that doesn't belong to the job system" };
+
+		size_t lane = static_cast<size_t>(priority);
+
+		// A full deque means the others are far behind anyway. A frame job runs right here, the caller waits for it
+		// soon. Background jobs never run on a client thread, they wait in the overflow queue for a worker
+		if (!m_deques[lane][index]->push(job))
+		{
+			if (priority == JobPriority::Frame)
+			{
+				execute(job);
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock{ m_overflowMutex };
+			m_backgroundOverflow.push_back(job);
+		}
+
+		m_queuedJobs[lane].fetch_add(1);
+
+		// Taking the mutex orders the notification after a worker that is about to park has checked m_queuedJobs
+		if (m_sleepingWorkers.load() > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_sleepMutex };
+			}
+			m_wakeCondition.notify_one();
+		}
+	}
+
+	bool JobSystem::tryRunJob(int index, JobPriority priority)
+	{
+		size_t lane = static_cast<size_t>(priority);
+		auto& deques = m_deques[lane];
+
+		Job job;
+		bool found = deques[index]->pop(job);
+
+		for (size_t i = 1; !found && i < deques.size(); ++i)
+			found = deques[(index + i) % deques.size()]->steal(job);
+
+		if (!found && priority == JobPriority::Background)
+		{
+			std::lock_guard<std::mutex> lock{ m_overflowMutex };
+			if (!m_backgroundOverflow.empty())
+			{
+				job = m_backgroundOverflow.front();
+				m_backgroundOverflow.pop_front();
+				found = true;
+			}
+		}
+
+		if (!found)
+			return false;
+
+		m_queuedJobs[lane].fetch_sub(1);
+		execute(job);
+
+		return true;
+	}
+
+	bool JobSystem::workerHasWork() const
+	{
+		return m_queuedJobs[static_cast<size_t>(JobPriority::Frame)].load() > 0 ||
+			(m_queuedJobs[static_cast<size_t>(JobPriority::Background)].load() > 0 && m_runningBackgroundJobs.load() < backgroundLimit());
+	}
+
+	int JobSystem::backgroundLimit() const
+	{
+		if (m_backgroundWorkers > 0)
+			return m_backgroundWorkers;
+
+		return m_waitingThreads.load() == 0 ? 1 : 0;
+	}
+
+	void JobSystem::execute(const Job& job)
+	{
+		JobCounter* counter = job.counter();
+
+		try
+		{
+			FrameArena::Scope scope;
+			job();
+		}
+		catch (...)
+		{
+			if (!counter)
+				throw;
+
+			if (!counter->m_failed.exchange(true))
+				counter->m_exception = std::current_exception();
+		}
+
+		if (counter)
+			counter->m_pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	void JobSystem::wait(JobCounter& counter)
+	{
+		int index = localIndex();
+		int idleRounds = 0;
+
+		m_waitingThreads.fetch_add(1);
+
+		while (!counter.done())
+		{
+			if (index >= 0 && tryRunJob(index, JobPriority::Frame))
+			{
+				idleRounds = 0;
+				continue;
+			}
+
+			if (++idleRounds < SpinCount)
+				cpuRelax();
+			else
+				std::this_thread::yield();
+		}
+
+		// The last waiter leaving is an idle point for a single worker with background jobs queued
+		if (m_waitingThreads.fetch_sub(1) == 1 && m_backgroundWorkers == 0 && m_sleepingWorkers.load() > 0 &&
+			m_queuedJobs[static_cast<size_t>(JobPriority::Background)].load() > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_sleepMutex };
+			}
+			m_wakeCondition.notify_one();
+		}
+
+		if (counter.m_failed)
+		{
+			auto exception = std::exchange(counter.m_exception, nullptr);
+			counter.m_failed = false;
+			std::rethrow_exception(exception);
+		}
+	}
+
+	void JobSystem::workerLoop(int index)
+	{
+		t_jobSystem = this;
+		t_threadIndex = index;
+
+		while (true)
+		{
+			if (tryRunJob(index, JobPriority::Frame))
+				continue;
+
+			// A background job is taken only while the limit leaves a worker for frame jobs
+			if (m_runningBackgroundJobs.fetch_add(1) < backgroundLimit())
+			{
+				bool ran = tryRunJob(index, JobPriority::Background);
+				m_runningBackgroundJobs.fetch_sub(1);
+
+				if (ran)
+					continue;
+			}
+			else
+			{
+				m_runningBackgroundJobs.fetch_sub(1);
+			}
+
+			int spin = 0;
+			while (spin < SpinCount && !workerHasWork() && !m_stop.load(std::memory_order_relaxed))
+			{
+				cpuRelax();
+				++spin;
+			}
+
+			if (spin < SpinCount && !m_stop)
+				continue;
+
+			std::unique_lock<std::mutex> lock{ m_sleepMutex };
+
+			if (m_stop && m_queuedJobs[0].load() == 0 && m_queuedJobs[1].load() == 0)
+				return;
+
+			m_sleepingWorkers.fetch_add(1);
+			m_wakeCondition.wait(lock, [this] { return workerHasWork() || m_stop; });
+			m_sleepingWorkers.fetch_sub(1);
+		}
+	}
+
+	JobSystem& sharedJobSystem(JobSystemConfig config)
+	{
+		static std::unique_ptr<JobSystem> jobSystem;
+		static JobSystemConfig jobSystemConfig;
+
+		if (!config.workers)
+			config.workers = hardwareThreads();
+
+		if (!jobSystem || !(config == jobSystemConfig))
+		{
+			jobSystem.reset();
+			jobSystem = std::make_unique<JobSystem>(config);
+			jobSystemConfig = config;
+		}
+
+		return *jobSystem;
+	}
+
+	std::vector<size_t> workerCountSweep(size_t maxWorkers)
+	{
+		std::vector<size_t> counts;
+
+		for (size_t workers = 1; workers < maxWorkers; workers += workers < 8 ? 1 : 4)
+			counts.push_back(workers);
+
+		counts.push_back(std::max(maxWorkers, size_t{ 1 }));
+		return counts;
+	}
+
+	size_t scalingKnee(const std::vector<std::pair<size_t, double>>& msByWorkers)
+	{
+		if (msByWorkers.empty())
+			return 0;
+
+		double fastest = std::min_element(msByWorkers.begin(), msByWorkers.end(),
+			[](const auto& a, const auto& b) { return a.second < b.second; })->second;
+
+		for (auto& [workers, ms] : msByWorkers)
+		{
+			if (ms <= fastest * 1.1)
+				return workers;
+		}
+
+		return msByWorkers.back().first;
+	}
+
+	void benchmarkTaskThroughput(size_t threads)
+	{
+		constexpr int batches = 200;
+		constexpr int batchSize = 1000;
+
+		std::atomic<int64_t> sum{ 0 };
+		auto work = [&sum](int value) { sum.fetch_add(value, std::memory_order_relaxed); };
+
+		auto measure = [](auto&& runBatch) {
+			auto start = std::chrono::steady_clock::now();
+
+			for (int batch = 0; batch < batches; ++batch)
+				runBatch();
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return batches * double(batchSize) / seconds / 1e6;
+		};
+
+		double poolThroughput = 0;
+		{
+			ThreadPool pool{ threads };
+			std::vector<std::future<void>> futures;
+			futures.reserve(batchSize);
+
+			poolThroughput = measure([&] {
+				futures.clear();
+				for (int i = 0; i < batchSize; ++i)
+					futures.push_back(pool.enqueue(work, i));
+
+				for (auto& future : futures)
+					future.get();
+			});
+		}
+
+		double jobThroughput = 0;
+		{
+			JobSystem jobs{ threads };
+
+			jobThroughput = measure([&] {
+				JobCounter counter;
+				for (int i = 0; i < batchSize; ++i)
+					jobs.schedule(counter, [&work, i] { work(i); });
+
+				jobs.wait(counter);
+			});
+		}
+
+		std::cout << "Task throughput with " << threads << " workers (" << batches << " batches of " << batchSize << " tasks): ThreadPool "
+			<< poolThroughput << " M tasks/s, JobSystem " << jobThroughput << " M tasks/s" << std::endl;
+	}
+}
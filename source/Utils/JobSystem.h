@@ -0,0 +1,301 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <utility>
+
+#include "FrameArena.h"
+
+namespace utils
+{
+	// Number of unfinished jobs of a group
+	class JobCounter
+	{
+	public:
+		JobCounter() = default;
+		JobCounter(const JobCounter&) = delete;
+		JobCounter& operator=(const JobCounter&) = delete;
+
+		bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class JobSystem;
+
+		std::atomic<int> m_pending{ 0 };
+		std::atomic<bool> m_failed{ false };
+		// First exception thrown by a job of the group, rethrown by JobSystem::wait
+		std::exception_ptr m_exception;
+	};
+
+	// Callable stored in place: scheduling a job never allocates, and the deques copy jobs as plain bytes
+	class Job
+	{
+	public:
+		static constexpr size_t StorageSize = 48;
+
+		Job() = default;
+
+		template<class F>
+		Job(const F& function, JobCounter* counter) :
+			m_invoke{ [](const void* storage) { (*static_cast<const F*>(storage))(); } },
+			m_counter{ counter }
+		{
+			static_assert(sizeof(F) <= StorageSize, "job callable is too large, capture by reference or pointer");
+			static_assert(alignof(F) <= alignof(std::max_align_t), "job callable is overaligned");
+			static_assert(std::is_trivially_copyable_v<F>, "job callable must be trivially copyable");
+
+			std::memcpy(m_storage, &function, sizeof(F));
+		}
+
+		void operator()() const { m_invoke(m_storage); }
+		JobCounter* counter() const { return m_counter; }
+
+	private:
+		alignas(std::max_align_t) unsigned char m_storage[StorageSize]{};
+		void (*m_invoke)(const void*) = nullptr;
+		JobCounter* m_counter = nullptr;
+	};
+
+	static_assert(std::is_trivially_copyable_v<Job> && sizeof(Job) % sizeof(std::uint64_t) == 0, "jobs are copied as atomic words");
+
+	// Chase-Lev deque of fixed capacity: the owner pushes and pops at the bottom, other threads steal from the top
+	class JobDeque
+	{
+	public:
+		static constexpr int64_t Capacity = 4096;
+
+		JobDeque();
+
+		// Owner thread only, false when full
+		bool push(const Job& job);
+		bool pop(Job& job);
+
+		// Any thread
+		bool steal(Job& job);
+
+	private:
+		static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+		// A thief with a stale top may read a slot while the owner rewrites it after wraparound. Slots are words
+		// accessed with relaxed atomics, as in the C11 version of the algorithm, so that read isn't a data race;
+		// the thief's CAS fails and the torn copy is never run
+		struct Slot
+		{
+			std::array<std::atomic<std::uint64_t>, sizeof(Job) / sizeof(std::uint64_t)> words;
+		};
+
+		void store(int64_t index, const Job& job);
+		Job load(int64_t index) const;
+
+		alignas(64) std::atomic<int64_t> m_top{ 0 };
+		alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+		std::unique_ptr<Slot[]> m_jobs;
+	};
+
+	// Frame jobs are what a frame waits for. Background jobs (loading, pipeline compilation) run only on workers,
+	// once no frame job is queued, and never on all workers at once. A single worker can't be split, it runs them
+	// only at idle points, while no thread waits for frame jobs
+	enum class JobPriority { Frame, Background, Count };
+
+	struct JobSystemConfig
+	{
+		// 0 - one per hardware thread
+		size_t workers = 0;
+		// The creating thread and the threads that may attach
+		size_t clientThreads = 1;
+		// Worker i runs only on CPU (i + 1) % CPU count, CPU 0 is left to the main thread
+		bool pinWorkers = false;
+
+		bool operator==(const JobSystemConfig& other) const
+		{
+			return workers == other.workers && clientThreads == other.clientThreads && pinWorkers == other.pinWorkers;
+		}
+	};
+
+	// Work-stealing scheduler. Every worker owns a deque per priority, idle workers steal from the others, spin
+	// for a while and then park on a condition variable. The thread that created the system owns deques too, so it
+	// can schedule jobs and run frame jobs while it waits. Up to clientThreads - 1 other threads can do the same once attached
+	class JobSystem
+	{
+	public:
+		// threads 0 - one per hardware thread
+		explicit JobSystem(size_t threads, size_t clientThreads = 1);
+		explicit JobSystem(const JobSystemConfig& config);
+		~JobSystem();
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		// function is copied into the job, see Job for the requirements. The job's FrameArena allocations are
+		// released once it returns
+		template<class F>
+		void schedule(JobCounter& counter, const F& function, JobPriority priority = JobPriority::Frame);
+
+		// Runs frame jobs until all jobs of the counter are finished, then rethrows the first exception one of them threw
+		void wait(JobCounter& counter);
+
+		// Splits [begin, end) into chunks of at least grainSize elements, calls function(chunkBegin, chunkEnd) for every
+		// chunk and returns once all of them are done. The calling thread runs the first chunk and helps with the rest
+		template<class F>
+		void parallelFor(size_t begin, size_t end, size_t grainSize, const F& function);
+
+		// Like parallelFor, function(chunkBegin, chunkEnd) returns the chunk's result.
+		// Results are combined in chunk order, starting from identity. Chunk results live in the calling thread's FrameArena
+		template<class T, class F, class C>
+		T parallelReduce(size_t begin, size_t end, size_t grainSize, T identity, const F& function, const C& combine);
+
+		// One-off task with a result. Allocates the task and its shared state, so it's not meant for per-frame work
+		template<class F>
+		auto enqueue(F&& function, JobPriority priority = JobPriority::Frame) -> std::future<std::invoke_result_t<std::decay_t<F>>>;
+
+		// Gives the calling thread a deque of its own. Detach before the thread exits, its jobs must be waited for
+		void attachThread();
+		void detachThread();
+
+		size_t workerCount() const { return m_workers.size(); }
+
+		// Worker index, workerCount() for the creating thread and above it for attached threads
+		int threadIndex() const;
+
+	private:
+		// Enough chunks for every thread to steal a few, none smaller than grainSize
+		size_t chunkSize(size_t count, size_t grainSize) const;
+
+		static constexpr size_t PriorityCount = static_cast<size_t>(JobPriority::Count);
+
+		int localIndex() const;
+		void submit(const Job& job, JobPriority priority);
+		bool tryRunJob(int index, JobPriority priority);
+		void execute(const Job& job);
+		void workerLoop(int index);
+		bool workerHasWork() const;
+		int backgroundLimit() const;
+
+		// Indexed by priority, then by thread: workers first, then the clients
+		std::array<std::vector<std::unique_ptr<JobDeque>>, PriorityCount> m_deques;
+		std::vector<std::thread> m_workers;
+		std::thread::id m_ownerThread;
+
+		// Deques after the workers' ones, the first belongs to the creating thread
+		std::mutex m_clientMutex;
+		std::vector<bool> m_clientSlots;
+
+		// Jobs sitting in the deques by priority, workers park only when there is nothing they may run
+		std::array<std::atomic<int>, PriorityCount> m_queuedJobs{};
+		// Background jobs that didn't fit into a full deque, taken after the deques. Counted in m_queuedJobs too
+		std::mutex m_overflowMutex;
+		std::deque<Job> m_backgroundOverflow;
+		std::atomic<int> m_runningBackgroundJobs{ 0 };
+		int m_backgroundWorkers = 0;
+		// Threads inside wait(), a frame is in progress while there are any
+		std::atomic<int> m_waitingThreads{ 0 };
+		std::atomic<int> m_sleepingWorkers{ 0 };
+		std::atomic<bool> m_stop{ false };
+
+		std::mutex m_sleepMutex;
+		std::condition_variable m_wakeCondition;
+	};
+
+	template<class F>
+	void JobSystem::schedule(JobCounter& counter, const F& function, JobPriority priority)
+	{
+		counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+		submit(Job{ function, &counter }, priority);
+	}
+
+	template<class F>
+	void JobSystem::parallelFor(size_t begin, size_t end, size_t grainSize, const F& function)
+	{
+		if (begin >= end)
+			return;
+
+		size_t size = chunkSize(end - begin, grainSize);
+		JobCounter counter;
+
+		for (size_t chunkBegin = begin + size; chunkBegin < end; chunkBegin += size)
+		{
+			size_t chunkEnd = std::min(chunkBegin + size, end);
+			schedule(counter, [&function, chunkBegin, chunkEnd] { function(chunkBegin, chunkEnd); });
+		}
+
+		// The scheduled chunks reference function, so they are waited for even if the first one throws
+		std::exception_ptr exception;
+		try
+		{
+			function(begin, std::min(begin + size, end));
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+
+		wait(counter);
+
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	template<class T, class F, class C>
+	T JobSystem::parallelReduce(size_t begin, size_t end, size_t grainSize, T identity, const F& function, const C& combine)
+	{
+		if (begin >= end)
+			return identity;
+
+		size_t size = chunkSize(end - begin, grainSize);
+
+		FrameArena::Scope scope;
+		FrameVector<T> results((end - begin + size - 1) / size, identity);
+
+		parallelFor(begin, end, size, [&](size_t chunkBegin, size_t chunkEnd) {
+			results[(chunkBegin - begin) / size] = function(chunkBegin, chunkEnd);
+		});
+
+		T result = std::move(identity);
+		for (auto& chunkResult : results)
+			result = combine(std::move(result), std::move(chunkResult));
+
+		return result;
+	}
+
+	template<class F>
+	auto JobSystem::enqueue(F&& function, JobPriority priority) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+	{
+		using Task = std::packaged_task<std::invoke_result_t<std::decay_t<F>>()>;
+
+		auto task = std::make_unique<Task>(std::forward<F>(function));
+		auto result = task->get_future();
+
+		// Once submitted the job owns the task, it may already have run and freed it when submit returns
+		Task* rawTask = task.get();
+		submit(Job{ [rawTask] { std::unique_ptr<Task> ownedTask{ rawTask }; (*ownedTask)(); }, nullptr }, priority);
+		task.release();
+
+		return result;
+	}
+
+	// One job system for the whole process, so the workers survive from one benchmark run to the next. Recreated
+	// only when config changes, its previous users must be gone then. Main thread only
+	JobSystem& sharedJobSystem(JobSystemConfig config);
+
+	// Worker counts for scaling benchmarks: every count up to 8, then steps of 4, always ending with maxWorkers
+	std::vector<size_t> workerCountSweep(size_t maxWorkers);
+
+	// Smallest worker count within 10% of the fastest time, where adding workers stops paying off
+	size_t scalingKnee(const std::vector<std::pair<size_t, double>>& msByWorkers);
+
+	// Prints how many small tasks per second utils::ThreadPool and JobSystem get through with the same worker count
+	void benchmarkTaskThroughput(size_t threads);
+}
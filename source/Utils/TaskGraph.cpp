@@ -0,0 +1,87 @@
+#include "TaskGraph.h"
+
+#include <chrono>
+#include <map>
+#include <stdexcept>
+
+namespace utils
+{
+	TaskGraph::NodeId TaskGraph::addNode(std::string name, std::function<void()> work)
+	{
+		m_nodes.emplace_back();
+		m_nodes.back().name = std::move(name);
+		m_nodes.back().work = std::move(work);
+
+		return static_cast<NodeId>(m_nodes.size() - 1);
+	}
+
+	void TaskGraph::addDependency(NodeId before, NodeId after)
+	{
+		if (before >= m_nodes.size() || after >= m_nodes.size() || before == after)
+			throw std::runtime_error{ "invalid task graph dependency" };
+
+		m_nodes[before].successors.push_back(after);
+		++m_nodes[after].dependencies;
+	}
+
+	void TaskGraph::run(JobSystem& jobs)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (auto& node : m_nodes)
+			node.remaining.store(node.dependencies, std::memory_order_relaxed);
+
+		JobCounter counter;
+
+		for (NodeId id = 0; id < m_nodes.size(); ++id)
+		{
+			if (m_nodes[id].dependencies == 0)
+				jobs.schedule(counter, [this, &jobs, &counter, id] { runNode(jobs, counter, id); });
+		}
+
+		jobs.wait(counter);
+
+		m_runSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		++m_runs;
+	}
+
+	void TaskGraph::runNode(JobSystem& jobs, JobCounter& counter, NodeId id)
+	{
+		Node& node = m_nodes[id];
+
+		auto start = std::chrono::steady_clock::now();
+		node.work();
+		node.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		for (NodeId successor : node.successors)
+		{
+			if (m_nodes[successor].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				jobs.schedule(counter, [this, &jobs, &counter, successor] { runNode(jobs, counter, successor); });
+		}
+	}
+
+	std::vector<TaskGraph::NodeStatistics> TaskGraph::statistics() const
+	{
+		std::vector<NodeStatistics> result;
+		std::map<std::string, size_t> indices;
+
+		for (auto& node : m_nodes)
+		{
+			auto [it, inserted] = indices.emplace(node.name, result.size());
+			if (inserted)
+				result.push_back({ node.name });
+
+			auto& statistics = result[it->second];
+			++statistics.nodes;
+			if (m_runs)
+				statistics.averageMs += node.seconds * 1000.0 / m_runs;
+		}
+
+		return result;
+	}
+
+	double TaskGraph::averageRunMs() const
+	{
+		return m_runs ? m_runSeconds * 1000.0 / m_runs : 0.0;
+	}
+}
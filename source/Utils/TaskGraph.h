@@ -0,0 +1,63 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+namespace utils
+{
+	// Nodes with dependencies, built once and run on a JobSystem as many times as needed, e.g. once per frame.
+	// A node is scheduled as soon as its last dependency finishes, run() returns once every node is done.
+	// Node work may use the job system itself, e.g. parallelFor
+	class TaskGraph
+	{
+	public:
+		using NodeId = uint32_t;
+
+		NodeId addNode(std::string name, std::function<void()> work);
+
+		// after starts only once before is finished
+		void addDependency(NodeId before, NodeId after);
+
+		// On the thread that created jobs. Rethrows the first exception a node threw, its successors are skipped then
+		void run(JobSystem& jobs);
+
+		// Nodes with the same name are reported together, e.g. one node per recording batch
+		struct NodeStatistics
+		{
+			std::string name;
+			uint32_t nodes = 0;
+			double averageMs = 0;
+		};
+
+		std::vector<NodeStatistics> statistics() const;
+
+		// Average wall time of run(), shorter than the sum of the nodes when they overlap
+		double averageRunMs() const;
+
+	private:
+		struct Node
+		{
+			std::string name;
+			std::function<void()> work;
+			std::vector<NodeId> successors;
+			int dependencies = 0;
+
+			std::atomic<int> remaining{ 0 };
+			double seconds = 0;
+		};
+
+		void runNode(JobSystem& jobs, JobCounter& counter, NodeId id);
+
+		// Deque keeps the nodes in place, they hold atomics
+		std::deque<Node> m_nodes;
+
+		uint64_t m_runs = 0;
+		double m_runSeconds = 0;
+	};
+}
@@ -84,13 +84,13 @@ try {
 
 		if (guiData.renderType == RenderGuiData::RenderType::OpenGL)
 		{
-			RenderOpengl openglRender;
+			RenderOpengl openglRender{ guiData.settings };
 			Scene scene{ openglRender, guiData };
 			guiData.averageFps = scene.run();
 		}
 		else if (guiData.renderType == RenderGuiData::RenderType::Vulkan)
 		{
-			RenderVulkan vulkanRender;
+			RenderVulkan vulkanRender{ guiData.settings };
 			Scene scene{ vulkanRender, guiData };
 			guiData.averageFps = scene.run();
 		}